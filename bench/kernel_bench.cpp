@@ -0,0 +1,257 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+
+#include "scene.h"
+#include "sphere.h"
+#include "triangle.h"
+#include "aabb.h"
+#include "image.h"
+#include "timer.h"
+
+using namespace RayTracer;
+
+namespace {
+
+#define KERNEL_INPUT_COUNT 4096
+
+/// Accumulates kernel results so the compiler cannot discard the work being measured
+volatile float sink;
+
+float Uniform(std::mt19937& rng, float min, float max) {
+    return min + (max - min) * (float)(rng() / 4294967296.0);
+}
+
+Vector3 RandomPoint(std::mt19937& rng, float extent) {
+    return Vector3(Uniform(rng, -extent, extent), Uniform(rng, -extent, extent), Uniform(rng, -extent, extent));
+}
+
+/// Timing settings shared by all kernels
+struct BenchSettings {
+    int warmupRepetitions = 3;
+    int repetitions = 15;
+    int passesPerRepetition = 50;
+};
+
+/// Runs a kernel over all its pre-generated inputs several times, returning a JSON
+/// object with per-operation timing statistics over the measured repetitions
+std::string Measure(const std::string& name, const BenchSettings& settings, size_t opsPerPass, std::function<float()> pass) {
+    float accumulator = 0;
+    for (int i = 0; i < settings.warmupRepetitions; i++)
+        for (int p = 0; p < settings.passesPerRepetition; p++)
+            accumulator += pass();
+
+    std::vector<double> nsPerOp;
+    for (int r = 0; r < settings.repetitions; r++) {
+        Timer timer;
+        for (int p = 0; p < settings.passesPerRepetition; p++)
+            accumulator += pass();
+        double seconds = timer.Seconds();
+        nsPerOp.push_back(seconds * 1e9 / (opsPerPass * settings.passesPerRepetition));
+    }
+    sink = accumulator;
+
+    std::sort(nsPerOp.begin(), nsPerOp.end());
+    double mean = 0;
+    for (double ns : nsPerOp) mean += ns;
+    mean /= nsPerOp.size();
+    double variance = 0;
+    for (double ns : nsPerOp) variance += (ns - mean)*(ns - mean);
+    double stddev = std::sqrt(variance / nsPerOp.size());
+    double median = nsPerOp[nsPerOp.size()/2];
+
+    std::ostringstream json;
+    json << "{\"kernel\": \"" << name << "\""
+        << ", \"ops_per_repetition\": " << opsPerPass * settings.passesPerRepetition
+        << ", \"warmup_repetitions\": " << settings.warmupRepetitions
+        << ", \"repetitions\": " << settings.repetitions
+        << ", \"ns_per_op\": {"
+            << "\"median\": " << median
+            << ", \"mean\": " << mean
+            << ", \"min\": " << nsPerOp.front()
+            << ", \"max\": " << nsPerOp.back()
+            << ", \"stddev\": " << stddev << "}"
+        << ", \"mops_per_second\": " << (median > 0 ? 1e3 / median : 0)
+        << "}";
+    std::cerr << "microbench: " << name << " " << median << " ns/op\n";
+    return json.str();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    BenchSettings settings;
+    std::string outputFileName;
+    std::string filter;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        try {
+            if (arg == "--repetitions" && i+1 < argc) {
+                settings.repetitions = std::max(1, std::stoi(argv[++i]));
+            } else if (arg == "--warmup" && i+1 < argc) {
+                settings.warmupRepetitions = std::max(0, std::stoi(argv[++i]));
+            } else if (arg == "--filter" && i+1 < argc) {
+                filter = argv[++i];
+            } else if (arg == "--out" && i+1 < argc) {
+                outputFileName = argv[++i];
+            } else {
+                throw std::invalid_argument(arg);
+            }
+        } catch (std::invalid_argument& e) {
+            std::cout << "usage: raytracer-microbench [--repetitions n] [--warmup n] [--filter name] [--out file]\n"
+                << "--repetitions n - number of measured repetitions per kernel (default 15)\n"
+                << "--warmup n - number of unmeasured warm-up repetitions per kernel (default 3)\n"
+                << "--filter name - only run kernels whose name contains the given string\n"
+                << "--out file - also write results to a file\n"
+                << "Results are printed as a JSON array with one object per kernel.\n";
+            return -1;
+        }
+    }
+
+    // ----- Fixed inputs, generated once from a fixed seed -----
+    std::mt19937 rng(1);
+    const float extent = 20;
+    std::vector<Ray> rays;
+    for (int i = 0; i < KERNEL_INPUT_COUNT; i++) {
+        // Rays start outside the primitive volume and aim at a random point within it
+        Vector3 origin = Vector3::Normalize(RandomPoint(rng, 1)) * (2*extent);
+        rays.push_back(Ray(origin, RandomPoint(rng, extent) - origin));
+    }
+    std::vector<AABB> boxes;
+    std::vector<Sphere> spheres;
+    std::vector<Triangle> triangles;
+    for (int i = 0; i < KERNEL_INPUT_COUNT; i++) {
+        Vector3 center = RandomPoint(rng, extent/4);
+        float radius = Uniform(rng, 1, 4);
+        boxes.push_back(AABB(center, radius));
+        spheres.push_back(Sphere(center, radius, 0, -1));
+        Vector3 vertices[3] = { center + RandomPoint(rng, 4), center + RandomPoint(rng, 4), center + RandomPoint(rng, 4) };
+        Vector3 normals[3];
+        Vector3 texCoords[3];
+        triangles.push_back(Triangle(vertices, normals, texCoords, 0, -1));
+    }
+    struct ShadingInput { Vector3 L, N, I, Od, Os; };
+    std::vector<ShadingInput> shadingInputs;
+    for (int i = 0; i < KERNEL_INPUT_COUNT; i++) {
+        ShadingInput input;
+        input.L = Vector3::Normalize(RandomPoint(rng, 1));
+        input.N = Vector3::Normalize(RandomPoint(rng, 1));
+        input.I = Vector3::Normalize(RandomPoint(rng, 1));
+        input.Od = Vector3(Uniform(rng, 0, 1), Uniform(rng, 0, 1), Uniform(rng, 0, 1));
+        input.Os = Vector3(1, 1, 1);
+        shadingInputs.push_back(input);
+    }
+    Image texture(512, 512);
+    for (int y = 0; y < texture.Height(); y++)
+        for (int x = 0; x < texture.Width(); x++)
+            texture.SetPixel(x, y, Color(Uniform(rng, 0, 1), Uniform(rng, 0, 1), Uniform(rng, 0, 1)));
+    std::vector<std::pair<float, float>> texCoords;
+    for (int i = 0; i < KERNEL_INPUT_COUNT; i++)
+        texCoords.push_back({ Uniform(rng, 0, 1), Uniform(rng, 0, 1) });
+    Scene scene;
+    Scene unclusteredScene;
+    unclusteredScene.SetLeafClusters(false);
+    for (int i = 0; i < 10*KERNEL_INPUT_COUNT; i++) {
+        Vector3 center = RandomPoint(rng, extent);
+        float radius = Uniform(rng, 0.1f, 0.5f);
+        scene.AddObjectToScene(new Sphere(center, radius, 0, -1));
+        unclusteredScene.AddObjectToScene(new Sphere(center, radius, 0, -1));
+    }
+    scene.ConstructBVH();
+    unclusteredScene.ConstructBVH();
+
+    // ----- Kernels -----
+    std::vector<std::pair<std::string, std::function<std::string()>>> kernels;
+    kernels.push_back({ "AABB::IntersectsRay", [&]() {
+        return Measure("AABB::IntersectsRay", settings, rays.size(), [&]() {
+            float hits = 0;
+            for (size_t i = 0; i < rays.size(); i++)
+                hits += boxes[i].IntersectsRay(rays[i]) ? 1 : 0;
+            return hits;
+        });
+    }});
+    kernels.push_back({ "Sphere::IntersectRay", [&]() {
+        return Measure("Sphere::IntersectRay", settings, rays.size(), [&]() {
+            float distance = 0;
+            for (size_t i = 0; i < rays.size(); i++) {
+                RaycastHit hit = spheres[i].IntersectRay(rays[i]);
+                if (hit.hit) distance += hit.distance;
+            }
+            return distance;
+        });
+    }});
+    kernels.push_back({ "Triangle::IntersectRay", [&]() {
+        return Measure("Triangle::IntersectRay", settings, rays.size(), [&]() {
+            float distance = 0;
+            for (size_t i = 0; i < rays.size(); i++) {
+                RaycastHit hit = triangles[i].IntersectRay(rays[i]);
+                if (hit.hit) distance += hit.distance;
+            }
+            return distance;
+        });
+    }});
+    kernels.push_back({ "Scene::RaycastBVH", [&]() {
+        BenchSettings traversalSettings = settings;
+        traversalSettings.passesPerRepetition = 2;
+        return Measure("Scene::RaycastBVH", traversalSettings, rays.size(), [&]() {
+            float distance = 0;
+            for (size_t i = 0; i < rays.size(); i++) {
+                RaycastHit hit = scene.Raycast(rays[i]);
+                if (hit.hit) distance += hit.distance;
+            }
+            return distance;
+        });
+    }});
+    kernels.push_back({ "Scene::RaycastBVH/unclustered", [&]() {
+        BenchSettings traversalSettings = settings;
+        traversalSettings.passesPerRepetition = 2;
+        return Measure("Scene::RaycastBVH/unclustered", traversalSettings, rays.size(), [&]() {
+            float distance = 0;
+            for (size_t i = 0; i < rays.size(); i++) {
+                RaycastHit hit = unclusteredScene.Raycast(rays[i]);
+                if (hit.hit) distance += hit.distance;
+            }
+            return distance;
+        });
+    }});
+    kernels.push_back({ "Scene::ComputeDiffuseSpecular", [&]() {
+        return Measure("Scene::ComputeDiffuseSpecular", settings, shadingInputs.size(), [&]() {
+            float sum = 0;
+            for (const ShadingInput& in : shadingInputs)
+                sum += Scene::ComputeDiffuseSpecular(in.L, in.N, in.I, in.Od, in.Os, 0.1f, 0.6f, 0.3f, 20).x();
+            return sum;
+        });
+    }});
+    kernels.push_back({ "Image::GetPixel", [&]() {
+        return Measure("Image::GetPixel", settings, texCoords.size(), [&]() {
+            float sum = 0;
+            for (const auto& uv : texCoords)
+                sum += texture.GetPixel(uv.first, uv.second).r();
+            return sum;
+        });
+    }});
+
+    std::ostringstream results;
+    results << "[\n";
+    bool first = true;
+    for (auto& kernel : kernels) {
+        if (!filter.empty() && kernel.first.find(filter) == std::string::npos)
+            continue;
+        results << (first ? "  " : ",\n  ") << kernel.second();
+        first = false;
+    }
+    results << "\n]\n";
+
+    std::cout << results.str();
+    if (!outputFileName.empty()) {
+        std::ofstream outputFile(outputFileName, std::ios::out);
+        outputFile << results.str();
+    }
+    return 0;
+}
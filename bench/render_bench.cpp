@@ -0,0 +1,151 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include "scene_generator.h"
+#include "scene.h"
+#include "timer.h"
+
+using namespace RayTracer;
+
+namespace {
+
+/// A single benchmark configuration
+struct BenchCase {
+    std::string name;
+    int size;
+    std::string sceneDescription;
+};
+
+double RaysPerSecond(uint64_t rays, double seconds) {
+    return seconds > 0 ? rays / seconds : 0;
+}
+
+/// Loads, builds and renders the given case, returning its results as a JSON object
+std::string RunCase(const BenchCase& benchCase, const std::string& scratchDir, bool softShadows, bool depthOfField) {
+    std::string sceneFileName = scratchDir + "/bench-" + benchCase.name + "-" + std::to_string(benchCase.size) + ".txt";
+    SceneGenerator::WriteScene(sceneFileName, benchCase.sceneDescription);
+
+    Timer totalTimer;
+    std::ifstream sceneFile(sceneFileName);
+    Scene scene(softShadows, depthOfField);
+    SceneInitStatus status = scene.InitFromFile(sceneFile);
+    std::remove(sceneFileName.c_str());
+    if (status != Success) {
+        std::cerr << "bench: failed to load " << benchCase.name << ": " << sceneInitStatusText[status] << "\n";
+        return "";
+    }
+    scene.ConstructBVH();
+    Image image = scene.Render();
+    double totalSeconds = totalTimer.Seconds();
+
+    const RenderStats& stats = scene.Stats();
+    uint64_t totalRays = stats.cameraRays + stats.shadowRays + stats.reflectionRays + stats.refractionRays;
+    std::ostringstream json;
+    json << "{\"scene\": \"" << benchCase.name << "\""
+        << ", \"size\": " << benchCase.size
+        << ", \"objects\": " << scene.ObjectCount()
+        << ", \"width\": " << image.Width()
+        << ", \"height\": " << image.Height()
+        << ", \"soft_shadows\": " << (softShadows ? "true" : "false")
+        << ", \"depth_of_field\": " << (depthOfField ? "true" : "false")
+        << ", \"seconds\": {"
+            << "\"parse\": " << stats.parseSeconds
+            << ", \"texture_load\": " << stats.textureLoadSeconds
+            << ", \"bvh_build\": " << stats.bvhBuildSeconds
+            << ", \"render\": " << stats.renderSeconds
+            << ", \"total\": " << totalSeconds << "}"
+        << ", \"rays\": {"
+            << "\"camera\": " << stats.cameraRays
+            << ", \"shadow\": " << stats.shadowRays
+            << ", \"reflection\": " << stats.reflectionRays
+            << ", \"refraction\": " << stats.refractionRays
+            << ", \"total\": " << totalRays << "}"
+        << ", \"rays_per_render_second\": {"
+            << "\"camera\": " << RaysPerSecond(stats.cameraRays, stats.renderSeconds)
+            << ", \"shadow\": " << RaysPerSecond(stats.shadowRays, stats.renderSeconds)
+            << ", \"reflection\": " << RaysPerSecond(stats.reflectionRays, stats.renderSeconds)
+            << ", \"refraction\": " << RaysPerSecond(stats.refractionRays, stats.renderSeconds)
+            << ", \"total\": " << RaysPerSecond(totalRays, stats.renderSeconds) << "}"
+        << "}";
+    return json.str();
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+    bool quick = false;
+    bool softShadows = false;
+    bool depthOfField = false;
+    std::string scratchDir = ".";
+    std::string outputFileName;
+    std::string filter;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--quick") {
+            quick = true;
+        } else if (arg == "--softshadows") {
+            softShadows = true;
+        } else if (arg == "--dof") {
+            depthOfField = true;
+        } else if (arg == "--scratch" && i+1 < argc) {
+            scratchDir = argv[++i];
+        } else if (arg == "--out" && i+1 < argc) {
+            outputFileName = argv[++i];
+        } else if (arg == "--filter" && i+1 < argc) {
+            filter = argv[++i];
+        } else {
+            std::cout << "usage: raytracer-bench [--quick] [--softshadows] [--dof] [--filter name] [--scratch dir] [--out file]\n"
+                << "--quick - only run the smallest size of each scene\n"
+                << "--softshadows, --dof - enable soft shadows or depth of field while rendering\n"
+                << "--filter name - only run scenes whose name contains the given string\n"
+                << "--scratch dir - directory for temporary scene and texture files (default .)\n"
+                << "--out file - also write results to a file\n"
+                << "Results are printed as a JSON array with one object per scene and size.\n";
+            return -1;
+        }
+    }
+
+    // Image size is kept fixed so that ray throughput is comparable between sizes
+    const int width = 160;
+    const int height = 120;
+    std::string texturePath = scratchDir + "/bench-checker.ppm";
+    SceneGenerator::WriteCheckerTexture(texturePath, 512, 16);
+
+    std::vector<int> sphereSizes = quick ? std::vector<int>{ 1000 } : std::vector<int>{ 1000, 10000, 100000 };
+    std::vector<int> gridSizes = quick ? std::vector<int>{ 32 } : std::vector<int>{ 32, 128, 512 };
+    std::vector<int> glassSizes = quick ? std::vector<int>{ 16 } : std::vector<int>{ 16, 64, 256 };
+    std::vector<BenchCase> cases;
+    for (int size : sphereSizes)
+        cases.push_back({ "spheres", size, SceneGenerator::RandomSpheres(size, width, height) });
+    for (int size : gridSizes)
+        cases.push_back({ "grid", size, SceneGenerator::TessellatedGrid(size, width, height, texturePath) });
+    for (int size : glassSizes)
+        cases.push_back({ "glass", size, SceneGenerator::GlassSpheres(size, width, height) });
+
+    std::ostringstream results;
+    results << "[\n";
+    bool first = true;
+    for (const BenchCase& benchCase : cases) {
+        if (!filter.empty() && benchCase.name.find(filter) == std::string::npos)
+            continue;
+        std::string result = RunCase(benchCase, scratchDir, softShadows, depthOfField);
+        if (result.empty())
+            continue;
+        results << (first ? "  " : ",\n  ") << result;
+        first = false;
+        std::cerr << "bench: finished " << benchCase.name << " " << benchCase.size << "\n";
+    }
+    results << "\n]\n";
+    std::remove(texturePath.c_str());
+
+    std::cout << results.str();
+    if (!outputFileName.empty()) {
+        std::ofstream outputFile(outputFileName, std::ios::out);
+        outputFile << results.str();
+    }
+    return 0;
+}
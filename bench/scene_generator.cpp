@@ -0,0 +1,124 @@
+#include "scene_generator.h"
+
+#include <random>
+#include <sstream>
+#include <fstream>
+#include <cmath>
+
+namespace RayTracer {
+
+namespace {
+
+// Returns a uniformly distributed float in [min, max) using only the
+// bit-exact std::mt19937 engine, since std distributions vary by platform
+float Uniform(std::mt19937& rng, float min, float max) {
+    return min + (max - min) * (float)(rng() / 4294967296.0);
+}
+
+}  // namespace
+
+std::string SceneGenerator::Header(int width, int height, float eyeDistance) {
+    std::ostringstream scene;
+    scene << "eye 0 0 " << eyeDistance << "\n"
+        << "viewdir 0 0 -1\n"
+        << "updir 0 1 0\n"
+        << "vfov 45\n"
+        << "imsize " << width << " " << height << "\n"
+        << "bkgcolor 0.1 0.1 0.1\n"
+        << "light 5 8 " << eyeDistance << " 1 0.8 0.8 0.8\n"
+        << "light -1 -1 -1 0 0.3 0.3 0.3\n";
+    return scene.str();
+}
+
+std::string SceneGenerator::RandomSpheres(int count, int width, int height, uint32_t seed) {
+    std::mt19937 rng(seed);
+    // Spread spheres through a cube whose volume grows with the sphere count
+    float extent = 2 * std::cbrt((float)count);
+    float radius = 0.4f;
+    std::ostringstream scene;
+    scene << Header(width, height, 3*extent);
+    for (int i = 0; i < count; i++) {
+        scene << "mtlcolor " << Uniform(rng, 0, 1) << " " << Uniform(rng, 0, 1) << " " << Uniform(rng, 0, 1)
+            << " 1 1 1 0.2 0.6 0.3 20 1 1\n";
+        scene << "sphere " << Uniform(rng, -extent, extent) << " " << Uniform(rng, -extent, extent) << " "
+            << Uniform(rng, -extent, extent) << " " << radius << "\n";
+    }
+    return scene.str();
+}
+
+std::string SceneGenerator::TessellatedGrid(int resolution, int width, int height, const std::string& texturePath) {
+    std::ostringstream scene;
+    scene << Header(width, height, 14);
+    scene << "mtlcolor 0.8 0.8 0.8 1 1 1 0.2 0.7 0.3 20 1 1\n";
+    if (!texturePath.empty())
+        scene << "texture " << texturePath << "\n";
+
+    // Vertices of a rippled grid tilted towards the camera
+    for (int j = 0; j <= resolution; j++) {
+        for (int i = 0; i <= resolution; i++) {
+            float u = i / (float)resolution;
+            float v = j / (float)resolution;
+            float x = -5 + 10*u;
+            float y = -5 + 10*v;
+            float z = -2 + 0.3f*std::sin(8*u)*std::cos(8*v) - 2*v;
+            scene << "v " << x << " " << y << " " << z << "\n";
+            scene << "vt " << u << " " << 1-v << "\n";
+        }
+    }
+    // Two triangles per grid cell
+    for (int j = 0; j < resolution; j++) {
+        for (int i = 0; i < resolution; i++) {
+            int a = j*(resolution+1) + i + 1;
+            int b = a + 1;
+            int c = a + resolution + 1;
+            int d = c + 1;
+            scene << "f " << a << "/" << a << " " << b << "/" << b << " " << d << "/" << d << "\n";
+            scene << "f " << a << "/" << a << " " << d << "/" << d << " " << c << "/" << c << "\n";
+        }
+    }
+    return scene.str();
+}
+
+std::string SceneGenerator::GlassSpheres(int count, int width, int height, uint32_t seed) {
+    std::mt19937 rng(seed);
+    float extent = 2 * std::sqrt((float)count);
+    std::ostringstream scene;
+    scene << Header(width, height, 2*extent);
+
+    // Mirror-like floor so that refracted and reflected paths keep bouncing
+    scene << "v " << -2*extent << " " << -extent << " " << -2*extent << "\n"
+        << "v " << 2*extent << " " << -extent << " " << -2*extent << "\n"
+        << "v " << 2*extent << " " << -extent << " " << 2*extent << "\n"
+        << "v " << -2*extent << " " << -extent << " " << 2*extent << "\n";
+    scene << "mtlcolor 0.3 0.3 0.3 1 1 1 0.2 0.6 0.3 50 1 3\n";
+    scene << "f 1 2 3\nf 1 3 4\n";
+
+    // Mostly transparent spheres with a range of refractive indices
+    for (int i = 0; i < count; i++) {
+        scene << "mtlcolor " << Uniform(rng, 0, 1) << " " << Uniform(rng, 0, 1) << " " << Uniform(rng, 0, 1)
+            << " 1 1 1 0.1 0.2 0.5 60 " << Uniform(rng, 0.05f, 0.3f) << " " << Uniform(rng, 1.3f, 1.8f) << "\n";
+        scene << "sphere " << Uniform(rng, -extent, extent) << " " << Uniform(rng, -extent, extent) << " "
+            << Uniform(rng, -extent, extent) << " " << Uniform(rng, 0.5f, 1.0f) << "\n";
+    }
+    return scene.str();
+}
+
+void SceneGenerator::WriteCheckerTexture(const std::string& fileName, int size, int squares) {
+    std::ofstream textureFile(fileName, std::ios::out);
+    // Header is kept on one line to match the texture files read by Image::ReadPPM
+    textureFile << "P3 " << size << " " << size << " 255\n";
+    int squareSize = std::max(1, size / squares);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            int c = ((x / squareSize + y / squareSize) % 2) ? 230 : 40;
+            textureFile << c << " " << c << " " << c << "\n";
+        }
+    }
+}
+
+void SceneGenerator::WriteScene(const std::string& fileName, const std::string& sceneDescription) {
+    std::ofstream sceneFile(fileName, std::ios::out);
+    sceneFile << sceneDescription;
+}
+
+}  // namespace RayTracer
@@ -0,0 +1,31 @@
+#ifndef SCENE_GENERATOR_H_
+#define SCENE_GENERATOR_H_
+
+#include <string>
+#include <cstdint>
+
+namespace RayTracer {
+
+/// Generates deterministic procedural scene description files for benchmarking.
+/// Every generator produces the same scene for the same arguments on every platform.
+class SceneGenerator {
+public:
+    /// Returns a scene of randomly placed and colored opaque spheres
+    static std::string RandomSpheres(int count, int width, int height, uint32_t seed = 1);
+    /// Returns a scene containing a textured, rippled grid tessellated into 2*resolution^2 triangles
+    static std::string TessellatedGrid(int resolution, int width, int height, const std::string& texturePath);
+    /// Returns a scene of randomly placed reflective and refractive glass spheres over a floor
+    static std::string GlassSpheres(int count, int width, int height, uint32_t seed = 1);
+
+    /// Writes a checkerboard texture with given size and square count in PPM format
+    static void WriteCheckerTexture(const std::string& fileName, int size, int squares);
+    /// Writes given scene description to a file
+    static void WriteScene(const std::string& fileName, const std::string& sceneDescription);
+
+private:
+    static std::string Header(int width, int height, float eyeDistance);
+};
+
+}  // namespace RayTracer
+
+#endif  // SCENE_GENERATOR_H_
@@ -25,33 +25,56 @@ AABB::AABB(Vector3 min, Vector3 max) {
     max_ = max;
 }
 
-bool AABB::IntersectsRay(Ray ray) const {
-    // Check easy cases
-    if (ray.Direction().x() == 0 && (ray.Origin().x() < min_.x() || ray.Origin().x() > max_.x()))
-        return false;
-    if (ray.Direction().y() == 0 && (ray.Origin().y() < min_.y() || ray.Origin().y() > max_.y()))
-        return false;
-    if (ray.Direction().z() == 0 && (ray.Origin().z() < min_.z() || ray.Origin().z() > max_.z()))
-        return false;
+float AABB::SurfaceArea() const {
+    Vector3 d = max_ - min_;
+    return 2*(d.x()*d.y() + d.y()*d.z() + d.z()*d.x());
+}
+
+AABB AABB::Union(const AABB& a, const AABB& b) {
+    return AABB(Vector3::Min(a.min_, b.min_), Vector3::Max(a.max_, b.max_));
+}
 
-    Vector3 inverseRayDirection = 1 / ray.Direction();
+bool AABB::Intersection(const AABB& a, const AABB& b, AABB& intersection) {
+    Vector3 min = Vector3::Max(a.min_, b.min_);
+    Vector3 max = Vector3::Min(a.max_, b.max_);
+    if (min.x() > max.x() || min.y() > max.y() || min.z() > max.z())
+        return false;
+    intersection = AABB(min, max);
+    return true;
+}
 
-    float tx1 = (min_.x() - ray.Origin().x())*inverseRayDirection.x();
-    float tx2 = (max_.x() - ray.Origin().x())*inverseRayDirection.x();
+bool AABB::operator==(const AABB& other) const {
+    return min_.x() == other.min_.x() && min_.y() == other.min_.y() && min_.z() == other.min_.z() &&
+        max_.x() == other.max_.x() && max_.y() == other.max_.y() && max_.z() == other.max_.z();
+}
 
-    float ty1 = (min_.y() - ray.Origin().y())*inverseRayDirection.y();
-    float ty2 = (max_.y() - ray.Origin().y())*inverseRayDirection.y();
+bool AABB::IntersectsRay(const Ray& ray) const {
+    // Slab test against the ray's range using its cached reciprocal direction,
+    // taking the near plane of each slab from the direction's sign. A zero
+    // direction component gives infinite slab distances, which reject the box
+    // unless the origin lies between the planes; the NaN produced when it lies
+    // exactly on one fails both comparisons and leaves the range unchanged.
+    Vector3 origin = ray.Origin();
+    Vector3 inverseDirection = ray.InverseDirection();
+    float tStart = ray.TMin();
+    float tEnd = ray.TMax();
 
-    float tz1 = (min_.z() - ray.Origin().z())*inverseRayDirection.z();
-    float tz2 = (max_.z() - ray.Origin().z())*inverseRayDirection.z();
+    float txNear = ((ray.Sign(0) ? max_ : min_).x() - origin.x())*inverseDirection.x();
+    float txFar = ((ray.Sign(0) ? min_ : max_).x() - origin.x())*inverseDirection.x();
+    if (txNear > tStart) tStart = txNear;
+    if (txFar < tEnd) tEnd = txFar;
 
-    float tStart = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::min(tz1, tz2));
-    float tEnd = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::max(tz1, tz2));
+    float tyNear = ((ray.Sign(1) ? max_ : min_).y() - origin.y())*inverseDirection.y();
+    float tyFar = ((ray.Sign(1) ? min_ : max_).y() - origin.y())*inverseDirection.y();
+    if (tyNear > tStart) tStart = tyNear;
+    if (tyFar < tEnd) tEnd = tyFar;
 
-    if (tStart > tEnd || tEnd < 0)
-        return false;
+    float tzNear = ((ray.Sign(2) ? max_ : min_).z() - origin.z())*inverseDirection.z();
+    float tzFar = ((ray.Sign(2) ? min_ : max_).z() - origin.z())*inverseDirection.z();
+    if (tzNear > tStart) tStart = tzNear;
+    if (tzFar < tEnd) tEnd = tzFar;
 
-    return true;
+    return tStart <= tEnd;
 }
 
 }  // namespace RayTracer
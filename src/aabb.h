@@ -22,7 +22,18 @@ public:
     Vector3 Min() const { return min_; }
     Vector3 Max() const { return max_; }
 
-    bool IntersectsRay(Ray ray) const;
+    /// Returns the surface area of the bounding box
+    float SurfaceArea() const;
+
+    /// Returns true if the ray enters the box within its [tMin, tMax] range
+    bool IntersectsRay(const Ray& ray) const;
+
+    /// Returns the smallest bounding box enclosing both given boxes
+    static AABB Union(const AABB& a, const AABB& b);
+    /// Computes the box shared by both given boxes, returning false if they do not overlap
+    static bool Intersection(const AABB& a, const AABB& b, AABB& intersection);
+
+    bool operator==(const AABB& other) const;
 
 private:
     Vector3 min_, max_;
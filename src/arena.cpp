@@ -0,0 +1,80 @@
+#include "arena.h"
+
+#include <cstdlib>
+#include <algorithm>
+#include <cstdint>
+#include <sys/mman.h>
+
+namespace RayTracer {
+
+Arena::Arena(bool hugePages, size_t blockSize) {
+    hugePages_ = hugePages;
+    blockSize_ = blockSize;
+}
+
+Arena::~Arena() {
+    Reset();
+}
+
+void* Arena::Allocate(size_t size, size_t alignment) {
+    // Bump allocate from the current block if the request fits
+    if (!blocks_.empty()) {
+        Block& block = blocks_.back();
+        uintptr_t start = ((uintptr_t)block.data + blockUsed_ + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        size_t end = start - (uintptr_t)block.data + size;
+        if (end <= block.size) {
+            blockUsed_ = end;
+            return (void*)start;
+        }
+    }
+
+    // Otherwise start a new block, sized to fit requests larger than a block
+    // (blocks are at least page aligned, which covers any object alignment)
+    Block block = NewBlock(std::max(size, blockSize_));
+    blocks_.push_back(block);
+    blockUsed_ = size;
+    return block.data;
+}
+
+Arena::Block Arena::NewBlock(size_t size) {
+    Block block;
+    size_t alignment = 4096;
+    if (hugePages_) {
+        // Huge pages need huge page aligned, whole huge page regions
+        alignment = HUGE_PAGE_SIZE;
+        size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    }
+    void* data = NULL;
+    if (posix_memalign(&data, alignment, size) != 0)
+        throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+    if (hugePages_)
+        madvise(data, size, MADV_HUGEPAGE);
+#endif
+    block.data = (char*)data;
+    block.size = size;
+    return block;
+}
+
+void Arena::Reset() {
+    for (const Block& block : blocks_)
+        free(block.data);
+    blocks_.clear();
+    blockUsed_ = 0;
+}
+
+void Arena::Swap(Arena& other) {
+    std::swap(blocks_, other.blocks_);
+    std::swap(blockUsed_, other.blockUsed_);
+    std::swap(blockSize_, other.blockSize_);
+    std::swap(hugePages_, other.hugePages_);
+}
+
+size_t Arena::BytesReserved() const {
+    size_t bytes = 0;
+    for (const Block& block : blocks_)
+        bytes += block.size;
+    return bytes;
+}
+
+}  // namespace RayTracer
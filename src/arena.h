@@ -0,0 +1,74 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <vector>
+#include <cstddef>
+#include <new>
+#include <utility>
+
+namespace RayTracer {
+
+#define ARENA_BLOCK_SIZE (2 << 20)
+#define HUGE_PAGE_SIZE (2 << 20)
+
+/// A region allocator that hands out memory from large contiguous blocks and
+/// frees all of it at once, for data such as scene geometry and BVH nodes
+/// that is created in bulk and discarded together.
+///
+/// Destructors of objects created in an arena are never run, so they must
+/// not own other resources. An arena is not thread safe.
+class Arena {
+public:
+
+    /// Creates an empty arena, optionally asking the kernel to back its blocks
+    /// with transparent huge pages
+    Arena(bool hugePages = false, size_t blockSize = ARENA_BLOCK_SIZE);
+    /// Frees every block
+    ~Arena();
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /// Returns size bytes of uninitialized memory with the given alignment
+    void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+    /// Constructs an object in the arena
+    template <typename T, typename... Args>
+    T* New(Args&&... args) {
+        return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+    /// Constructs a contiguous array of default constructed objects in the arena
+    template <typename T>
+    T* NewArray(size_t count) {
+        T* array = (T*)Allocate(sizeof(T) * count, alignof(T));
+        for (size_t i = 0; i < count; i++)
+            new (&array[i]) T();
+        return array;
+    }
+
+    /// Frees every block at once, invalidating everything allocated so far
+    void Reset();
+    /// Exchanges the contents of two arenas
+    void Swap(Arena& other);
+    /// Sets whether blocks allocated from now on use transparent huge pages
+    void SetHugePages(bool hugePages) { hugePages_ = hugePages; }
+    /// Returns true if blocks use transparent huge pages
+    bool HugePages() const { return hugePages_; }
+    /// Returns the total size of the blocks held by the arena
+    size_t BytesReserved() const;
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    Block NewBlock(size_t size);
+
+    std::vector<Block> blocks_;
+    size_t blockUsed_ = 0;
+    size_t blockSize_;
+    bool hugePages_;
+};
+
+}  // namespace RayTracer
+
+#endif  // ARENA_H_
@@ -0,0 +1,515 @@
+#include "bvh_builder.h"
+
+#include <algorithm>
+#include <future>
+#include <limits>
+#include <thread>
+
+namespace RayTracer {
+
+namespace {
+
+// Bounds grown one box at a time, starting from nothing rather than from the
+// point at the origin that AABB() describes
+struct BinBounds {
+    AABB box;
+    bool empty = true;
+
+    void Grow(const AABB& other) {
+        box = empty ? other : AABB::Union(box, other);
+        empty = false;
+    }
+    float Area() const { return empty ? 0 : box.SurfaceArea(); }
+};
+
+// Returns the box limited to [lower, upper] along the axis
+AABB ClampAxis(const AABB& box, int axis, float lower, float upper) {
+    float min[3] = { box.Min().x(), box.Min().y(), box.Min().z() };
+    float max[3] = { box.Max().x(), box.Max().y(), box.Max().z() };
+    min[axis] = std::max(min[axis], lower);
+    max[axis] = std::min(max[axis], upper);
+    return AABB(Vector3(min[0], min[1], min[2]), Vector3(max[0], max[1], max[2]));
+}
+
+float Centroid(const AABB& box, int axis) {
+    return 0.5f * (box.Min()[axis] + box.Max()[axis]);
+}
+
+}  // namespace
+
+BVHBuilder::BVHBuilder(BVHBuildMode mode, int threadCount) {
+    mode_ = mode;
+    threadCount_ = threadCount > 0 ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+    // Spawn subtrees down to the depth where there is at least one per thread
+    parallelDepth_ = 0;
+    while ((1 << parallelDepth_) < threadCount_)
+        parallelDepth_++;
+}
+
+BVHNode* BVHBuilder::Build(const std::vector<SceneObject*>& sceneObjects, Arena& arena, size_t* nodeCount) const {
+    if (mode_ == SpatialSplitBVH && sceneObjects.size() > 0) {
+        size_t spatialNodeCount;
+        BVHNode* root = BuildSpatialSplit(sceneObjects, arena, spatialNodeCount);
+        if (nodeCount != NULL)
+            *nodeCount = spatialNodeCount;
+        return root;
+    }
+    if (nodeCount != NULL)
+        *nodeCount = NodeCount(sceneObjects.size());
+    BVHNode* nodes = arena.NewArray<BVHNode>(NodeCount(sceneObjects.size()));
+    // Special Case: Empty scene
+    if (sceneObjects.size() == 0)
+        return nodes;
+
+    // Cache bounds and centroids so they are not recomputed at every level
+    std::vector<BuildObject> objects(sceneObjects.size());
+    std::vector<std::thread> threads;
+    size_t chunkSize = (objects.size() + threadCount_ - 1) / threadCount_;
+    for (size_t start = 0; start < objects.size(); start += chunkSize) {
+        size_t stop = std::min(objects.size(), start + chunkSize);
+        threads.push_back(std::thread([&objects, &sceneObjects, start, stop]() {
+            for (size_t i = start; i < stop; i++) {
+                objects[i].object = sceneObjects[i];
+                objects[i].bounds = sceneObjects[i]->BoundingBox();
+                objects[i].centroid = sceneObjects[i]->Position();
+                objects[i].mortonCode = 0;
+            }
+        }));
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    if (mode_ == LinearBVH) {
+        ComputeMortonCodes(objects);
+        SortByMortonCode(objects);
+        return BuildLinear(objects, 0, objects.size(), 0, nodes);
+    }
+    return BuildMedianSplit(objects, 0, objects.size(), 0, nodes);
+}
+
+bool BVHBuilder::SpawnSubtree(size_t objectCount, int depth) const {
+    return threadCount_ > 1 && depth < parallelDepth_ && objectCount >= PARALLEL_BUILD_MIN_OBJECTS;
+}
+
+BVHNode* BVHBuilder::BuildMedianSplit(std::vector<BuildObject>& objects, size_t begin, size_t end, int depth, BVHNode* node) const {
+    // Special Case: Leaf node
+    if (end - begin == 1)
+        return new (node) BVHNode(objects[begin].bounds, objects[begin].object);
+
+    // Construct an AABB surrounding all the given objects
+    AABB aabb = objects[begin].bounds;
+    for (size_t i = begin+1; i < end; i++)
+        aabb = AABB::Union(aabb, objects[i].bounds);
+
+    // Split the objects in half along the longest side of the AABB,
+    // partitioning in place around the median rather than fully sorting
+    Vector3 dims = aabb.Max()-aabb.Min();
+    float longestAxis = std::max(dims.x(), std::max(dims.y(), dims.z()));
+    int axis = dims.x() == longestAxis ? 0 : (dims.y() == longestAxis ? 1 : 2);
+    size_t mid = begin + (end-begin)/2;
+    std::nth_element(objects.begin()+begin, objects.begin()+mid, objects.begin()+end,
+        [axis](const BuildObject& a, const BuildObject& b) {
+            if (axis == 0) return a.centroid.x() < b.centroid.x();
+            if (axis == 1) return a.centroid.y() < b.centroid.y();
+            return a.centroid.z() < b.centroid.z();
+        });
+
+    // Build large subtrees concurrently. The left subtree takes the 2*(mid-begin)-1
+    // nodes after this one and the right subtree the nodes after that.
+    BVHNode* leftNode = node + 1;
+    BVHNode* rightNode = node + 2*(mid-begin);
+    BVHNode* left;
+    BVHNode* right;
+    if (SpawnSubtree(end-begin, depth)) {
+        std::future<BVHNode*> leftFuture = std::async(std::launch::async,
+            &BVHBuilder::BuildMedianSplit, this, std::ref(objects), begin, mid, depth+1, leftNode);
+        right = BuildMedianSplit(objects, mid, end, depth+1, rightNode);
+        left = leftFuture.get();
+    } else {
+        left = BuildMedianSplit(objects, begin, mid, depth+1, leftNode);
+        right = BuildMedianSplit(objects, mid, end, depth+1, rightNode);
+    }
+    return new (node) BVHNode(aabb, left, right);
+}
+
+BVHNode* BVHBuilder::BuildLinear(std::vector<BuildObject>& objects, size_t begin, size_t end, int depth, BVHNode* node) const {
+    // Special Case: Leaf node
+    if (end - begin == 1)
+        return new (node) BVHNode(objects[begin].bounds, objects[begin].object);
+
+    // Split where the highest differing Morton code bit flips, or in the middle
+    // if every code in the range is identical
+    uint32_t first = objects[begin].mortonCode;
+    uint32_t last = objects[end-1].mortonCode;
+    size_t split;
+    if (first == last) {
+        split = begin + (end-begin)/2;
+    } else {
+        int highestBit = 31;
+        while (((first ^ last) & (1u << highestBit)) == 0)
+            highestBit--;
+        uint32_t mask = 1u << highestBit;
+        split = std::partition_point(objects.begin()+begin, objects.begin()+end,
+            [mask](const BuildObject& o) { return (o.mortonCode & mask) == 0; }) - objects.begin();
+    }
+
+    BVHNode* leftNode = node + 1;
+    BVHNode* rightNode = node + 2*(split-begin);
+    BVHNode* left;
+    BVHNode* right;
+    if (SpawnSubtree(end-begin, depth)) {
+        std::future<BVHNode*> leftFuture = std::async(std::launch::async,
+            &BVHBuilder::BuildLinear, this, std::ref(objects), begin, split, depth+1, leftNode);
+        right = BuildLinear(objects, split, end, depth+1, rightNode);
+        left = leftFuture.get();
+    } else {
+        left = BuildLinear(objects, begin, split, depth+1, leftNode);
+        right = BuildLinear(objects, split, end, depth+1, rightNode);
+    }
+    // Bounds are gathered bottom-up from the children
+    return new (node) BVHNode(AABB::Union(left->BoundingBox(), right->BoundingBox()), left, right);
+}
+
+BVHNode* BVHBuilder::BuildSpatialSplit(const std::vector<SceneObject*>& sceneObjects, Arena& arena, size_t& nodeCount) const {
+    std::vector<Reference> references(sceneObjects.size());
+    AABB bounds = sceneObjects[0]->BoundingBox();
+    for (size_t i = 0; i < sceneObjects.size(); i++) {
+        references[i].object = sceneObjects[i];
+        references[i].bounds = sceneObjects[i]->BoundingBox();
+        bounds = AABB::Union(bounds, references[i].bounds);
+    }
+    float minOverlapArea = SBVH_SPLIT_ALPHA * bounds.SurfaceArea();
+    size_t referenceBudget = (size_t)(SBVH_REFERENCE_BUDGET * sceneObjects.size());
+    std::vector<SplitNode> splitNodes;
+    splitNodes.reserve(2*sceneObjects.size());
+    SplitReferences(references, bounds, minOverlapArea, referenceBudget, splitNodes);
+
+    // Construct back to front so children exist before the parents linking them
+    nodeCount = splitNodes.size();
+    BVHNode* nodes = arena.NewArray<BVHNode>(nodeCount);
+    for (size_t i = nodeCount; i-- > 0;) {
+        const SplitNode& node = splitNodes[i];
+        if (node.leaf != NULL)
+            new (&nodes[i]) BVHNode(node.bounds, node.leaf);
+        else
+            new (&nodes[i]) BVHNode(node.bounds, &nodes[i+1], &nodes[node.right]);
+    }
+    return nodes;
+}
+
+void BVHBuilder::SplitReferences(std::vector<Reference>& references, const AABB& bounds, float minOverlapArea,
+    size_t& referenceBudget, std::vector<SplitNode>& nodes) const {
+    size_t index = nodes.size();
+    nodes.push_back(SplitNode{ bounds, NULL, 0 });
+    // Special Case: Leaf node
+    if (references.size() == 1) {
+        nodes[index].leaf = references[0].object;
+        return;
+    }
+
+    // Only look for a spatial split where the best object split leaves children
+    // that overlap noticeably, since that is where splitting objects can help
+    AABB centroidBounds;
+    SplitCandidate objectSplit = FindObjectSplit(references, centroidBounds);
+    std::vector<Reference> left, right;
+    bool split = false;
+    AABB overlap;
+    if (objectSplit.axis >= 0 && referenceBudget > 0 &&
+        AABB::Intersection(objectSplit.left, objectSplit.right, overlap) && overlap.SurfaceArea() > minOverlapArea) {
+        SplitCandidate spatialSplit = FindSpatialSplit(references, bounds);
+        if (spatialSplit.axis >= 0 && spatialSplit.cost < objectSplit.cost &&
+            PartitionSpatial(references, bounds, spatialSplit, left, right)) {
+            size_t added = left.size() + right.size() - references.size();
+            referenceBudget -= std::min(added, referenceBudget);
+            split = true;
+        }
+    }
+    if (!split)
+        PartitionObjects(references, objectSplit, centroidBounds, left, right);
+    references.clear();
+    references.shrink_to_fit();
+
+    // Children get the bounds of what they actually hold, which after clipping
+    // can be well inside the bounds the split was costed with
+    AABB leftBounds = left[0].bounds;
+    for (const Reference& reference : left)
+        leftBounds = AABB::Union(leftBounds, reference.bounds);
+    AABB rightBounds = right[0].bounds;
+    for (const Reference& reference : right)
+        rightBounds = AABB::Union(rightBounds, reference.bounds);
+    SplitReferences(left, leftBounds, minOverlapArea, referenceBudget, nodes);
+    nodes[index].right = nodes.size();
+    SplitReferences(right, rightBounds, minOverlapArea, referenceBudget, nodes);
+}
+
+BVHBuilder::SplitCandidate BVHBuilder::FindObjectSplit(const std::vector<Reference>& references, AABB& centroidBounds) const {
+    SplitCandidate best;
+    best.cost = std::numeric_limits<float>::infinity();
+    best.axis = -1;
+    best.bin = 0;
+    best.leftCount = best.rightCount = 0;
+
+    Vector3 centroidMin = 0.5f * (references[0].bounds.Min() + references[0].bounds.Max());
+    Vector3 centroidMax = centroidMin;
+    for (const Reference& reference : references) {
+        Vector3 centroid = 0.5f * (reference.bounds.Min() + reference.bounds.Max());
+        centroidMin = Vector3::Min(centroidMin, centroid);
+        centroidMax = Vector3::Max(centroidMax, centroid);
+    }
+    centroidBounds = AABB(centroidMin, centroidMax);
+
+    // Bin reference centroids along each axis and sweep the planes between bins
+    for (int axis = 0; axis < 3; axis++) {
+        float extent = centroidMax[axis] - centroidMin[axis];
+        if (extent <= 0)
+            continue;
+        BinBounds bins[SBVH_BIN_COUNT];
+        size_t counts[SBVH_BIN_COUNT] = {};
+        float scale = SBVH_BIN_COUNT / extent;
+        for (const Reference& reference : references) {
+            int bin = std::min((int)((Centroid(reference.bounds, axis) - centroidMin[axis]) * scale), SBVH_BIN_COUNT - 1);
+            bins[bin].Grow(reference.bounds);
+            counts[bin]++;
+        }
+
+        BinBounds rightBins[SBVH_BIN_COUNT];
+        size_t rightCounts[SBVH_BIN_COUNT];
+        BinBounds accumulated;
+        size_t count = 0;
+        for (int bin = SBVH_BIN_COUNT - 1; bin > 0; bin--) {
+            if (!bins[bin].empty)
+                accumulated.Grow(bins[bin].box);
+            count += counts[bin];
+            rightBins[bin] = accumulated;
+            rightCounts[bin] = count;
+        }
+        accumulated = BinBounds();
+        count = 0;
+        for (int bin = 0; bin < SBVH_BIN_COUNT - 1; bin++) {
+            if (!bins[bin].empty)
+                accumulated.Grow(bins[bin].box);
+            count += counts[bin];
+            if (count == 0 || rightCounts[bin+1] == 0)
+                continue;
+            float cost = accumulated.Area() * count + rightBins[bin+1].Area() * rightCounts[bin+1];
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.bin = bin;
+                best.left = accumulated.box;
+                best.right = rightBins[bin+1].box;
+                best.leftCount = count;
+                best.rightCount = rightCounts[bin+1];
+            }
+        }
+    }
+    return best;
+}
+
+BVHBuilder::SplitCandidate BVHBuilder::FindSpatialSplit(const std::vector<Reference>& references, const AABB& bounds) const {
+    SplitCandidate best;
+    best.cost = std::numeric_limits<float>::infinity();
+    best.axis = -1;
+    best.bin = 0;
+    best.leftCount = best.rightCount = 0;
+
+    // Bin the clipped parts of each reference into every bin it spans, counting
+    // it as entering at its first bin and leaving at its last
+    for (int axis = 0; axis < 3; axis++) {
+        float origin = bounds.Min()[axis];
+        float binWidth = (bounds.Max()[axis] - origin) / SBVH_BIN_COUNT;
+        if (binWidth <= 0)
+            continue;
+        BinBounds bins[SBVH_BIN_COUNT];
+        size_t entries[SBVH_BIN_COUNT] = {};
+        size_t exits[SBVH_BIN_COUNT] = {};
+        for (const Reference& reference : references) {
+            int first = std::min(std::max((int)((reference.bounds.Min()[axis] - origin) / binWidth), 0), SBVH_BIN_COUNT - 1);
+            int last = std::min(std::max((int)((reference.bounds.Max()[axis] - origin) / binWidth), first), SBVH_BIN_COUNT - 1);
+            for (int bin = first; bin <= last; bin++) {
+                float lower = bin == first ? -std::numeric_limits<float>::infinity() : origin + bin * binWidth;
+                float upper = bin == last ? std::numeric_limits<float>::infinity() : origin + (bin+1) * binWidth;
+                AABB clipped;
+                if (reference.object->ClipBoundingBox(ClampAxis(reference.bounds, axis, lower, upper), clipped))
+                    bins[bin].Grow(clipped);
+            }
+            entries[first]++;
+            exits[last]++;
+        }
+
+        BinBounds rightBins[SBVH_BIN_COUNT];
+        size_t rightCounts[SBVH_BIN_COUNT];
+        BinBounds accumulated;
+        size_t count = 0;
+        for (int bin = SBVH_BIN_COUNT - 1; bin > 0; bin--) {
+            if (!bins[bin].empty)
+                accumulated.Grow(bins[bin].box);
+            count += exits[bin];
+            rightBins[bin] = accumulated;
+            rightCounts[bin] = count;
+        }
+        accumulated = BinBounds();
+        count = 0;
+        for (int bin = 0; bin < SBVH_BIN_COUNT - 1; bin++) {
+            if (!bins[bin].empty)
+                accumulated.Grow(bins[bin].box);
+            count += entries[bin];
+            if (count == 0 || rightCounts[bin+1] == 0)
+                continue;
+            float cost = accumulated.Area() * count + rightBins[bin+1].Area() * rightCounts[bin+1];
+            if (cost < best.cost) {
+                best.cost = cost;
+                best.axis = axis;
+                best.bin = bin;
+                best.left = accumulated.box;
+                best.right = rightBins[bin+1].box;
+                best.leftCount = count;
+                best.rightCount = rightCounts[bin+1];
+            }
+        }
+    }
+    return best;
+}
+
+bool BVHBuilder::PartitionSpatial(const std::vector<Reference>& references, const AABB& bounds, const SplitCandidate& split,
+    std::vector<Reference>& left, std::vector<Reference>& right) const {
+    int axis = split.axis;
+    float origin = bounds.Min()[axis];
+    float plane = origin + (split.bin + 1) * ((bounds.Max()[axis] - origin) / SBVH_BIN_COUNT);
+    float leftArea = split.left.SurfaceArea();
+    float rightArea = split.right.SurfaceArea();
+    for (const Reference& reference : references) {
+        if (reference.bounds.Max()[axis] <= plane) {
+            left.push_back(reference);
+            continue;
+        }
+        if (reference.bounds.Min()[axis] >= plane) {
+            right.push_back(reference);
+            continue;
+        }
+
+        // Keep a straddling reference whole on one side when that costs less than
+        // splitting it (unsplitting, Stich et al. 2009)
+        float splitCost = leftArea * split.leftCount + rightArea * split.rightCount;
+        float leftCost = AABB::Union(split.left, reference.bounds).SurfaceArea() * split.leftCount +
+            rightArea * (split.rightCount - 1);
+        float rightCost = leftArea * (split.leftCount - 1) +
+            AABB::Union(split.right, reference.bounds).SurfaceArea() * split.rightCount;
+        if (leftCost < splitCost && leftCost <= rightCost) {
+            left.push_back(reference);
+            continue;
+        }
+        if (rightCost < splitCost) {
+            right.push_back(reference);
+            continue;
+        }
+
+        float infinity = std::numeric_limits<float>::infinity();
+        Reference leftPart = { reference.object, AABB() };
+        Reference rightPart = { reference.object, AABB() };
+        bool inLeft = reference.object->ClipBoundingBox(ClampAxis(reference.bounds, axis, -infinity, plane), leftPart.bounds);
+        bool inRight = reference.object->ClipBoundingBox(ClampAxis(reference.bounds, axis, plane, infinity), rightPart.bounds);
+        if (inLeft)
+            left.push_back(leftPart);
+        if (inRight)
+            right.push_back(rightPart);
+        if (!inLeft && !inRight)
+            left.push_back(reference);
+    }
+
+    // A side may keep every reference, since their clipped bounds still shrink;
+    // each such split adds the other side's references, so the budget still ends
+    // the recursion. A side left empty would not.
+    if (left.empty() || right.empty()) {
+        left.clear();
+        right.clear();
+        return false;
+    }
+    return true;
+}
+
+void BVHBuilder::PartitionObjects(const std::vector<Reference>& references, const SplitCandidate& split,
+    const AABB& centroidBounds, std::vector<Reference>& left, std::vector<Reference>& right) const {
+    // Special Case: Every centroid in the same place, so split in the middle
+    if (split.axis < 0) {
+        size_t mid = references.size() / 2;
+        left.assign(references.begin(), references.begin() + mid);
+        right.assign(references.begin() + mid, references.end());
+        return;
+    }
+    int axis = split.axis;
+    float centroidMin = centroidBounds.Min()[axis];
+    float scale = SBVH_BIN_COUNT / (centroidBounds.Max()[axis] - centroidMin);
+    left.reserve(split.leftCount);
+    right.reserve(split.rightCount);
+    for (const Reference& reference : references) {
+        int bin = std::min((int)((Centroid(reference.bounds, axis) - centroidMin) * scale), SBVH_BIN_COUNT - 1);
+        if (bin <= split.bin)
+            left.push_back(reference);
+        else
+            right.push_back(reference);
+    }
+}
+
+void BVHBuilder::ComputeMortonCodes(std::vector<BuildObject>& objects) const {
+    // Quantize centroids within their bounds to a 2^10 grid per axis
+    Vector3 min = objects[0].centroid;
+    Vector3 max = objects[0].centroid;
+    for (size_t i = 1; i < objects.size(); i++) {
+        min = Vector3::Min(min, objects[i].centroid);
+        max = Vector3::Max(max, objects[i].centroid);
+    }
+    Vector3 extent = max - min;
+    float cells = (float)((1 << MORTON_BITS_PER_AXIS) - 1);
+    float sx = extent.x() > 0 ? cells / extent.x() : 0;
+    float sy = extent.y() > 0 ? cells / extent.y() : 0;
+    float sz = extent.z() > 0 ? cells / extent.z() : 0;
+    for (auto& object : objects) {
+        Vector3 p = object.centroid - min;
+        uint32_t x = (uint32_t)(p.x()*sx);
+        uint32_t y = (uint32_t)(p.y()*sy);
+        uint32_t z = (uint32_t)(p.z()*sz);
+        object.mortonCode = (ExpandBits(x) << 2) | (ExpandBits(y) << 1) | ExpandBits(z);
+    }
+}
+
+void BVHBuilder::SortByMortonCode(std::vector<BuildObject>& objects) const {
+    auto compare = [](const BuildObject& a, const BuildObject& b) { return a.mortonCode < b.mortonCode; };
+
+    // Sort one chunk per thread, then merge neighbouring chunks pairwise
+    size_t chunkCount = objects.size() >= PARALLEL_BUILD_MIN_OBJECTS ? threadCount_ : 1;
+    size_t chunkSize = (objects.size() + chunkCount - 1) / chunkCount;
+    std::vector<std::thread> threads;
+    for (size_t start = 0; start < objects.size(); start += chunkSize) {
+        size_t stop = std::min(objects.size(), start + chunkSize);
+        threads.push_back(std::thread([&objects, &compare, start, stop]() {
+            std::sort(objects.begin()+start, objects.begin()+stop, compare);
+        }));
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    for (size_t width = chunkSize; width < objects.size(); width *= 2) {
+        threads.clear();
+        for (size_t start = 0; start + width < objects.size(); start += 2*width) {
+            size_t mid = start + width;
+            size_t stop = std::min(objects.size(), start + 2*width);
+            threads.push_back(std::thread([&objects, &compare, start, mid, stop]() {
+                std::inplace_merge(objects.begin()+start, objects.begin()+mid, objects.begin()+stop, compare);
+            }));
+        }
+        for (auto& thread : threads)
+            thread.join();
+    }
+}
+
+uint32_t BVHBuilder::ExpandBits(uint32_t v) {
+    // Spreads the lower 10 bits of v so there are two zero bits between each
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+}  // namespace RayTracer
@@ -0,0 +1,111 @@
+#ifndef BVH_BUILDER_H_
+#define BVH_BUILDER_H_
+
+#include "bvh_node.h"
+#include "scene_object.h"
+#include "aabb.h"
+#include "vector3.h"
+#include "arena.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace RayTracer {
+
+#define PARALLEL_BUILD_MIN_OBJECTS 4096
+#define MORTON_BITS_PER_AXIS 10
+#define SBVH_BIN_COUNT 32
+// Spatial splits are only tried where the best object split's children overlap
+// by more than this fraction of the root's surface area
+#define SBVH_SPLIT_ALPHA 1e-5f
+// Extra object references spatial splits may add, relative to the object count
+#define SBVH_REFERENCE_BUDGET 0.5f
+
+/// Strategies available for constructing a BVH
+enum BVHBuildMode {
+    MedianSplitBVH,  // Splits each node at the object median along its longest axis
+    LinearBVH,       // Sorts objects along a Morton curve and splits on Morton code bits (fast, lower quality)
+    SpatialSplitBVH  // Binned SAH splits, also splitting space through objects (slow, highest quality)
+};
+
+/// Builds bounding volume hierarchies over scene objects, recursing over
+/// in-place partitions of a single object array and building large subtrees
+/// in parallel.
+///
+/// A tree over n objects has exactly 2n-1 nodes, so they are allocated as one
+/// array up front and each subtree fills a fixed range of it in depth first
+/// order, with every left child directly after its parent.
+///
+/// Spatial split builds are the exception: an object straddling a split plane
+/// may be clipped into both children, so a leaf holds one reference to an
+/// object with bounds around only the part of it inside the leaf, and an object
+/// may be referenced from several leaves. These trees have more nodes, still
+/// laid out depth first in one array, and are built on a single thread.
+class BVHBuilder {
+public:
+
+    /// Creates a builder using the given mode and number of threads (0 = all hardware threads)
+    BVHBuilder(BVHBuildMode mode = MedianSplitBVH, int threadCount = 0);
+
+    /// Builds a BVH over the given objects in the given arena and returns its root,
+    /// the first of nodeCount contiguous nodes
+    BVHNode* Build(const std::vector<SceneObject*>& sceneObjects, Arena& arena, size_t* nodeCount = NULL) const;
+    /// Returns the number of nodes in a BVH over the given number of objects,
+    /// unless built with spatial splits
+    static size_t NodeCount(size_t objectCount) { return objectCount > 0 ? 2*objectCount - 1 : 1; }
+
+private:
+    /// Per-object data cached for the duration of a build
+    struct BuildObject {
+        SceneObject* object;
+        AABB bounds;
+        Vector3 centroid;
+        uint32_t mortonCode;
+    };
+    /// A reference to an object, or to the part of it inside a node, in a spatial split build
+    struct Reference {
+        SceneObject* object;
+        AABB bounds;
+    };
+    /// A node of a spatial split build, stored depth first before conversion to BVHNodes
+    struct SplitNode {
+        AABB bounds;
+        SceneObject* leaf;
+        size_t right;
+    };
+    /// The best split found for a set of references. Object splits put references
+    /// with centroids in bins up to and including bin to the left; spatial splits
+    /// split space after bin.
+    struct SplitCandidate {
+        float cost;
+        int axis;
+        int bin;
+        AABB left, right;
+        size_t leftCount, rightCount;
+    };
+
+    BVHNode* BuildMedianSplit(std::vector<BuildObject>& objects, size_t begin, size_t end, int depth, BVHNode* node) const;
+    BVHNode* BuildSpatialSplit(const std::vector<SceneObject*>& sceneObjects, Arena& arena, size_t& nodeCount) const;
+    void SplitReferences(std::vector<Reference>& references, const AABB& bounds, float minOverlapArea,
+        size_t& referenceBudget, std::vector<SplitNode>& nodes) const;
+    SplitCandidate FindObjectSplit(const std::vector<Reference>& references, AABB& centroidBounds) const;
+    SplitCandidate FindSpatialSplit(const std::vector<Reference>& references, const AABB& bounds) const;
+    bool PartitionSpatial(const std::vector<Reference>& references, const AABB& bounds, const SplitCandidate& split,
+        std::vector<Reference>& left, std::vector<Reference>& right) const;
+    void PartitionObjects(const std::vector<Reference>& references, const SplitCandidate& split,
+        const AABB& centroidBounds, std::vector<Reference>& left, std::vector<Reference>& right) const;
+    BVHNode* BuildLinear(std::vector<BuildObject>& objects, size_t begin, size_t end, int depth, BVHNode* node) const;
+    void ComputeMortonCodes(std::vector<BuildObject>& objects) const;
+    void SortByMortonCode(std::vector<BuildObject>& objects) const;
+    bool SpawnSubtree(size_t objectCount, int depth) const;
+    static uint32_t ExpandBits(uint32_t v);
+
+    BVHBuildMode mode_;
+    int threadCount_;
+    int parallelDepth_;
+};
+
+}  // namespace RayTracer
+
+#endif  // BVH_BUILDER_H_
@@ -1,10 +1,17 @@
 #include "bvh_node.h"
 
+#include <cstddef>
+
 namespace RayTracer {
 
 BVHNode::BVHNode() {
     isLeaf_ = true;
     isEmpty_ = true;
+    left_ = NULL;
+    right_ = NULL;
+    parent_ = NULL;
+    cluster_ = -1;
+    leaf_ = NULL;
 }
 
 BVHNode::BVHNode(AABB aabb, BVHNode* left, BVHNode* right) {
@@ -13,21 +20,39 @@ BVHNode::BVHNode(AABB aabb, BVHNode* left, BVHNode* right) {
     aabb_ = aabb;
     left_ = left;
     right_ = right;
+    parent_ = NULL;
+    cluster_ = -1;
+    leaf_ = NULL;
+    left_->parent_ = this;
+    right_->parent_ = this;
 }
 
 BVHNode::BVHNode(AABB aabb, SceneObject* leaf) {
     isLeaf_ = true;
     isEmpty_ = false;
     aabb_ = aabb;
+    left_ = NULL;
+    right_ = NULL;
+    parent_ = NULL;
+    cluster_ = -1;
     leaf_ = leaf;
 }
 
-BVHNode::~BVHNode() {
-    if (!isLeaf_) {
-        delete left_;
-        delete right_;
+bool BVHNode::Refit() {
+    AABB aabb;
+    if (isLeaf_) {
+        if (isEmpty_) return false;
+        aabb = leaf_->BoundingBox();
+    } else if (left_->IsEmpty()) {
+        aabb = right_->BoundingBox();
+    } else if (right_->IsEmpty()) {
+        aabb = left_->BoundingBox();
+    } else {
+        aabb = AABB::Union(left_->BoundingBox(), right_->BoundingBox());
     }
+    bool changed = !(aabb == aabb_);
+    aabb_ = aabb;
+    return changed;
 }
 
-
 }  // namespace RayTracer
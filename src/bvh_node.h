@@ -6,28 +6,42 @@
 
 namespace RayTracer {
 
-/// Bounding volume hierachy node.
+/// Bounding volume hierachy node. Nodes do not own their children or leaf
+/// object; all nodes of a tree are allocated together and freed together.
 class BVHNode {
 public:
     BVHNode();
     BVHNode(AABB aabb, BVHNode* left, BVHNode* right);
     BVHNode(AABB aabb, SceneObject* leaf);
-    ~BVHNode();
 
     BVHNode* Left() const { return left_; }
     BVHNode* Right() const { return right_; }
+    BVHNode* Parent() const { return parent_; }
     bool IsLeaf() const { return isLeaf_; }
     bool IsEmpty() const { return isEmpty_; }
     SceneObject* Leaf() const { return leaf_; }
+    void SetLeaf(SceneObject* leaf) { leaf_ = leaf; }
+    AABB BoundingBox() const { return aabb_; }
+    /// Returns the index of the leaf cluster holding this subtree's objects, or -1 if none
+    int Cluster() const { return cluster_; }
+    void SetCluster(int cluster) { cluster_ = cluster; }
+    void SetBoundingBox(AABB aabb) { aabb_ = aabb; }
 
-    bool IntersectsRay(Ray ray) const { return aabb_.IntersectsRay(ray); }
+    /// Recomputes the bounds of this node from its children (or leaf object),
+    /// returning true if the bounds changed
+    bool Refit();
+
+    bool IntersectsRay(const Ray& ray) const { return aabb_.IntersectsRay(ray); }
 
 private:
     AABB aabb_;
     BVHNode* left_;
     BVHNode* right_;
+    BVHNode* parent_;
     bool isEmpty_;
     bool isLeaf_;
+    // Fits in the padding before leaf_, so nodes stay 64 bytes (80 with SIMD)
+    int cluster_;
     SceneObject* leaf_;
 };
 
@@ -0,0 +1,80 @@
+#include "bvh_report.h"
+
+#include <algorithm>
+#include <sstream>
+
+namespace RayTracer {
+
+BVHReport BVHReport::Analyze(const BVHNode* root) {
+    BVHReport report;
+    float rootArea = root->BoundingBox().SurfaceArea();
+    float leafDepthSum = 0;
+    float overlapSum = 0;
+    report.AnalyzeRecursive(root, 0, rootArea > 0 ? rootArea : 1, leafDepthSum, overlapSum);
+    int interiorCount = report.nodeCount - report.leafCount;
+    if (report.leafCount > 0)
+        report.averageLeafDepth = leafDepthSum / report.leafCount;
+    if (interiorCount > 0)
+        report.averageSiblingOverlap = overlapSum / interiorCount;
+    report.bytes = report.nodeCount * sizeof(BVHNode);
+    return report;
+}
+
+void BVHReport::AnalyzeRecursive(const BVHNode* node, int depth, float rootArea, float& leafDepthSum, float& overlapSum) {
+    nodeCount++;
+    maxDepth = std::max(maxDepth, depth);
+    float relativeArea = node->BoundingBox().SurfaceArea() / rootArea;
+
+    if (node->IsLeaf()) {
+        leafCount++;
+        leafDepthSum += depth;
+        int primitiveCount = node->IsEmpty() ? 0 : 1;
+        if (node->IsEmpty()) emptyLeafCount++;
+        leafSizes[primitiveCount]++;
+        sahCost += relativeArea * primitiveCount * SAH_INTERSECTION_COST;
+        return;
+    }
+
+    sahCost += relativeArea * SAH_TRAVERSAL_COST;
+
+    // Overlap of the two child boxes relative to their parent
+    AABB left = node->Left()->BoundingBox();
+    AABB right = node->Right()->BoundingBox();
+    Vector3 overlapMin = Vector3::Max(left.Min(), right.Min());
+    Vector3 overlapMax = Vector3::Min(left.Max(), right.Max());
+    float overlap = 0;
+    if (overlapMin.x() <= overlapMax.x() && overlapMin.y() <= overlapMax.y() && overlapMin.z() <= overlapMax.z()) {
+        float parentArea = node->BoundingBox().SurfaceArea();
+        if (parentArea > 0)
+            overlap = AABB(overlapMin, overlapMax).SurfaceArea() / parentArea;
+    }
+    overlapSum += overlap;
+    maxSiblingOverlap = std::max(maxSiblingOverlap, overlap);
+
+    AnalyzeRecursive(node->Left(), depth+1, rootArea, leafDepthSum, overlapSum);
+    AnalyzeRecursive(node->Right(), depth+1, rootArea, leafDepthSum, overlapSum);
+}
+
+std::string BVHReport::ToJSON() const {
+    std::ostringstream json;
+    json << "{\n"
+        << "  \"nodes\": " << nodeCount << ",\n"
+        << "  \"bytes\": " << bytes << ",\n"
+        << "  \"leaves\": " << leafCount << ",\n"
+        << "  \"empty_leaves\": " << emptyLeafCount << ",\n"
+        << "  \"max_depth\": " << maxDepth << ",\n"
+        << "  \"average_leaf_depth\": " << averageLeafDepth << ",\n"
+        << "  \"sah_cost\": " << sahCost << ",\n"
+        << "  \"sibling_overlap\": {\"average\": " << averageSiblingOverlap << ", \"max\": " << maxSiblingOverlap << "},\n"
+        << "  \"leaf_sizes\": {";
+    bool first = true;
+    for (auto leafSize : leafSizes) {
+        json << (first ? "" : ", ") << "\"" << leafSize.first << "\": " << leafSize.second;
+        first = false;
+    }
+    json << "}\n"
+        << "}";
+    return json.str();
+}
+
+}  // namespace RayTracer
@@ -0,0 +1,47 @@
+#ifndef BVH_REPORT_H_
+#define BVH_REPORT_H_
+
+#include "bvh_node.h"
+
+#include <map>
+#include <cstddef>
+#include <string>
+
+namespace RayTracer {
+
+#define SAH_TRAVERSAL_COST 1.0f
+#define SAH_INTERSECTION_COST 1.0f
+
+/// A struct containing quality measures of a constructed BVH, used to
+/// spot pathological geometry and compare build strategies.
+struct BVHReport {
+    int nodeCount = 0;
+    int leafCount = 0;
+    int emptyLeafCount = 0;
+    int maxDepth = 0;
+    float averageLeafDepth = 0;
+    /// Surface area heuristic cost, the expected cost of tracing a random ray
+    /// relative to a single primitive test (lower is better)
+    float sahCost = 0;
+    /// Mean over interior nodes of the overlap between sibling bounds,
+    /// relative to the surface area of the parent (0 = disjoint siblings)
+    float averageSiblingOverlap = 0;
+    /// Largest such sibling overlap
+    float maxSiblingOverlap = 0;
+    /// Number of leaves holding each number of primitives
+    std::map<int, int> leafSizes;
+    /// Memory taken by the tree that traversal walks
+    size_t bytes = 0;
+
+    /// Walks the BVH with given root and gathers its quality measures
+    static BVHReport Analyze(const BVHNode* root);
+    /// Returns the report as a JSON object
+    std::string ToJSON() const;
+
+private:
+    void AnalyzeRecursive(const BVHNode* node, int depth, float rootArea, float& leafDepthSum, float& overlapSum);
+};
+
+}  // namespace RayTracer
+
+#endif  // BVH_REPORT_H_
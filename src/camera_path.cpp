@@ -0,0 +1,108 @@
+#include "camera_path.h"
+
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+namespace RayTracer {
+
+CameraPath::CameraPath() {
+    frameCount_ = 0;
+    errorLine_ = 0;
+}
+
+bool CameraPath::InitFromFile(std::ifstream& cameraPathFile) {
+    std::string line;
+    for (int lineNumber = 1; std::getline(cameraPathFile, line); lineNumber++) {
+        std::vector<std::string> values;
+        std::istringstream iss(line);
+        for (std::string s; iss >> s; )
+            values.push_back(s);
+        if (values.empty() || values[0][0] == '#')
+            continue;
+
+        errorLine_ = lineNumber;
+        try {
+            if (values[0] == "frames" && values.size() >= 2) {
+                frameCount_ = std::stoi(values[1]);
+                if (frameCount_ < 1) return false;
+            } else if (values[0] == "key" && values.size() >= 12) {
+                float v[11];
+                for (int i = 0; i < 11; i++)
+                    v[i] = std::stof(values[i+1]);
+                Keyframe keyframe;
+                keyframe.time = v[0];
+                keyframe.eye = Vector3(v[1], v[2], v[3]);
+                keyframe.viewDirection = Vector3(v[4], v[5], v[6]);
+                keyframe.upDirection = Vector3(v[7], v[8], v[9]);
+                keyframe.fieldOfView = v[10];
+                if (keyframe.viewDirection.Length() == 0 || keyframe.upDirection.Length() == 0 || keyframe.fieldOfView <= 0)
+                    return false;
+                if (!keyframes_.empty() && keyframe.time <= keyframes_.back().time)
+                    return false;
+                keyframes_.push_back(keyframe);
+            } else {
+                return false;
+            }
+        } catch (std::invalid_argument& e) {
+            return false;
+        } catch (std::out_of_range& e) {
+            return false;
+        }
+    }
+    cameraPathFile.close();
+    errorLine_ = 0;
+    return !keyframes_.empty();
+}
+
+std::vector<Camera> CameraPath::Cameras(int width, int height) const {
+    std::vector<Camera> cameras;
+    if (frameCount_ == 0) {
+        // Discrete views
+        for (const Keyframe& k : keyframes_)
+            cameras.push_back(Camera(k.eye, k.viewDirection, k.upDirection, k.fieldOfView, width, height));
+    } else {
+        // Evenly spaced frames along the spline, from the first to the last keyframe
+        float start = keyframes_.front().time;
+        float end = keyframes_.back().time;
+        for (int frame = 0; frame < frameCount_; frame++) {
+            float time = frameCount_ == 1 ? start : start + (end - start) * frame / (frameCount_ - 1);
+            Keyframe k = Interpolate(time);
+            cameras.push_back(Camera(k.eye, k.viewDirection, k.upDirection, k.fieldOfView, width, height));
+        }
+    }
+    return cameras;
+}
+
+CameraPath::Keyframe CameraPath::Interpolate(float time) const {
+    if (keyframes_.size() == 1 || time <= keyframes_.front().time)
+        return keyframes_.front();
+    if (time >= keyframes_.back().time)
+        return keyframes_.back();
+
+    // Find the segment containing the time, clamping neighbours at the ends
+    size_t i = 1;
+    while (keyframes_[i].time < time)
+        i++;
+    const Keyframe& k1 = keyframes_[i-1];
+    const Keyframe& k2 = keyframes_[i];
+    const Keyframe& k0 = i >= 2 ? keyframes_[i-2] : k1;
+    const Keyframe& k3 = i+1 < keyframes_.size() ? keyframes_[i+1] : k2;
+    float t = (time - k1.time) / (k2.time - k1.time);
+
+    Keyframe k;
+    k.time = time;
+    k.eye = CatmullRom(k0.eye, k1.eye, k2.eye, k3.eye, t);
+    k.viewDirection = Vector3::Normalize(CatmullRom(k0.viewDirection, k1.viewDirection, k2.viewDirection, k3.viewDirection, t));
+    k.upDirection = Vector3::Normalize(CatmullRom(k0.upDirection, k1.upDirection, k2.upDirection, k3.upDirection, t));
+    k.fieldOfView = k1.fieldOfView + t*(k2.fieldOfView - k1.fieldOfView);
+    return k;
+}
+
+Vector3 CameraPath::CatmullRom(Vector3 p0, Vector3 p1, Vector3 p2, Vector3 p3, float t) {
+    float t2 = t*t;
+    float t3 = t2*t;
+    return 0.5f * ((2*p1) + (p2 - p0)*t + (2*p0 - 5*p1 + 4*p2 - p3)*t2 + (3*p1 - p0 - 3*p2 + p3)*t3);
+}
+
+}  // namespace RayTracer
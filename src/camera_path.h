@@ -0,0 +1,57 @@
+#ifndef CAMERA_PATH_H_
+#define CAMERA_PATH_H_
+
+#include "camera.h"
+#include "vector3.h"
+
+#include <vector>
+#include <fstream>
+#include <string>
+
+namespace RayTracer {
+
+/// A sequence of camera views to render from a single loaded scene, given
+/// either as a list of discrete views or as keyframes of a Catmull-Rom spline.
+///
+/// Camera path files contain one keyframe per line:
+///   key t eyex eyey eyez vdirx vdiry vdirz upx upy upz vfov
+/// and optionally a line
+///   frames n
+/// which samples n frames evenly in time along a spline through the keyframes,
+/// from the first keyframe's t to the last. The t values only place keyframes
+/// relative to each other and must increase. Without it every keyframe is
+/// rendered as-is.
+class CameraPath {
+public:
+
+    /// Creates an empty camera path
+    CameraPath();
+
+    /// Initializes the path from a camera path file, returning false if it is malformed
+    bool InitFromFile(std::ifstream& cameraPathFile);
+    /// Returns the line InitFromFile failed on, or 0 if it failed for want of keyframes
+    int ErrorLine() const { return errorLine_; }
+
+    /// Returns one camera per view to render, each with the given image size
+    std::vector<Camera> Cameras(int width, int height) const;
+
+private:
+    struct Keyframe {
+        float time;
+        Vector3 eye;
+        Vector3 viewDirection;
+        Vector3 upDirection;
+        float fieldOfView;
+    };
+
+    Keyframe Interpolate(float time) const;
+    static Vector3 CatmullRom(Vector3 p0, Vector3 p1, Vector3 p2, Vector3 p3, float t);
+
+    std::vector<Keyframe> keyframes_;
+    int frameCount_;
+    int errorLine_;
+};
+
+}  // namespace RayTracer
+
+#endif  // CAMERA_PATH_H_
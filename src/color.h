@@ -1,6 +1,8 @@
 #ifndef COLOR_H_
 #define COLOR_H_
 
+#include "vector3.h"
+
 namespace RayTracer {
 
 /// A RGB color defined by floats between 0 and 1.
@@ -8,25 +10,66 @@ class Color {
 public:
 
     /// Default constructor creates the color black
-    Color();
-    /// Creates a color with given (r, g, b)
-    Color(float r, float g, float b);
+    constexpr Color() : c_{0, 0, 0} {}
+    /// Creates a color with given (r, g, b), clamping components above 1
+    constexpr Color(float r, float g, float b) : c_{r > 1 ? 1 : r, g > 1 ? 1 : g, b > 1 ? 1 : b} {}
 
     /// Gets color r, g, and b components
-    float r() const { return r_; }
-    float g() const { return g_; }
-    float b() const { return b_; }
+    constexpr float r() const { return c_[0]; }
+    constexpr float g() const { return c_[1]; }
+    constexpr float b() const { return c_[2]; }
 
     /// Clamps the color rgb values between 0 and 1
-    void Clamp01();
+    inline void Clamp01();
+
+#ifdef RAYTRACER_SSE
+    /// Creates a color from four SSE lanes, clamping components above 1 and ignoring the last
+    explicit Color(__m128 c) {
+        // min(1, c) keeps NaN components like the scalar clamp does
+        _mm_store_ps(c_, _mm_min_ps(_mm_set1_ps(1), c));
+    }
+    /// Returns the color as four SSE lanes
+    __m128 Load() const { return _mm_load_ps(c_); }
+#endif
 
 private:
-    float r_, g_, b_;
+#ifdef RAYTRACER_SSE
+    alignas(16) float c_[4];
+#else
+    float c_[3];
+#endif
 };
 
-Color operator+(const Color& c1, const Color& c2);
+#ifdef RAYTRACER_SSE
+
+inline Color operator+(const Color& c1, const Color& c2) { return Color(_mm_add_ps(c1.Load(), c2.Load())); }
+
+inline Color operator/(const Color& c, const float s) { return Color(_mm_div_ps(c.Load(), _mm_set1_ps(s))); }
+
+inline void Color::Clamp01() {
+    // max(0, min(1, c)) matches the scalar clamp, which leaves NaN components alone
+    __m128 c = _mm_min_ps(_mm_set1_ps(1), Load());
+    _mm_store_ps(c_, _mm_max_ps(_mm_setzero_ps(), c));
+}
+
+#else
+
+constexpr Color operator+(const Color& c1, const Color& c2) {
+    return Color(c1.r() + c2.r(), c1.g() + c2.g(), c1.b() + c2.b());
+}
+
+constexpr Color operator/(const Color& c, const float s) {
+    return Color(c.r() / s, c.g() / s, c.b() / s);
+}
+
+inline void Color::Clamp01() {
+    for (int i = 0; i < 3; i++) {
+        if (c_[i] < 0) c_[i] = 0;
+        else if (c_[i] > 1) c_[i] = 1;
+    }
+}
 
-Color operator/(const Color& c, const float s);
+#endif  // RAYTRACER_SSE
 
 }  // namespace RayTracer
 
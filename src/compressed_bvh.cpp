@@ -0,0 +1,158 @@
+#include "compressed_bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace RayTracer {
+
+CompressedBVH::CompressedBVH() {
+    root_ = 0;
+}
+
+void CompressedBVH::Build(const BVHNode* root) {
+    nodes_.clear();
+    objects_.clear();
+    rootBounds_ = AABB();
+    root_ = 0;
+    if (root == NULL || root->IsEmpty())
+        return;
+    rootBounds_ = root->BoundingBox();
+    root_ = Encode(root);
+}
+
+size_t CompressedBVH::Bytes() const {
+    return nodes_.size() * sizeof(Node) + objects_.size() * sizeof(SceneObject*);
+}
+
+uint32_t CompressedBVH::Encode(const BVHNode* node) {
+    if (node->IsLeaf()) {
+        objects_.push_back(node->Leaf());
+        return COMPRESSED_BVH_LEAF_FLAG | (uint32_t)(objects_.size() - 1);
+    }
+
+    // Children are quantized on a grid spanning both of them, starting at their
+    // common minimum, with the smallest power of two cell size that reaches
+    // their common maximum in COMPRESSED_BVH_QUANTIZATION_STEPS cells
+    AABB childBounds[2] = { node->Left()->BoundingBox(), node->Right()->BoundingBox() };
+    AABB frame = AABB::Union(childBounds[0], childBounds[1]);
+    float frameMin[3] = { frame.Min().x(), frame.Min().y(), frame.Min().z() };
+    float frameMax[3] = { frame.Max().x(), frame.Max().y(), frame.Max().z() };
+    float childMin[2][3], childMax[2][3];
+    for (int side = 0; side < 2; side++) {
+        Vector3 minimum = childBounds[side].Min();
+        Vector3 maximum = childBounds[side].Max();
+        float sideMin[3] = { minimum.x(), minimum.y(), minimum.z() };
+        float sideMax[3] = { maximum.x(), maximum.y(), maximum.z() };
+        std::copy(sideMin, sideMin + 3, childMin[side]);
+        std::copy(sideMax, sideMax + 3, childMax[side]);
+    }
+    Node encoded;
+    memset(&encoded, 0, sizeof(encoded));
+    for (int axis = 0; axis < 3; axis++) {
+        float origin = frameMin[axis];
+        int exponent = -126;
+        float extent = frameMax[axis] - origin;
+        if (extent > 0) {
+            std::frexp(extent / COMPRESSED_BVH_QUANTIZATION_STEPS, &exponent);
+            exponent = std::max(exponent, -126);
+        }
+        while (exponent < 127 && origin + COMPRESSED_BVH_QUANTIZATION_STEPS * CellSize(exponent) < frameMax[axis])
+            exponent++;
+        encoded.origin[axis] = origin;
+        encoded.exponent[axis] = (int8_t)exponent;
+
+        // Round each plane outwards, checking against the exact sums that decoding
+        // computes so that float rounding can never shrink a box
+        float cellSize = CellSize(exponent);
+        for (int side = 0; side < 2; side++) {
+            float lower = childMin[side][axis];
+            float upper = childMax[side][axis];
+            int steps = COMPRESSED_BVH_QUANTIZATION_STEPS;
+            int lowerStep = std::min(std::max((int)std::floor((lower - origin) / cellSize), 0), steps);
+            while (lowerStep > 0 && origin + (float)lowerStep * cellSize > lower)
+                lowerStep--;
+            int upperStep = std::min(std::max((int)std::ceil((upper - origin) / cellSize), 0), steps);
+            while (upperStep < steps && origin + (float)upperStep * cellSize < upper)
+                upperStep++;
+            encoded.bounds[side][axis] = (uint8_t)lowerStep;
+            encoded.bounds[side][axis + 3] = (uint8_t)upperStep;
+        }
+    }
+
+    // Store nodes depth first, with every left child directly after its parent
+    uint32_t index = (uint32_t)nodes_.size();
+    nodes_.push_back(encoded);
+    uint32_t left = Encode(node->Left());
+    uint32_t right = Encode(node->Right());
+    nodes_[index].child[0] = left;
+    nodes_[index].child[1] = right;
+    return index;
+}
+
+float CompressedBVH::CellSize(int8_t exponent) {
+    // 2^exponent, built directly from its IEEE bit pattern
+    uint32_t bits = (uint32_t)(exponent + 127) << 23;
+    float cellSize;
+    memcpy(&cellSize, &bits, sizeof(cellSize));
+    return cellSize;
+}
+
+AABB CompressedBVH::ChildBounds(const Node& node, int side) const {
+    float bounds[6];
+    for (int plane = 0; plane < 6; plane++) {
+        int axis = plane % 3;
+        bounds[plane] = node.origin[axis] + (float)node.bounds[side][plane] * CellSize(node.exponent[axis]);
+    }
+    return AABB(Vector3(bounds[0], bounds[1], bounds[2]), Vector3(bounds[3], bounds[4], bounds[5]));
+}
+
+RaycastHit CompressedBVH::Raycast(Ray& ray, TraceContext& context, const SceneObject* ignoreObject) const {
+    if (IsEmpty()) {
+        context.stats.bvhNodesVisited++;
+        return RaycastHit();
+    }
+    return RaycastChild(ray, root_, rootBounds_, context, ignoreObject);
+}
+
+RaycastHit CompressedBVH::RaycastChild(Ray& ray, uint32_t child, const AABB& bounds, TraceContext& context,
+    const SceneObject* ignoreObject) const {
+    context.stats.bvhNodesVisited++;
+    if (!bounds.IntersectsRay(ray))
+        return RaycastHit();
+    if (child & COMPRESSED_BVH_LEAF_FLAG) {
+        const SceneObject* object = objects_[child & ~COMPRESSED_BVH_LEAF_FLAG];
+        if (object == ignoreObject)
+            return RaycastHit();
+        ObjectType type = object->Type();
+        if (type == SphereObject) context.stats.sphereTests++;
+        else if (type == TriangleObject) context.stats.triangleTests++;
+        else context.stats.otherTests++;
+        RaycastHit hit = object->IntersectRay(ray);
+        if (hit.hit)
+            ray.SetTMax(hit.distance);
+        return hit;
+    }
+    // Same order and tie breaking as the full precision traversal
+    const Node& node = nodes_[child];
+    RaycastHit left = RaycastChild(ray, node.child[0], ChildBounds(node, 0), context, ignoreObject);
+    RaycastHit right = RaycastChild(ray, node.child[1], ChildBounds(node, 1), context, ignoreObject);
+    return left.distance < right.distance ? left : right;
+}
+
+BVHNode* CompressedBVH::Decode(Arena& arena) const {
+    if (IsEmpty())
+        return arena.New<BVHNode>();
+    return DecodeChild(root_, rootBounds_, arena);
+}
+
+BVHNode* CompressedBVH::DecodeChild(uint32_t child, const AABB& bounds, Arena& arena) const {
+    if (child & COMPRESSED_BVH_LEAF_FLAG)
+        return arena.New<BVHNode>(bounds, objects_[child & ~COMPRESSED_BVH_LEAF_FLAG]);
+    const Node& node = nodes_[child];
+    BVHNode* left = DecodeChild(node.child[0], ChildBounds(node, 0), arena);
+    BVHNode* right = DecodeChild(node.child[1], ChildBounds(node, 1), arena);
+    return arena.New<BVHNode>(bounds, left, right);
+}
+
+}  // namespace RayTracer
@@ -0,0 +1,76 @@
+#ifndef COMPRESSED_BVH_H_
+#define COMPRESSED_BVH_H_
+
+#include "bvh_node.h"
+#include "aabb.h"
+#include "ray.h"
+#include "raycast_hit.h"
+#include "trace_context.h"
+#include "arena.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace RayTracer {
+
+#define COMPRESSED_BVH_LEAF_FLAG 0x80000000u
+#define COMPRESSED_BVH_QUANTIZATION_STEPS 255
+
+/// A compact, read-only copy of a BVH for traversal when memory is tight.
+///
+/// Each interior node stores both children's bounds quantized to 8 bits per
+/// plane on a grid spanning the node itself: a full precision origin and a
+/// power of two cell size per axis. Children are referred to by 32 bit
+/// indices, and leaves by the index of their object, so a node takes 36
+/// bytes in place of two full BVHNodes. Quantized bounds are always rounded
+/// outwards, so traversal visits every node the full precision tree would
+/// and finds the same hits, only testing a few more boxes and objects.
+class CompressedBVH {
+public:
+
+    /// Creates an empty tree that no ray hits
+    CompressedBVH();
+
+    /// Encodes the tree with the given root, replacing the current contents.
+    /// Leaves refer to the root's objects, which must outlive this tree.
+    void Build(const BVHNode* root);
+    /// Returns true if the tree holds no objects
+    bool IsEmpty() const { return objects_.empty(); }
+    /// Returns the number of bytes taken by nodes and leaf references
+    size_t Bytes() const;
+
+    /// Casts a ray through the tree, returning the nearest hit within the ray's
+    /// range and shrinking tMax to each hit found, like Scene::Raycast
+    RaycastHit Raycast(Ray& ray, TraceContext& context, const SceneObject* ignoreObject) const;
+
+    /// Expands the tree back into BVH nodes allocated in the arena, with the
+    /// quantized bounds that traversal tests, e.g. to analyze its quality
+    BVHNode* Decode(Arena& arena) const;
+
+private:
+    struct Node {
+        float origin[3];
+        int8_t exponent[3];
+        uint8_t padding;
+        // Lower then upper grid planes (x, y, z) of the left and right child
+        uint8_t bounds[2][6];
+        uint32_t child[2];
+    };
+
+    uint32_t Encode(const BVHNode* node);
+    AABB ChildBounds(const Node& node, int side) const;
+    RaycastHit RaycastChild(Ray& ray, uint32_t child, const AABB& bounds, TraceContext& context,
+        const SceneObject* ignoreObject) const;
+    BVHNode* DecodeChild(uint32_t child, const AABB& bounds, Arena& arena) const;
+    static float CellSize(int8_t exponent);
+
+    std::vector<Node> nodes_;
+    std::vector<SceneObject*> objects_;
+    AABB rootBounds_;
+    uint32_t root_;
+};
+
+}  // namespace RayTracer
+
+#endif  // COMPRESSED_BVH_H_
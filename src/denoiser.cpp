@@ -0,0 +1,104 @@
+#include "denoiser.h"
+#include "thread_pool.h"
+
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+
+namespace RayTracer {
+
+namespace {
+
+// Squared length of the difference of two vectors
+float DistanceSquared(const Vector3& a, const Vector3& b) {
+    Vector3 d = a - b;
+    return Vector3::Dot(d, d);
+}
+
+}  // namespace
+
+Denoiser::Denoiser(int threadCount) {
+    threadCount_ = threadCount;
+}
+
+Image Denoiser::Denoise(const Image& image, const RenderFeatures& features) const {
+    int width = image.Width();
+    int height = image.Height();
+    size_t pixelCount = (size_t)width * height;
+
+    // Unpack the image and its features into flat buffers
+    std::vector<Vector3> color(pixelCount), albedo(pixelCount), normal(pixelCount);
+    std::vector<float> depth(pixelCount);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            size_t i = x + (size_t)y * width;
+            Color c = image.GetPixel(x, y);
+            Color a = features.albedo.GetPixel(x, y);
+            Color n = features.normal.GetPixel(x, y);
+            color[i] = Vector3(c.r(), c.g(), c.b());
+            albedo[i] = Vector3(a.r(), a.g(), a.b());
+            normal[i] = 2*Vector3(n.r(), n.g(), n.b()) - Vector3(1, 1, 1);
+            depth[i] = features.depth.GetValue(x, y);
+        }
+    }
+
+    // Feature weights do not change between iterations, only the color weight tightens
+    const float kernel[5] = { 1.0f/16, 1.0f/4, 3.0f/8, 1.0f/4, 1.0f/16 };
+    float normalFactor = 1 / (normalSigma_*normalSigma_);
+    float depthFactor = 1 / (depthSigma_*depthSigma_);
+    float albedoFactor = 1 / (albedoSigma_*albedoSigma_);
+
+    ThreadPool threadPool(threadCount_);
+    std::vector<Vector3> filtered(pixelCount);
+    for (int iteration = 0; iteration < iterations_; iteration++) {
+        int step = 1 << iteration;
+        float sigma = colorSigma_ / step;
+        float colorFactor = 1 / (sigma*sigma);
+        std::atomic<int> nextRow(0);
+        threadPool.Run([&](int threadIdx) {
+            for (int y = nextRow++; y < height; y = nextRow++) {
+                for (int x = 0; x < width; x++) {
+                    size_t p = x + (size_t)y * width;
+                    Vector3 sum;
+                    float weightSum = 0;
+                    for (int ky = 0; ky < 5; ky++) {
+                        int qy = y + (ky - 2)*step;
+                        if (qy < 0 || qy >= height) continue;
+                        for (int kx = 0; kx < 5; kx++) {
+                            int qx = x + (kx - 2)*step;
+                            if (qx < 0 || qx >= width) continue;
+                            size_t q = qx + (size_t)qy * width;
+                            // Depth is compared relative to the farther hit so the filter
+                            // does not depend on scene scale; hits barely blend with misses
+                            float depthDifference = 0;
+                            float farDepth = std::max(depth[p], depth[q]);
+                            if (farDepth > 0)
+                                depthDifference = (depth[p] - depth[q]) / farDepth;
+                            float exponent = DistanceSquared(color[p], color[q])*colorFactor +
+                                DistanceSquared(normal[p], normal[q])*normalFactor +
+                                DistanceSquared(albedo[p], albedo[q])*albedoFactor +
+                                depthDifference*depthDifference*depthFactor;
+                            float weight = kernel[kx]*kernel[ky]*std::exp(-exponent);
+                            sum = sum + weight*color[q];
+                            weightSum += weight;
+                        }
+                    }
+                    // The center tap always has a nonzero weight
+                    filtered[p] = sum / weightSum;
+                }
+            }
+        });
+        color.swap(filtered);
+    }
+
+    Image denoised = Image(width, height);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const Vector3& c = color[x + (size_t)y * width];
+            denoised.SetPixel(x, y, Color(c.x(), c.y(), c.z()));
+        }
+    }
+    return denoised;
+}
+
+}  // namespace RayTracer
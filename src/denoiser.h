@@ -0,0 +1,60 @@
+#ifndef DENOISER_H_
+#define DENOISER_H_
+
+#include "image.h"
+#include "heatmap.h"
+#include "vector3.h"
+
+#include <vector>
+
+namespace RayTracer {
+
+#define DENOISE_ITERATIONS 3
+#define DENOISE_COLOR_SIGMA 0.5f
+#define DENOISE_NORMAL_SIGMA 0.02f
+#define DENOISE_DEPTH_SIGMA 0.02f
+#define DENOISE_ALBEDO_SIGMA 0.02f
+
+/// First-hit surface attributes of each pixel, averaged over the pixel's
+/// camera rays: diffuse albedo, normal facing the camera (mapped from
+/// [-1, 1] to [0, 1] so it can be written as an image) and hit distance
+/// (0 where nothing was hit). They are free of shading noise and mark the
+/// geometric and material edges a denoiser must not blur across.
+struct RenderFeatures {
+    Image albedo;
+    Image normal;
+    Heatmap depth;
+};
+
+/// An edge-avoiding à-trous wavelet filter (Dammertz et al. 2010) that
+/// smooths sampling noise out of a rendered image. Each iteration blurs with
+/// a 5x5 B3-spline kernel whose taps are spread twice as far apart as in the
+/// previous one, and weights every tap by how closely its color, albedo,
+/// normal and depth match the center pixel's.
+class Denoiser {
+public:
+
+    /// Creates a denoiser filtering on the given number of threads (0 = all hardware threads)
+    Denoiser(int threadCount = 0);
+
+    /// Sets how different colors may be and still be blended in the first
+    /// iteration (halved in each further iteration)
+    void SetColorSigma(float sigma) { colorSigma_ = sigma; }
+    /// Sets the number of filter iterations, each doubling the filter radius
+    void SetIterations(int iterations) { iterations_ = iterations; }
+
+    /// Returns the denoised image, guided by features of the same size
+    Image Denoise(const Image& image, const RenderFeatures& features) const;
+
+private:
+    int threadCount_;
+    int iterations_ = DENOISE_ITERATIONS;
+    float colorSigma_ = DENOISE_COLOR_SIGMA;
+    float normalSigma_ = DENOISE_NORMAL_SIGMA;
+    float depthSigma_ = DENOISE_DEPTH_SIGMA;
+    float albedoSigma_ = DENOISE_ALBEDO_SIGMA;
+};
+
+}  // namespace RayTracer
+
+#endif  // DENOISER_H_
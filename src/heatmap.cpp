@@ -0,0 +1,47 @@
+#include "heatmap.h"
+#include "image.h"
+
+#include <algorithm>
+
+namespace RayTracer {
+
+Heatmap::Heatmap() {
+    width_ = 0;
+    height_ = 0;
+}
+
+Heatmap::Heatmap(int width, int height) {
+    width_ = width;
+    height_ = height;
+    values_.assign(width*height, 0);
+}
+
+void Heatmap::WriteToPPMFile(std::string outputFileName) const {
+    // Find the 99th percentile value to normalize against
+    std::vector<float> sorted = values_;
+    float scale = 0;
+    if (!sorted.empty()) {
+        size_t percentile = (sorted.size() - 1) * 99 / 100;
+        std::nth_element(sorted.begin(), sorted.begin() + percentile, sorted.end());
+        scale = sorted[percentile];
+    }
+    if (scale <= 0) scale = 1;
+
+    // Map normalized values onto a black-blue-red-yellow-white ramp
+    const float ramp[5][3] = { { 0, 0, 0 }, { 0, 0, 1 }, { 1, 0, 0 }, { 1, 1, 0 }, { 1, 1, 1 } };
+    Image image = Image(width_, height_);
+    for (int y = 0; y < height_; y++) {
+        for (int x = 0; x < width_; x++) {
+            float t = std::min(1.0f, GetValue(x, y) / scale) * 4;
+            int i = std::min(3, (int)t);
+            float f = t - i;
+            image.SetPixel(x, y, Color(
+                ramp[i][0] + f*(ramp[i+1][0] - ramp[i][0]),
+                ramp[i][1] + f*(ramp[i+1][1] - ramp[i][1]),
+                ramp[i][2] + f*(ramp[i+1][2] - ramp[i][2])));
+        }
+    }
+    image.WriteToPPMFile(outputFileName);
+}
+
+}  // namespace RayTracer
@@ -0,0 +1,44 @@
+#ifndef HEATMAP_H_
+#define HEATMAP_H_
+
+#include <vector>
+#include <string>
+
+namespace RayTracer {
+
+/// A 2D grid of per-pixel scalar costs that can be written out as a
+/// false color image, from black (cheapest) through blue, red and yellow to white.
+class Heatmap {
+public:
+
+    /// Creates an empty heatmap
+    Heatmap();
+    /// Creates a heatmap with given width and height, with all values zero
+    Heatmap(int width, int height);
+
+    int Width() const { return width_; }
+    int Height() const { return height_; }
+    /// Gets value at (x, y)
+    float GetValue(int x, int y) const { return values_[x + y*width_]; }
+    /// Sets value at (x, y)
+    void SetValue(int x, int y, float value) { values_[x + y*width_] = value; }
+
+    /// Writes the heatmap in PPM format, scaled so that the 99th percentile
+    /// value (or above) maps to white so a few outliers do not wash out the image
+    void WriteToPPMFile(std::string outputFileName) const;
+
+private:
+    int width_, height_;
+    std::vector<float> values_;
+};
+
+/// Per-pixel cost images produced by a diagnostic render
+struct RenderHeatmaps {
+    Heatmap nodeVisits;
+    Heatmap primitiveTests;
+    Heatmap renderTime;
+};
+
+}  // namespace RayTracer
+
+#endif  // HEATMAP_H_
@@ -3,6 +3,9 @@
 
 #include <vector>
 #include <sstream>
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
     #include <iostream>
 
 namespace RayTracer {
@@ -25,8 +28,49 @@ Image::Image(int width, int height, Color* pixels) {
     pixels_ = pixels;
 }
 
+Image::Image(const Image& other) {
+    width_ = other.width_;
+    height_ = other.height_;
+    pixels_ = new Color[width_*height_];
+    std::copy(other.pixels_, other.pixels_ + width_*height_, pixels_);
+}
+
+Image::Image(Image&& other) {
+    width_ = other.width_;
+    height_ = other.height_;
+    pixels_ = other.pixels_;
+    other.width_ = 0;
+    other.height_ = 0;
+    other.pixels_ = NULL;
+}
+
 Image::~Image() {
-    delete pixels_;
+    delete[] pixels_;
+}
+
+Image& Image::operator=(const Image& other) {
+    if (this != &other) {
+        Color* pixels = new Color[other.width_*other.height_];
+        std::copy(other.pixels_, other.pixels_ + other.width_*other.height_, pixels);
+        delete[] pixels_;
+        width_ = other.width_;
+        height_ = other.height_;
+        pixels_ = pixels;
+    }
+    return *this;
+}
+
+Image& Image::operator=(Image&& other) {
+    if (this != &other) {
+        delete[] pixels_;
+        width_ = other.width_;
+        height_ = other.height_;
+        pixels_ = other.pixels_;
+        other.width_ = 0;
+        other.height_ = 0;
+        other.pixels_ = NULL;
+    }
+    return *this;
 }
 
 int Image::Idx(int x, int y) const {
@@ -46,12 +90,20 @@ void Image::SetPixel(int x, int y, Color color) {
     pixels_[Idx(x, y)] = color;
 }
 
-void Image::WriteToPPMFile(std::string outputFileName) {
+void Image::Paste(const Image& image, int x, int y) {
+    for (int row = 0; row < image.height_; row++) {
+        std::copy(image.pixels_ + row*image.width_, image.pixels_ + (row+1)*image.width_, pixels_ + Idx(x, y + row));
+    }
+}
+
+void Image::WriteToPPMFile(std::string outputFileName, const std::string& comment) const {
     // Open output file for writing
     std::ofstream outputStream(outputFileName, std::ios::out);
     // Write the header to the output file
-    outputStream << "P3\n"
-        << width_ << " " << height_ << "\n"
+    outputStream << "P3\n";
+    if (!comment.empty())
+        outputStream << "# " << comment << "\n";
+    outputStream << width_ << " " << height_ << "\n"
         << 255 << "\n";
 
     // Write the pixels, starting at the top left corner of the image
@@ -68,46 +120,87 @@ void Image::WriteToPPMFile(std::string outputFileName) {
     outputStream.close();
 }
 
-Image* Image::ReadPPM(std::string ppmImageFileName) {
+namespace {
+
+// Reads the next whitespace separated token of a PPM file, setting aside any
+// "#" comments before it. Returns false at the end of the file.
+bool ReadPPMToken(std::istream& stream, std::string& token, std::vector<std::string>* comments) {
+    token.clear();
+    int c;
+    while ((c = stream.get()) != EOF) {
+        if (c == '#') {
+            std::string comment;
+            std::getline(stream, comment);
+            if (comments != NULL) {
+                size_t textStart = comment.find_first_not_of(" \t");
+                comments->push_back(textStart == std::string::npos ? "" : comment.substr(textStart));
+            }
+        } else if (!std::isspace(c)) {
+            break;
+        }
+    }
+    if (c == EOF)
+        return false;
+    do {
+        token.push_back((char)c);
+        c = stream.peek();
+        if (c == EOF || c == '#' || std::isspace(c))
+            break;
+        stream.get();
+    } while (true);
+    return true;
+}
+
+}  // namespace
+
+Image* Image::ReadPPM(std::string ppmImageFileName, std::vector<std::string>* comments) {
     std::ifstream ppmImageFile;
     ppmImageFile.open(ppmImageFileName);
     if (!ppmImageFile) {
         throw std::invalid_argument("Invalid file name.");
     }
-    int i = 0;
-    int pixelIdx = 0;
-    bool header = true;
-    std::string line;
-    float r, g, b;
-    float norm;
-    int height;
-    int width;
-    Color* pixels;
-    while (std::getline(ppmImageFile, line)) {
-        std::vector<std::string> values;
-        std::istringstream iss(line);
-    	for (std::string s; iss >> s; )
-    		values.push_back(s);
-        if (header) {
-            width = std::stoi(values[1]);
-            height = std::stoi(values[2]);
-            norm = std::stof(values[3]);
-            pixels = new Color[width*height];
-            header = false;
-        } else {
-            for (auto value : values) {
-                if (i == 0) {
-                    r = std::stof(value) / norm;
-                } else if (i == 1) {
-                    g = std::stof(value) / norm;
-                } else if (i == 2) {
-                    b = std::stof(value) / norm;
-                    pixels[pixelIdx++] = Color(r, g, b);
-                }
-                i = (i + 1) % 3;
+    // Parse the header, then stream the pixel values straight into the image
+    // rather than holding the whole file in memory as text
+    std::string header[4];
+    for (int i = 0; i < 4; i++) {
+        if (!ReadPPMToken(ppmImageFile, header[i], comments))
+            throw std::invalid_argument("Invalid PPM header.");
+    }
+    if (header[0] != "P3") {
+        throw std::invalid_argument("Invalid PPM header.");
+    }
+    int width = std::stoi(header[1]);
+    int height = std::stoi(header[2]);
+    float norm = std::stof(header[3]);
+    // Every value takes at least a digit and a separator, which bounds the
+    // pixel count a file can hold before allocating for it
+    std::streampos pixelStart = ppmImageFile.tellg();
+    ppmImageFile.seekg(0, std::ios::end);
+    uint64_t pixelBytes = (uint64_t)(ppmImageFile.tellg() - pixelStart);
+    ppmImageFile.seekg(pixelStart);
+    if (width <= 0 || height <= 0 || (uint64_t)width * height > (pixelBytes + 1) / 6) {
+        throw std::invalid_argument("Invalid PPM pixel data.");
+    }
+    Color* pixels = new Color[width*height];
+    std::string value;
+    for (int pixelIdx = 0; pixelIdx < width*height; pixelIdx++) {
+        float rgb[3];
+        for (int i = 0; i < 3; i++) {
+            if (!ReadPPMToken(ppmImageFile, value, comments)) {
+                delete[] pixels;
+                throw std::invalid_argument("Invalid PPM pixel data.");
+            }
+            try {
+                rgb[i] = std::stof(value) / norm;
+            } catch (std::exception& e) {
+                delete[] pixels;
+                throw;
             }
         }
+        pixels[pixelIdx] = Color(rgb[0], rgb[1], rgb[2]);
     }
+    // Pick up any comments after the pixels
+    while (ReadPPMToken(ppmImageFile, value, comments)) {}
     return new Image(width, height, pixels);
 }
 
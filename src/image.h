@@ -5,6 +5,7 @@
 
 #include <fstream>
 #include <string>
+#include <vector>
 
 namespace RayTracer {
 
@@ -18,9 +19,16 @@ public:
     Image(int width, int height);
     /// Creates an image with given width and height and heap allocated pixels array
     Image(int width, int height, Color* pixels);
+    /// Copies the pixels of another image
+    Image(const Image& other);
+    /// Takes the pixels of another image
+    Image(Image&& other);
     /// Deletes array of pixels
     ~Image();
 
+    Image& operator=(const Image& other);
+    Image& operator=(Image&& other);
+
     /// Returns image width
     int Width() const { return width_; }
     /// Returns image height
@@ -31,12 +39,15 @@ public:
     Color GetPixel(float u, float v) const;
     /// Sets pixel at (x, y)
     void SetPixel(int x, int y, Color color);
+    /// Copies all pixels of the given image into this one with its top left corner at (x, y)
+    void Paste(const Image& image, int x, int y);
 
-    /// Writes image in PPM format to file with given name
-    void WriteToPPMFile(std::string outputFileName);
+    /// Writes image in PPM format to file with given name, with an optional
+    /// comment line written after the magic number
+    void WriteToPPMFile(std::string outputFileName, const std::string& comment = "") const;
 
-    /// Creates an image from given ppm file
-    static Image* ReadPPM(std::string ppmImageFileName);
+    /// Creates an image from given ppm file, optionally returning its comment lines
+    static Image* ReadPPM(std::string ppmImageFileName, std::vector<std::string>* comments = NULL);
 
 private:
     inline int Idx(int x, int y) const;
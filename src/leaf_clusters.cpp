@@ -0,0 +1,362 @@
+#include "leaf_clusters.h"
+#include "sphere.h"
+#include "triangle.h"
+
+#include <cmath>
+#include <limits>
+
+namespace RayTracer {
+
+namespace {
+
+// Fields stored per lane for each kind of cluster, starting with the bounds
+// of the leaf the object came from
+enum BoxField { MinX, MinY, MinZ, MaxX, MaxY, MaxZ, BoxFieldCount };
+enum SphereField { CenterX = BoxFieldCount, CenterY, CenterZ, Radius, SphereFieldCount };
+enum TriangleField {
+    NormalX = BoxFieldCount, NormalY, NormalZ, PlaneOffset,
+    Vertex0X, Vertex0Y, Vertex0Z,
+    Edge1X, Edge1Y, Edge1Z,
+    Edge2X, Edge2Y, Edge2Z,
+    Dot11, Dot12, Dot22, Determinant,
+    TriangleFieldCount
+};
+
+// One float per cluster lane. With RAYTRACER_SSE (RAYTRACER_SIMD on a CPU with
+// SSE2, see vector3.h) the lanes are an SSE register, otherwise each operation loops over them; either way every lane
+// performs the same IEEE operation as the scalar code.
+#ifdef RAYTRACER_SSE
+
+struct Lanes {
+    __m128 v;
+
+    Lanes(__m128 v) : v(v) {}
+    explicit Lanes(float s) : v(_mm_set1_ps(s)) {}
+    explicit Lanes(const float* p) : v(_mm_loadu_ps(p)) {}
+    void Store(float* p) const { _mm_storeu_ps(p, v); }
+};
+
+inline Lanes operator+(Lanes a, Lanes b) { return _mm_add_ps(a.v, b.v); }
+inline Lanes operator-(Lanes a, Lanes b) { return _mm_sub_ps(a.v, b.v); }
+inline Lanes operator*(Lanes a, Lanes b) { return _mm_mul_ps(a.v, b.v); }
+inline Lanes operator/(Lanes a, Lanes b) { return _mm_div_ps(a.v, b.v); }
+inline Lanes operator-(Lanes a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+inline Lanes Sqrt(Lanes a) { return _mm_sqrt_ps(a.v); }
+// a > b ? a : b and a < b ? a : b, so a NaN in a is never chosen
+inline Lanes Max(Lanes a, Lanes b) { return _mm_max_ps(a.v, b.v); }
+inline Lanes Min(Lanes a, Lanes b) { return _mm_min_ps(a.v, b.v); }
+// Comparisons return a bit per lane, false for NaNs like the scalar operators
+inline int Less(Lanes a, Lanes b) { return _mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)); }
+inline int LessEqual(Lanes a, Lanes b) { return _mm_movemask_ps(_mm_cmple_ps(a.v, b.v)); }
+
+#else
+
+struct Lanes {
+    float v[LEAF_CLUSTER_SIZE];
+
+    Lanes() {}
+    explicit Lanes(float s) { for (int i = 0; i < LEAF_CLUSTER_SIZE; i++) v[i] = s; }
+    explicit Lanes(const float* p) { for (int i = 0; i < LEAF_CLUSTER_SIZE; i++) v[i] = p[i]; }
+    void Store(float* p) const { for (int i = 0; i < LEAF_CLUSTER_SIZE; i++) p[i] = v[i]; }
+};
+
+#define LANEWISE(expression) \
+    Lanes r; \
+    for (int i = 0; i < LEAF_CLUSTER_SIZE; i++) r.v[i] = expression; \
+    return r;
+
+inline Lanes operator+(Lanes a, Lanes b) { LANEWISE(a.v[i] + b.v[i]) }
+inline Lanes operator-(Lanes a, Lanes b) { LANEWISE(a.v[i] - b.v[i]) }
+inline Lanes operator*(Lanes a, Lanes b) { LANEWISE(a.v[i] * b.v[i]) }
+inline Lanes operator/(Lanes a, Lanes b) { LANEWISE(a.v[i] / b.v[i]) }
+inline Lanes operator-(Lanes a) { LANEWISE(-a.v[i]) }
+inline Lanes Sqrt(Lanes a) { LANEWISE(std::sqrt(a.v[i])) }
+inline Lanes Max(Lanes a, Lanes b) { LANEWISE(a.v[i] > b.v[i] ? a.v[i] : b.v[i]) }
+inline Lanes Min(Lanes a, Lanes b) { LANEWISE(a.v[i] < b.v[i] ? a.v[i] : b.v[i]) }
+
+#undef LANEWISE
+
+inline int Less(Lanes a, Lanes b) {
+    int mask = 0;
+    for (int i = 0; i < LEAF_CLUSTER_SIZE; i++)
+        mask |= (a.v[i] < b.v[i]) << i;
+    return mask;
+}
+
+inline int LessEqual(Lanes a, Lanes b) {
+    int mask = 0;
+    for (int i = 0; i < LEAF_CLUSTER_SIZE; i++)
+        mask |= (a.v[i] <= b.v[i]) << i;
+    return mask;
+}
+
+#endif
+
+// AABB::IntersectsRay, a lane per leaf. Stores where each lane's slabs start
+// and end along the ray and returns the lanes entered within the ray's range.
+// Only the range's end changes as hits are found, and a lane is entered with
+// an end of tMax exactly when start <= end and start <= tMax.
+int IntersectBoxes(const float (*lanes)[LEAF_CLUSTER_SIZE], const Ray& ray, float* start, float* end) {
+    Vector3 origin = ray.Origin();
+    Vector3 inverseDirection = ray.InverseDirection();
+    Lanes tStart(ray.TMin());
+    Lanes tEnd(std::numeric_limits<float>::infinity());
+    for (int axis = 0; axis < 3; axis++) {
+        Lanes near(lanes[ray.Sign(axis) ? MaxX + axis : MinX + axis]);
+        Lanes far(lanes[ray.Sign(axis) ? MinX + axis : MaxX + axis]);
+        Lanes o(origin[axis]);
+        Lanes inverse(inverseDirection[axis]);
+        tStart = Max((near - o)*inverse, tStart);
+        tEnd = Min((far - o)*inverse, tEnd);
+    }
+    tStart.Store(start);
+    tEnd.Store(end);
+    return LessEqual(tStart, tEnd) & LessEqual(tStart, Lanes(ray.TMax()));
+}
+
+}  // namespace
+
+void LeafClusters::Build(BVHNode* root) {
+    sphereClusters_.clear();
+    triangleClusters_.clear();
+    if (root == NULL)
+        return;
+    int leafCount;
+    ObjectType type;
+    if (Collapse(root, leafCount, type) && !root->IsLeaf())
+        AddCluster(root, type);
+}
+
+size_t LeafClusters::Bytes() const {
+    return sphereClusters_.size() * sizeof(SphereCluster) + triangleClusters_.size() * sizeof(TriangleCluster);
+}
+
+bool LeafClusters::Collapse(BVHNode* node, int& leafCount, ObjectType& type) {
+    node->SetCluster(-1);
+    if (node->IsLeaf()) {
+        leafCount = 1;
+        type = node->IsEmpty() ? GenericObject : node->Leaf()->Type();
+        return type == SphereObject || type == TriangleObject;
+    }
+
+    int leftCount, rightCount;
+    ObjectType leftType, rightType;
+    bool left = Collapse(node->Left(), leftCount, leftType);
+    bool right = Collapse(node->Right(), rightCount, rightType);
+    leafCount = leftCount + rightCount;
+    type = leftType;
+    if (left && right && leftType == rightType && leafCount <= LEAF_CLUSTER_SIZE)
+        return true;
+
+    // This subtree cannot be one cluster, so each child that could is one
+    if (left && !node->Left()->IsLeaf())
+        AddCluster(node->Left(), leftType);
+    if (right && !node->Right()->IsLeaf())
+        AddCluster(node->Right(), rightType);
+    return false;
+}
+
+void LeafClusters::GatherLeaves(const BVHNode* node, std::vector<const BVHNode*>& leaves) const {
+    if (node->IsLeaf()) {
+        leaves.push_back(node);
+        return;
+    }
+    GatherLeaves(node->Left(), leaves);
+    GatherLeaves(node->Right(), leaves);
+}
+
+void LeafClusters::AddCluster(BVHNode* node, ObjectType type) {
+    // Lanes follow the order in which the traversal would visit the leaves
+    static_assert(sizeof(SphereCluster::lanes) == SphereFieldCount * sizeof(float[LEAF_CLUSTER_SIZE]), "Sphere fields");
+    static_assert(sizeof(TriangleCluster::lanes) == TriangleFieldCount * sizeof(float[LEAF_CLUSTER_SIZE]), "Triangle fields");
+    std::vector<const BVHNode*> leaves;
+    GatherLeaves(node, leaves);
+    int count = (int)leaves.size();
+    // Unused lanes get inside out bounds that no ray enters, and are left
+    // zero otherwise
+    float infinity = std::numeric_limits<float>::infinity();
+    float bounds[LEAF_CLUSTER_SIZE][BoxFieldCount];
+    for (int lane = 0; lane < LEAF_CLUSTER_SIZE; lane++) {
+        Vector3 min(infinity, infinity, infinity);
+        Vector3 max(-infinity, -infinity, -infinity);
+        if (lane < count) {
+            min = leaves[lane]->BoundingBox().Min();
+            max = leaves[lane]->BoundingBox().Max();
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            bounds[lane][MinX + axis] = min[axis];
+            bounds[lane][MaxX + axis] = max[axis];
+        }
+    }
+
+    if (type == SphereObject) {
+        SphereCluster cluster = {};
+        for (int lane = 0; lane < LEAF_CLUSTER_SIZE; lane++)
+            for (int field = 0; field < BoxFieldCount; field++)
+                cluster.lanes[field][lane] = bounds[lane][field];
+        for (int lane = 0; lane < count; lane++) {
+            const Sphere* sphere = static_cast<const Sphere*>(leaves[lane]->Leaf());
+            Vector3 center = sphere->Position();
+            cluster.objects[lane] = sphere;
+            cluster.lanes[CenterX][lane] = center.x();
+            cluster.lanes[CenterY][lane] = center.y();
+            cluster.lanes[CenterZ][lane] = center.z();
+            cluster.lanes[Radius][lane] = sphere->Radius();
+        }
+        node->SetCluster(2 * (int)sphereClusters_.size());
+        sphereClusters_.push_back(cluster);
+        return;
+    }
+
+    TriangleCluster cluster = {};
+    for (int lane = 0; lane < LEAF_CLUSTER_SIZE; lane++)
+        for (int field = 0; field < BoxFieldCount; field++)
+            cluster.lanes[field][lane] = bounds[lane][field];
+    for (int lane = 0; lane < count; lane++) {
+        // Precompute what Triangle::IntersectRay derives from the vertices on
+        // every call, with the same operations
+        const Triangle* triangle = static_cast<const Triangle*>(leaves[lane]->Leaf());
+        Vector3 e1 = triangle->Vertex(1) - triangle->Vertex(0);
+        Vector3 e2 = triangle->Vertex(2) - triangle->Vertex(0);
+        Vector3 vectors[] = { triangle->PlaneNormal(), triangle->Vertex(0), e1, e2 };
+        int vectorFields[] = { NormalX, Vertex0X, Edge1X, Edge2X };
+        for (int i = 0; i < 4; i++)
+            for (int axis = 0; axis < 3; axis++)
+                cluster.lanes[vectorFields[i] + axis][lane] = vectors[i][axis];
+        float d11 = Vector3::Dot(e1, e1);
+        float d12 = Vector3::Dot(e1, e2);
+        float d22 = Vector3::Dot(e2, e2);
+        cluster.objects[lane] = triangle;
+        cluster.lanes[PlaneOffset][lane] = triangle->PlaneOffset();
+        cluster.lanes[Dot11][lane] = d11;
+        cluster.lanes[Dot12][lane] = d12;
+        cluster.lanes[Dot22][lane] = d22;
+        cluster.lanes[Determinant][lane] = d11*d22-d12*d12;
+    }
+    node->SetCluster(2 * (int)triangleClusters_.size() + 1);
+    triangleClusters_.push_back(cluster);
+}
+
+RaycastHit LeafClusters::IntersectRay(int index, Ray& ray, TraceContext& context, const SceneObject* ignoreObject) const {
+    // Skip the objects when the ray enters none of their leaves, as the
+    // traversal would. Unused lanes are never entered.
+    float start[LEAF_CLUSTER_SIZE], end[LEAF_CLUSTER_SIZE];
+    float t[LEAF_CLUSTER_SIZE], distance[LEAF_CLUSTER_SIZE];
+    if (index % 2 == 0) {
+        const SphereCluster& cluster = sphereClusters_[index / 2];
+        context.stats.bvhNodesVisited += LaneCount(cluster.objects);
+        int entered = IntersectBoxes(cluster.lanes, ray, start, end);
+        if (entered == 0)
+            return RaycastHit();
+        int hits = IntersectSpheres(cluster, ray, t, distance);
+        int lane = NearestLane(cluster.objects, entered, start, end, hits, t, distance, ray, ignoreObject,
+            context.stats.sphereTests);
+        if (lane < 0)
+            return RaycastHit();
+        return static_cast<const Sphere*>(cluster.objects[lane])->HitAt(ray, t[lane]);
+    }
+    const TriangleCluster& cluster = triangleClusters_[index / 2];
+    context.stats.bvhNodesVisited += LaneCount(cluster.objects);
+    int entered = IntersectBoxes(cluster.lanes, ray, start, end);
+    if (entered == 0)
+        return RaycastHit();
+    float b[LEAF_CLUSTER_SIZE], y[LEAF_CLUSTER_SIZE];
+    int hits = IntersectTriangles(cluster, ray, t, distance, b, y);
+    int lane = NearestLane(cluster.objects, entered, start, end, hits, t, distance, ray, ignoreObject,
+        context.stats.triangleTests);
+    if (lane < 0)
+        return RaycastHit();
+    return static_cast<const Triangle*>(cluster.objects[lane])->HitAt(ray.GetPoint(t[lane]), distance[lane], b[lane], y[lane]);
+}
+
+int LeafClusters::LaneCount(const SceneObject* const* objects) {
+    int count = 0;
+    while (count < LEAF_CLUSTER_SIZE && objects[count] != NULL)
+        count++;
+    return count;
+}
+
+int LeafClusters::NearestLane(const SceneObject* const* objects, int entered, const float* start,
+    const float* end, int hits, const float* t, const float* distance, Ray& ray, const SceneObject* ignoreObject,
+    uint64_t& tests) {
+    // Visit the leaves in order as the traversal would: each must be entered
+    // and hit within the range left by the hits before it, and the nearest hit
+    // wins, the later one on ties
+    int nearest = -1;
+    for (int lane = 0; entered >> lane; lane++) {
+        if (!(entered & (1 << lane)) || !(start[lane] <= end[lane] && start[lane] <= ray.TMax()) ||
+            objects[lane] == ignoreObject)
+            continue;
+        tests++;
+        if (!(hits & (1 << lane)) || !ray.InRange(t[lane]))
+            continue;
+        if (nearest < 0 || !(distance[nearest] < distance[lane]))
+            nearest = lane;
+        ray.SetTMax(distance[lane]);
+    }
+    return nearest;
+}
+
+int LeafClusters::IntersectSpheres(const SphereCluster& cluster, const Ray& ray, float* t, float* distance) {
+    // Sphere::IntersectRay, a lane per sphere
+    Vector3 origin = ray.Origin();
+    Vector3 direction = ray.Direction();
+    Lanes ox(origin.x()), oy(origin.y()), oz(origin.z());
+    Lanes dx(direction.x()), dy(direction.y()), dz(direction.z());
+    Lanes cx(cluster.lanes[CenterX]);
+    Lanes cy(cluster.lanes[CenterY]);
+    Lanes cz(cluster.lanes[CenterZ]);
+    Lanes radius(cluster.lanes[Radius]);
+
+    Lanes closest = (cx-ox)*dx + (cy-oy)*dy + (cz-oz)*dz;
+    Lanes px = cx - (ox + closest*dx);
+    Lanes py = cy - (oy + closest*dy);
+    Lanes pz = cz - (oz + closest*dz);
+    Lanes y = Sqrt(px*px + py*py + pz*pz);
+    int hits = Less(y, radius);
+    Lanes nearest = closest - Sqrt(radius*radius - y*y);
+    nearest.Store(t);
+    nearest.Store(distance);
+    return hits;
+}
+
+int LeafClusters::IntersectTriangles(const TriangleCluster& cluster, const Ray& ray, float* t, float* distance,
+    float* b, float* y) {
+    // Triangle::IntersectRay, a lane per triangle
+    const float (*lanes)[LEAF_CLUSTER_SIZE] = cluster.lanes;
+    Vector3 origin = ray.Origin();
+    Vector3 direction = ray.Direction();
+    Lanes ox(origin.x()), oy(origin.y()), oz(origin.z());
+    Lanes dx(direction.x()), dy(direction.y()), dz(direction.z());
+    Lanes nx(lanes[NormalX]), ny(lanes[NormalY]), nz(lanes[NormalZ]);
+
+    // Where the ray meets each triangle's plane
+    Lanes planeT = -((nx*ox + ny*oy + nz*oz) + Lanes(lanes[PlaneOffset])) / (nx*dx + ny*dy + nz*dz);
+    Lanes px = ox + dx*planeT;
+    Lanes py = oy + dy*planeT;
+    Lanes pz = oz + dz*planeT;
+
+    // Barycentric coordinates of the point
+    Lanes epx = px - Lanes(lanes[Vertex0X]);
+    Lanes epy = py - Lanes(lanes[Vertex0Y]);
+    Lanes epz = pz - Lanes(lanes[Vertex0Z]);
+    Lanes dp1 = epx*Lanes(lanes[Edge1X]) + epy*Lanes(lanes[Edge1Y]) + epz*Lanes(lanes[Edge1Z]);
+    Lanes dp2 = epx*Lanes(lanes[Edge2X]) + epy*Lanes(lanes[Edge2Y]) + epz*Lanes(lanes[Edge2Z]);
+    Lanes d11(lanes[Dot11]), d12(lanes[Dot12]), d22(lanes[Dot22]);
+    Lanes D(lanes[Determinant]);
+    Lanes laneB = (d22*dp1 - d12*dp2) / D;
+    Lanes laneY = (d11*dp2 - d12*dp1) / D;
+    Lanes zero(0.0f), one(1.0f);
+    Lanes a = one - (laneB + laneY);
+
+    int outside = Less(a, zero) | Less(one, a) | Less(laneB, zero) | Less(one, laneB) | Less(laneY, zero) | Less(one, laneY);
+    int hits = ~outside;
+    planeT.Store(t);
+    laneB.Store(b);
+    laneY.Store(y);
+    Lanes qx = ox - px, qy = oy - py, qz = oz - pz;
+    Sqrt(qx*qx + qy*qy + qz*qz).Store(distance);
+    return hits;
+}
+
+}  // namespace RayTracer
@@ -0,0 +1,86 @@
+#ifndef LEAF_CLUSTERS_H_
+#define LEAF_CLUSTERS_H_
+
+#include "bvh_node.h"
+#include "scene_object.h"
+#include "ray.h"
+#include "raycast_hit.h"
+#include "trace_context.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace RayTracer {
+
+#define LEAF_CLUSTER_SIZE 4
+
+/// Small BVH subtrees collapsed into clusters of spheres or triangles that
+/// are tested against a ray all at once.
+///
+/// Every subtree of two to LEAF_CLUSTER_SIZE leaves holding only spheres or
+/// only triangles (and not part of a larger such subtree) becomes a cluster:
+/// its node is marked with the cluster's index, and the data each
+/// intersection test needs is stored as one array per field with a lane per
+/// object. One SSE pass (or a loop over lanes without RAYTRACER_SSE) then
+/// replaces the traversal of the subtree. The lanes repeat the arithmetic of
+/// Sphere::IntersectRay and Triangle::IntersectRay exactly, and hits are
+/// accepted in leaf order with the same range updates and tie breaking as the
+/// traversal, so clustered and unclustered trees find the same hits. The
+/// hit is then filled in from the winning lane without testing its object
+/// again. Each leaf box tested counts as a BVH node visited, while the
+/// cluster's inner nodes are never visited.
+class LeafClusters {
+public:
+
+    /// Collapses the subtrees of the tree with the given root into clusters,
+    /// replacing any previous clusters. Must be rerun when objects move.
+    void Build(BVHNode* root);
+    /// Returns the number of clusters
+    size_t Count() const { return sphereClusters_.size() + triangleClusters_.size(); }
+    /// Returns the number of bytes taken by the clusters
+    size_t Bytes() const;
+
+    /// Tests the ray against every object of a cluster, returning the nearest
+    /// hit within the ray's range and shrinking tMax like the traversal would
+    RaycastHit IntersectRay(int cluster, Ray& ray, TraceContext& context, const SceneObject* ignoreObject) const;
+
+private:
+    // A cluster's lanes, a row of LEAF_CLUSTER_SIZE floats per field, kept next
+    // to its objects so that testing it touches little memory besides its node
+    template <int FieldCount>
+    struct Cluster {
+        float lanes[FieldCount][LEAF_CLUSTER_SIZE];
+        const SceneObject* objects[LEAF_CLUSTER_SIZE];
+    };
+    // Leaf bounds, center and radius
+    typedef Cluster<10> SphereCluster;
+    // Leaf bounds, plane, first vertex, edges from it and the edges' dot products
+    typedef Cluster<23> TriangleCluster;
+
+    // Marks clusters in the subtree, returning true if the whole subtree could
+    // be one, in which case leafCount and type describe its leaves
+    bool Collapse(BVHNode* node, int& leafCount, ObjectType& type);
+    void AddCluster(BVHNode* node, ObjectType type);
+    void GatherLeaves(const BVHNode* node, std::vector<const BVHNode*>& leaves) const;
+    // Compute the hit distance along the ray and the reported hit distance of
+    // each lane, returning a bit mask of the lanes whose object the ray's line hits
+    static int IntersectSpheres(const SphereCluster& cluster, const Ray& ray, float* t, float* distance);
+    // Triangles also give each lane's barycentric coordinates b and y
+    static int IntersectTriangles(const TriangleCluster& cluster, const Ray& ray, float* t, float* distance,
+        float* b, float* y);
+    // Returns the lane of the nearest hit, or -1 if there is none
+    static int NearestLane(const SceneObject* const* objects, int entered, const float* start,
+        const float* end, int hits, const float* t, const float* distance, Ray& ray, const SceneObject* ignoreObject,
+        uint64_t& tests);
+    // Returns the number of lanes holding an object
+    static int LaneCount(const SceneObject* const* objects);
+
+    // Node cluster indices are even for sphere clusters and odd for triangle clusters
+    std::vector<SphereCluster> sphereClusters_;
+    std::vector<TriangleCluster> triangleClusters_;
+};
+
+}  // namespace RayTracer
+
+#endif  // LEAF_CLUSTERS_H_
@@ -0,0 +1,140 @@
+#include "light_tree.h"
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+namespace RayTracer {
+
+namespace {
+
+// Returns the power of a light as the mean of its color channels
+float LightPower(const PointLight& light) {
+    Color color = light.LightColor();
+    return (color.r() + color.g() + color.b()) / 3;
+}
+
+// Returns the distance from a point to the nearest point of a box (0 if inside)
+float DistanceToBox(Vector3 point, const AABB& box) {
+    Vector3 nearest = Vector3::Min(Vector3::Max(point, box.Min()), box.Max());
+    return Vector3::Distance(point, nearest);
+}
+
+}  // namespace
+
+void LightTree::Build(const std::vector<PointLight>& lights) {
+    lights_ = lights;
+    nodes_.clear();
+    if (lights_.empty())
+        return;
+    nodes_.reserve(2 * lights_.size());
+    std::vector<int> lightIndices(lights_.size());
+    for (size_t i = 0; i < lights_.size(); i++)
+        lightIndices[i] = i;
+    BuildNode(lightIndices, 0, lightIndices.size());
+}
+
+int LightTree::BuildNode(std::vector<int>& lightIndices, size_t begin, size_t end) {
+    int nodeIdx = nodes_.size();
+    nodes_.push_back(Node());
+
+    // Special Case: Leaf node
+    if (end - begin == 1) {
+        const PointLight& light = lights_[lightIndices[begin]];
+        Node& leaf = nodes_[nodeIdx];
+        leaf.bounds = AABB(light.Position(), light.Position());
+        leaf.power = LightPower(light);
+        leaf.minFactors = light.AttenuationFactors();
+        leaf.hasAttenuated = light.Attenuated();
+        leaf.hasUnattenuated = !light.Attenuated();
+        leaf.light = lightIndices[begin];
+        return nodeIdx;
+    }
+
+    // Split at the median light along the longest axis of the light positions
+    Vector3 min = lights_[lightIndices[begin]].Position();
+    Vector3 max = min;
+    for (size_t i = begin+1; i < end; i++) {
+        min = Vector3::Min(min, lights_[lightIndices[i]].Position());
+        max = Vector3::Max(max, lights_[lightIndices[i]].Position());
+    }
+    Vector3 extent = max - min;
+    int axis = 0;
+    if (extent.y() > extent.x() && extent.y() >= extent.z())
+        axis = 1;
+    else if (extent.z() > extent.x() && extent.z() > extent.y())
+        axis = 2;
+    auto coordinate = [axis](const Vector3& v) {
+        return axis == 0 ? v.x() : axis == 1 ? v.y() : v.z();
+    };
+    size_t mid = begin + (end - begin) / 2;
+    std::nth_element(lightIndices.begin() + begin, lightIndices.begin() + mid, lightIndices.begin() + end,
+        [&](int a, int b) { return coordinate(lights_[a].Position()) < coordinate(lights_[b].Position()); });
+
+    int left = BuildNode(lightIndices, begin, mid);
+    int right = BuildNode(lightIndices, mid, end);
+
+    // Combine the children (nodes_ may have been reallocated while building them)
+    const Node& leftNode = nodes_[left];
+    const Node& rightNode = nodes_[right];
+    Node& node = nodes_[nodeIdx];
+    node.bounds = AABB::Union(leftNode.bounds, rightNode.bounds);
+    node.power = leftNode.power + rightNode.power;
+    node.hasAttenuated = leftNode.hasAttenuated || rightNode.hasAttenuated;
+    node.hasUnattenuated = leftNode.hasUnattenuated || rightNode.hasUnattenuated;
+    if (leftNode.hasAttenuated && rightNode.hasAttenuated)
+        node.minFactors = Vector3::Min(leftNode.minFactors, rightNode.minFactors);
+    else
+        node.minFactors = leftNode.hasAttenuated ? leftNode.minFactors : rightNode.minFactors;
+    node.left = left;
+    node.right = right;
+    return nodeIdx;
+}
+
+float LightTree::Importance(const Node& node, Vector3 point) const {
+    // Lights without power contribute nothing, however close
+    if (node.power <= 0)
+        return 0;
+
+    // Leaves are estimated exactly
+    if (node.light >= 0)
+        return node.power * lights_[node.light].Attenuate(point);
+
+    // Otherwise assume every light is as close and as weakly attenuated as any
+    // in the node, which is unbounded for a point inside the node's bounds if
+    // some light has no constant attenuation
+    float attenuation = node.hasUnattenuated ? 1 : 0;
+    if (node.hasAttenuated) {
+        float d = DistanceToBox(point, node.bounds);
+        float denominator = node.minFactors.x() + node.minFactors.y()*d + node.minFactors.z()*d*d;
+        attenuation = std::max(attenuation, denominator > 0 ? 1 / denominator : std::numeric_limits<float>::infinity());
+    }
+    return node.power * attenuation;
+}
+
+int LightTree::Sample(Vector3 point, Random& random, float& pdf) const {
+    pdf = 1;
+    if (nodes_.empty() || Importance(nodes_[0], point) <= 0)
+        return -1;
+
+    // Descend from the root, choosing each child in proportion to its importance
+    const Node* node = &nodes_[0];
+    while (node->light < 0) {
+        float leftImportance = Importance(nodes_[node->left], point);
+        float rightImportance = Importance(nodes_[node->right], point);
+        float total = leftImportance + rightImportance;
+        // Split evenly when either side's importance is unbounded, so that the
+        // lights on both sides can still be picked
+        float leftProbability = total > 0 && std::isfinite(total) ? leftImportance / total : 0.5f;
+        if (random.NextFloat() < leftProbability) {
+            pdf *= leftProbability;
+            node = &nodes_[node->left];
+        } else {
+            pdf *= 1 - leftProbability;
+            node = &nodes_[node->right];
+        }
+    }
+    return pdf > 0 ? node->light : -1;
+}
+
+}  // namespace RayTracer
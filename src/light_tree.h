@@ -0,0 +1,56 @@
+#ifndef LIGHT_TREE_H_
+#define LIGHT_TREE_H_
+
+#include "point_light.h"
+#include "aabb.h"
+#include "random.h"
+
+#include <vector>
+#include <cstddef>
+
+namespace RayTracer {
+
+/// A bounding volume hierarchy over point lights used to pick a few lights
+/// per shading point in proportion to their estimated contribution, so that
+/// shading cost grows with the tree depth rather than the number of lights.
+///
+/// Each node stores the total power of its lights and a bound on their
+/// attenuation, from which the importance of a subtree at a point is
+/// estimated without visiting its lights.
+class LightTree {
+public:
+
+    /// Creates an empty tree
+    LightTree() {}
+
+    /// Builds the tree over the given lights, replacing any previous tree
+    void Build(const std::vector<PointLight>& lights);
+    /// Returns the number of lights in the tree
+    size_t LightCount() const { return lights_.size(); }
+
+    /// Picks a light for shading the given point, returning its index and the
+    /// probability it was picked with, or -1 if no light can contribute
+    int Sample(Vector3 point, Random& random, float& pdf) const;
+
+private:
+    struct Node {
+        AABB bounds;
+        float power = 0;
+        // Smallest attenuation factors of the attenuated lights below this node
+        Vector3 minFactors;
+        bool hasAttenuated = false;
+        bool hasUnattenuated = false;
+        int left = -1, right = -1;
+        int light = -1;
+    };
+
+    int BuildNode(std::vector<int>& lightIndices, size_t begin, size_t end);
+    float Importance(const Node& node, Vector3 point) const;
+
+    std::vector<PointLight> lights_;
+    std::vector<Node> nodes_;
+};
+
+}  // namespace RayTracer
+
+#endif  // LIGHT_TREE_H_
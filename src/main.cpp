@@ -1,77 +1,650 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <thread>
 #include <stdexcept>
 #include <cmath>
 #include <ctime>
+#include <sstream>
+#include <algorithm>
+#include <csignal>
+#include <cstdlib>
+#include <unistd.h>
 
 #include "scene.h"
 #include "vector3.h"
 #include "image.h"
 #include "utilities.h"
+#include "timer.h"
+#include "thread_pool.h"
+#include "render_server.h"
+#include "camera_path.h"
+#include "render_coordinator.h"
+#include "random.h"
 
 using namespace RayTracer;
 
+// Progress of the render in flight, which SIGINT cancels
+static RenderProgress* interruptibleProgress = NULL;
+
+// Stops the render at the next row so the image so far is still written.
+// A second SIGINT terminates as usual.
+void HandleInterrupt(int) {
+    if (interruptibleProgress != NULL)
+        interruptibleProgress->Cancel();
+    signal(SIGINT, SIG_DFL);
+}
+
+// Loads a scene from file and constructs its BVH, printing an error and returning NULL on failure
+Scene* LoadScene(const std::string& sceneFileName, bool softShadows, bool depthOfField, BVHBuildMode bvhBuildMode, bool hugePages,
+    bool compressedBVH, bool leafClusters, size_t geometryCacheBytes, const std::string& pageDirectory) {
+    std::ifstream sceneFile;
+    sceneFile.open(sceneFileName);
+    if (!sceneFile) {
+        std::cout << "Scene file does not exist. Please try again.\n";
+        return NULL;
+    }
+
+    // Try to initialize a scene using the scene file
+    Scene* scene = new Scene(softShadows, depthOfField);
+    scene->SetHugePages(hugePages);
+    SceneInitStatus sceneInitStatus = scene->InitFromFile(sceneFile);
+    // Print an error message specifying what went wrong if unsuccessful
+    if (sceneInitStatus != Success) {
+        std::cout << "Scene file load error: " << sceneInitStatusText[sceneInitStatus] << " is not properly defined.\n";
+        delete scene;
+        return NULL;
+    }
+    // Construct a BVH for the scene to improve ray tracing speed
+    scene->SetBVHBuildMode(bvhBuildMode);
+    scene->SetCompressedBVH(compressedBVH);
+    scene->SetLeafClusters(leafClusters);
+    scene->SetGeometryCache(geometryCacheBytes, pageDirectory);
+    scene->ConstructBVH();
+    if (geometryCacheBytes > 0 && !scene->IsGeometryPaged() && !scene->IsAnimated())
+        std::cout << "Warning: could not write geometry pages to " << pageDirectory << ", keeping the scene in memory.\n";
+    return scene;
+}
+
+// Reassembles partial images written with --crop or --tile into a full frame image.
+// Each part records where it belongs as a "crop x0 y0 width height" comment.
+bool MergeImages(const std::string& outputFileName, const std::vector<std::string>& partFileNames) {
+    Image* mergedImage = NULL;
+    std::vector<bool> covered;
+    int fullWidth = 0, fullHeight = 0;
+    for (const std::string& partFileName : partFileNames) {
+        std::vector<std::string> comments;
+        Image* part = NULL;
+        try {
+            part = Image::ReadPPM(partFileName, &comments);
+        } catch (std::invalid_argument& e) {
+            std::cout << "Partial image " << partFileName << " could not be read.\n";
+            delete mergedImage;
+            return false;
+        }
+        // Find where this part belongs in the full frame
+        bool found = false;
+        int x0 = 0, y0 = 0, width = 0, height = 0;
+        for (const std::string& comment : comments) {
+            std::istringstream iss(comment);
+            std::string keyword;
+            if (iss >> keyword >> x0 >> y0 >> width >> height && keyword == "crop") {
+                found = true;
+                break;
+            }
+        }
+        if (!found || x0 < 0 || y0 < 0 || x0 + part->Width() > width || y0 + part->Height() > height ||
+            (mergedImage != NULL && (width != fullWidth || height != fullHeight))) {
+            std::cout << "Partial image " << partFileName << " has a missing or mismatched crop window.\n";
+            delete part;
+            delete mergedImage;
+            return false;
+        }
+        if (mergedImage == NULL) {
+            fullWidth = width;
+            fullHeight = height;
+            mergedImage = new Image(fullWidth, fullHeight);
+            covered.assign(fullWidth*fullHeight, false);
+        }
+        mergedImage->Paste(*part, x0, y0);
+        for (int y = y0; y < y0 + part->Height(); y++)
+            for (int x = x0; x < x0 + part->Width(); x++)
+                covered[x + y*fullWidth] = true;
+        delete part;
+    }
+    if (mergedImage == NULL)
+        return false;
+    if (std::find(covered.begin(), covered.end(), false) != covered.end())
+        std::cout << "Warning: partial images do not cover the full frame.\n";
+    mergedImage->WriteToPPMFile(outputFileName);
+    delete mergedImage;
+    return true;
+}
+
 int main(int argc, char **argv) {
+    // Separate "--option value" pairs from the positional arguments
+    std::vector<std::string> args;
+    int frameCount = 1;
+    BVHBuildMode bvhBuildMode = MedianSplitBVH;
+    int threadCount = 0;
+    bool printStats = false;
+    bool heatmap = false;
+    bool bvhReport = false;
+    bool server = false;
+    std::string socketPath;
+    std::string cameraPathFileName;
+    bool merge = false;
+    bool crop = false;
+    int cropX0 = 0, cropY0 = 0, cropX1 = 0, cropY1 = 0;
+    int tileIdx = 0, tileCount = 0;
+    int workerCount = 0;
+    double workerTimeout = COORDINATOR_TILE_TIMEOUT;
+    int lightSampleCount = 0;
+    bool hugePages = false;
+    bool compressedBVH = false;
+    bool leafClusters = true;
+    size_t geometryCacheBytes = 0;
+    std::string pageDirectory = getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp";
+    int progressivePassCount = 0;
+    double writeInterval = 2;
+    bool denoise = false;
+    bool writeFeatures = false;
+    int dofSampleCount = DOF_SAMPLE_COUNT;
+    int shadowSampleCount = SHADOW_SAMPLE_COUNT;
+    double timeBudget = 0;
+    bool showProgress = false;
+    std::string checkpointFileName;
+    bool resume = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i+1 < argc) {
+            try {
+                frameCount = std::stoi(argv[++i]);
+                if (frameCount < 1) throw std::invalid_argument("Frame count must be at least 1.");
+            } catch (std::invalid_argument& e) {
+                std::cout << "Frame count not specified correctly.\n";
+                return -1;
+            }
+        } else if (arg == "--threads" && i+1 < argc) {
+            try {
+                threadCount = std::stoi(argv[++i]);
+                if (threadCount < 0) throw std::invalid_argument("Thread count must not be negative.");
+            } catch (std::invalid_argument& e) {
+                std::cout << "Thread count not specified correctly.\n";
+                return -1;
+            }
+        } else if (arg == "--workers" && i+1 < argc) {
+            try {
+                workerCount = std::stoi(argv[++i]);
+                if (workerCount < 0) throw std::invalid_argument("Worker count must not be negative.");
+            } catch (std::invalid_argument& e) {
+                std::cout << "Worker count not specified correctly.\n";
+                return -1;
+            }
+        } else if (arg == "--worker-timeout" && i+1 < argc) {
+            try {
+                workerTimeout = std::stod(argv[++i]);
+                if (workerTimeout <= 0) throw std::invalid_argument("Worker timeout must be positive.");
+            } catch (std::invalid_argument& e) {
+                std::cout << "Worker timeout not specified correctly.\n";
+                return -1;
+            }
+        } else if (arg == "--light-samples" && i+1 < argc) {
+            try {
+                lightSampleCount = std::stoi(argv[++i]);
+                if (lightSampleCount < 0) throw std::invalid_argument("Light sample count must not be negative.");
+            } catch (std::invalid_argument& e) {
+                std::cout << "Light sample count not specified correctly.\n";
+                return -1;
+            }
+        } else if (arg == "--progressive" && i+1 < argc) {
+            try {
+                progressivePassCount = std::stoi(argv[++i]);
+                if (progressivePassCount < 0) throw std::invalid_argument("Pass count must not be negative.");
+            } catch (std::invalid_argument& e) {
+                std::cout << "Progressive pass count not specified correctly.\n";
+                return -1;
+            }
+        } else if (arg == "--write-interval" && i+1 < argc) {
+            try {
+                writeInterval = std::stod(argv[++i]);
+                if (writeInterval < 0) throw std::invalid_argument("Write interval must not be negative.");
+            } catch (std::invalid_argument& e) {
+                std::cout << "Write interval not specified correctly.\n";
+                return -1;
+            }
+        } else if (arg == "--time-budget" && i+1 < argc) {
+            try {
+                timeBudget = std::stod(argv[++i]);
+                if (timeBudget <= 0) throw std::invalid_argument("Time budget must be positive.");
+            } catch (std::invalid_argument& e) {
+                std::cout << "Time budget not specified correctly.\n";
+                return -1;
+            }
+        } else if (arg == "--progress") {
+            showProgress = true;
+        } else if (arg == "--checkpoint" && i+1 < argc) {
+            checkpointFileName = argv[++i];
+        } else if (arg == "--resume") {
+            resume = true;
+        } else if ((arg == "--dof-samples" || arg == "--shadow-samples") && i+1 < argc) {
+            try {
+                int sampleCount = std::stoi(argv[++i]);
+                if (sampleCount < 1) throw std::invalid_argument("Sample count must be at least 1.");
+                (arg == "--dof-samples" ? dofSampleCount : shadowSampleCount) = sampleCount;
+            } catch (std::invalid_argument& e) {
+                std::cout << "Sample count not specified correctly.\n";
+                return -1;
+            }
+        } else if (arg == "--denoise") {
+            denoise = true;
+        } else if (arg == "--features") {
+            writeFeatures = true;
+        } else if (arg == "--huge-pages") {
+            hugePages = true;
+        } else if (arg == "--compressed-bvh") {
+            compressedBVH = true;
+        } else if (arg == "--no-leaf-clusters") {
+            leafClusters = false;
+        } else if (arg == "--geometry-cache" && i+1 < argc) {
+            try {
+                int cacheMegabytes = std::stoi(argv[++i]);
+                if (cacheMegabytes < 1) throw std::invalid_argument("Cache size must be at least 1 MB.");
+                geometryCacheBytes = (size_t)cacheMegabytes << 20;
+            } catch (std::invalid_argument& e) {
+                std::cout << "Geometry cache size not specified correctly.\n";
+                return -1;
+            }
+        } else if (arg == "--page-dir" && i+1 < argc) {
+            pageDirectory = argv[++i];
+        } else if (arg == "--stats") {
+            printStats = true;
+        } else if (arg == "--heatmap") {
+            heatmap = true;
+        } else if (arg == "--bvh-report") {
+            bvhReport = true;
+        } else if (arg == "--camera-path" && i+1 < argc) {
+            cameraPathFileName = argv[++i];
+        } else if (arg == "--server") {
+            server = true;
+        } else if (arg == "--socket" && i+1 < argc) {
+            server = true;
+            socketPath = argv[++i];
+        } else if (arg == "--crop" && i+4 < argc) {
+            try {
+                cropX0 = std::stoi(argv[++i]);
+                cropY0 = std::stoi(argv[++i]);
+                cropX1 = std::stoi(argv[++i]);
+                cropY1 = std::stoi(argv[++i]);
+                if (cropX0 < 0 || cropY0 < 0 || cropX1 <= cropX0 || cropY1 <= cropY0)
+                    throw std::invalid_argument("Crop window must not be empty.");
+                crop = true;
+            } catch (std::invalid_argument& e) {
+                std::cout << "Crop window not specified correctly.\n";
+                return -1;
+            }
+        } else if (arg == "--tile" && i+2 < argc) {
+            try {
+                tileIdx = std::stoi(argv[++i]);
+                tileCount = std::stoi(argv[++i]);
+                if (tileCount < 1 || tileIdx < 0 || tileIdx >= tileCount)
+                    throw std::invalid_argument("Tile index must be in [0, n).");
+            } catch (std::invalid_argument& e) {
+                std::cout << "Tile not specified correctly.\n";
+                return -1;
+            }
+        } else if (arg == "--merge") {
+            merge = true;
+        } else if (arg == "--bvh" && i+1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "median") {
+                bvhBuildMode = MedianSplitBVH;
+            } else if (mode == "lbvh") {
+                bvhBuildMode = LinearBVH;
+            } else if (mode == "sbvh") {
+                bvhBuildMode = SpatialSplitBVH;
+            } else {
+                std::cout << "BVH build mode not specified correctly.\n";
+                return -1;
+            }
+        } else {
+            args.push_back(arg);
+        }
+    }
+
     // Supply the user with usage info if they did not enter enough command line arguments
-    if (argc < 2) {
-        std::cout << "usage: scenefile [outputfile] [softshadows] [dof]\n"
+    if (args.size() < 1) {
+        std::cout << "usage: scenefile [outputfile] [softshadows] [dof] [--frames n] [--bvh median|lbvh|sbvh] [--threads n] [--stats] [--heatmap] [--bvh-report] [--camera-path file] [--crop x0 y0 x1 y1] [--tile i n] [--workers n [--worker-timeout s]] [--light-samples k] [--huge-pages] [--compressed-bvh] [--no-leaf-clusters] [--geometry-cache mb [--page-dir dir]] [--progressive n] [--write-interval s] [--dof-samples n] [--shadow-samples n] [--denoise] [--features] [--time-budget s] [--progress] [--checkpoint file [--resume]]\n"
+            << "       --server [--socket path] scenefile [scenefile ...]\n"
+            << "       --merge outputfile partfile [partfile ...]\n"
             << "scenefile - path to input file containing scene description\n"
             << "outputfile - name for final output image file (optional)\n"
             << "softshadows -  soft shadow toggle, 0 = off, 1 = on (optional)\n"
-            << "dof - depth of field toggle, 0 = off, 1 = on (optional)\n";
+            << "dof - depth of field toggle, 0 = off, 1 = on (optional)\n"
+            << "--frames n - render n frames of animation, advancing object motions each frame (optional)\n"
+            << "--bvh median|lbvh|sbvh - BVH build mode, lbvh builds faster for quick previews, sbvh builds slower but traces faster through large or thin triangles (optional)\n"
+            << "--threads n - number of render threads, 0 = all hardware threads (optional)\n"
+            << "--stats - print ray counts, traversal work and phase timings as JSON (optional)\n"
+            << "--heatmap - write per-pixel BVH node visit, primitive test and render time images instead of the shaded image (optional)\n"
+            << "--bvh-report - print BVH quality measures (SAH cost, depth, leaf sizes, sibling overlap) as JSON (optional)\n"
+            << "--camera-path file - render one frame per view or spline frame in a camera path file (optional)\n"
+            << "--crop x0 y0 x1 y1 - render only pixels [x0, x1) x [y0, y1) of the full frame (optional)\n"
+            << "--tile i n - render only the i-th of n horizontal bands of the full frame (optional)\n"
+            << "--workers n - render tiles in n forked worker processes, retrying tiles of workers that crash (optional)\n"
+            << "--worker-timeout s - with --workers, retry a tile whose worker has not finished it after s seconds, default 600 (optional)\n"
+            << "--light-samples k - shade each hit with k point lights importance sampled from a light tree, 0 = all lights (optional)\n"
+            << "--huge-pages - back scene geometry and the BVH with transparent huge pages (optional)\n"
+            << "--compressed-bvh - traverse a BVH with 8 bit quantized bounds that takes far less memory (optional)\n"
+            << "--no-leaf-clusters - traverse small subtrees of spheres or triangles node by node instead of testing their objects together (optional)\n"
+            << "--geometry-cache mb - keep scene geometry in a page file while rendering, paging it in through a cache of mb megabytes (optional)\n"
+            << "--page-dir dir - directory for the --geometry-cache page file, default $TMPDIR or /tmp (optional)\n"
+            << "--progressive n - write a quick preview, then refine the image over n sample passes (optional)\n"
+            << "--write-interval s - with --progressive, write the image at most every s seconds, default 2 (optional)\n"
+            << "--dof-samples n - camera rays per pixel with depth of field, default 20 (optional)\n"
+            << "--shadow-samples n - shadow rays per light with soft shadows, default 50 (optional)\n"
+            << "--denoise - filter sampling noise out of the image, guided by first-hit albedo, normals and depth (optional)\n"
+            << "--features - also write the first-hit albedo, normal and depth images (optional)\n"
+            << "--time-budget s - stop each frame after s seconds and write the image rendered so far (optional)\n"
+            << "--progress - report progress and the estimated time left on stderr while rendering (optional)\n"
+            << "--checkpoint file - save the render's state to file after every sample pass (optional)\n"
+            << "--resume - continue the render saved in the --checkpoint file, if there is one (optional)\n"
+            << "--merge - reassemble partial images written with --crop or --tile into outputfile\n"
+            << "--server - keep the given scenes loaded and render them on requests read from stdin\n"
+            << "--socket path - serve requests on a local UNIX socket instead of stdin\n";
         return -1;
     }
 
+    // Merge mode: paste partial renders back into the full frame
+    if (merge) {
+        if (args.size() < 2) {
+            std::cout << "Merge needs an output file and at least one partial image.\n";
+            return -1;
+        }
+        std::vector<std::string> partFileNames(args.begin() + 1, args.end());
+        return MergeImages(args[0], partFileNames) ? 0 : -1;
+    }
+
+    // Server mode: keep every given scene loaded and render them on request
+    if (server) {
+        ThreadPool threadPool(threadCount);
+        RenderServer renderServer(&threadPool);
+        for (const std::string& sceneFileName : args) {
+            Scene* scene = LoadScene(sceneFileName, false, false, bvhBuildMode, hugePages, compressedBVH, leafClusters,
+                geometryCacheBytes, pageDirectory);
+            if (scene == NULL)
+                return -1;
+            renderServer.AddScene(sceneFileName, scene);
+        }
+        if (socketPath.empty()) {
+            renderServer.Serve(std::cin, std::cout);
+        } else if (!renderServer.ServeSocket(socketPath)) {
+            std::cout << "Could not listen on socket " << socketPath << ".\n";
+            return -1;
+        }
+        return 0;
+    }
+
     // Get the scene and output file names from the command line arguments and ensure they are valid
-    std::string sceneFileName = argv[1];
-    std::string outputFileName = argc > 2 ?
-        Utilities::ReplaceExtension(argv[2], ".ppm") :
+    std::string sceneFileName = args[0];
+    std::string outputFileName = args.size() > 1 ?
+        Utilities::ReplaceExtension(args[1], ".ppm") :
         Utilities::ReplaceExtension(sceneFileName, ".ppm");
-    std::ifstream sceneFile;
-    sceneFile.open(sceneFileName);
-    if (!sceneFile) {
-        std::cout << "Scene file does not exist. Please try again.\n";
-        return -1;
-    }
     bool softShadows = false;
-    if (argc > 3) {
+    if (args.size() > 2) {
         try {
-            softShadows = std::stoi(argv[3]) == 0 ? false : true;
+            softShadows = std::stoi(args[2]) == 0 ? false : true;
         } catch (std::invalid_argument& e) {
             std::cout << "Soft shadows flag not specified correctly.\n";
             return -1;
         }
     }
     bool depthOfField = false;
-    if (argc > 4) {
+    if (args.size() > 3) {
         try {
-            depthOfField = std::stoi(argv[4]) == 0 ? false : true;
+            depthOfField = std::stoi(args[3]) == 0 ? false : true;
         } catch (std::invalid_argument& e) {
             std::cout << "Depth of field not specified correctly.\n";
             return -1;
         }
     }
 
-    // Try to initialize a scene using the scene file
-    Scene* scene = new Scene(softShadows, depthOfField);
-    SceneInitStatus sceneInitStatus = scene->InitFromFile(sceneFile);
-    // Print an error message specifying what went wrong if unsuccessful
-    if (sceneInitStatus != Success) {
-        std::cout << "Scene file load error: " << sceneInitStatusText[sceneInitStatus] << " is not properly defined.\n";
+    // Load the scene and construct its BVH
+    Scene* scene = LoadScene(sceneFileName, softShadows, depthOfField, bvhBuildMode, hugePages, compressedBVH, leafClusters,
+        geometryCacheBytes, pageDirectory);
+    if (scene == NULL)
+        return -1;
+    scene->SetThreadCount(threadCount);
+    scene->SetLightSampleCount(lightSampleCount);
+    scene->SetSampleCounts(dofSampleCount, shadowSampleCount);
+    if ((denoise || writeFeatures) && (workerCount > 0 || heatmap)) {
+        std::cout << "--denoise and --features cannot be combined with --workers or --heatmap.\n";
+        delete scene;
+        return -1;
+    }
+    if (timeBudget > 0 && (workerCount > 0 || heatmap)) {
+        std::cout << "--time-budget cannot be combined with --workers or --heatmap.\n";
         delete scene;
         return -1;
     }
-    // Construct a BVH for the scene to improve ray tracing speed
-    scene->ConstructBVH();
 
-    // Render a ray traced image of the scene
-    Image renderImage = scene->Render();
+    // Renders in this process report their progress, stop once the time budget
+    // is spent and end early on SIGINT, still writing what they have
+    RenderProgress renderProgress;
+    if (workerCount == 0) {
+        renderProgress.SetTimeBudget(timeBudget);
+        if (showProgress)
+            renderProgress.SetReportStream(&std::cerr, isatty(STDERR_FILENO));
+        scene->SetProgress(&renderProgress);
+        interruptibleProgress = &renderProgress;
+        signal(SIGINT, HandleInterrupt);
+    }
 
-    // Write the rendered image to an output file for viewing
-    renderImage.WriteToPPMFile(outputFileName);
+    // A camera path gives one camera per frame, otherwise every frame uses the scene camera
+    std::vector<Camera> cameras;
+    if (!cameraPathFileName.empty()) {
+        std::ifstream cameraPathFile;
+        cameraPathFile.open(cameraPathFileName);
+        CameraPath cameraPath;
+        if (!cameraPathFile || !cameraPath.InitFromFile(cameraPathFile)) {
+            if (cameraPath.ErrorLine() > 0)
+                std::cout << "Camera path file is not properly defined at line " << cameraPath.ErrorLine() << ".\n";
+            else
+                std::cout << "Camera path file is missing or not properly defined.\n";
+            delete scene;
+            return -1;
+        }
+        cameras = cameraPath.Cameras(scene->SceneCamera().Width(), scene->SceneCamera().Height());
+        frameCount = cameras.size();
+    }
+    bool checkpointing = !checkpointFileName.empty();
+    if (resume && !checkpointing) {
+        std::cout << "--resume needs a --checkpoint file.\n";
+        delete scene;
+        return -1;
+    }
+    if (checkpointing && (frameCount > 1 || workerCount > 0 || heatmap)) {
+        std::cout << "--checkpoint cannot be combined with animations, --workers or --heatmap.\n";
+        delete scene;
+        return -1;
+    }
+
+    // Restrict rendering to a crop window or tile of the full frame. Partial images
+    // record where they belong so that --merge can reassemble them.
+    int fullWidth = scene->SceneCamera().Width();
+    int fullHeight = scene->SceneCamera().Height();
+    if (tileCount > 0) {
+        crop = true;
+        cropX0 = 0;
+        cropX1 = fullWidth;
+        cropY0 = (int)((long long)fullHeight * tileIdx / tileCount);
+        cropY1 = (int)((long long)fullHeight * (tileIdx + 1) / tileCount);
+    }
+    std::string outputComment;
+    if (crop) {
+        if (cropX1 > fullWidth || cropY1 > fullHeight || cropY1 <= cropY0) {
+            std::cout << "Crop window does not fit inside the " << fullWidth << "x" << fullHeight << " image.\n";
+            delete scene;
+            return -1;
+        }
+        scene->SetCropWindow(cropX0, cropY0, cropX1, cropY1);
+        std::ostringstream comment;
+        comment << "crop " << cropX0 << " " << cropY0 << " " << fullWidth << " " << fullHeight;
+        outputComment = comment.str();
+    }
+
+    // A checkpoint is written after every pass of a progressive render and can only be
+    // resumed by a render of the same scene file, sampling settings and pass count
+    int renderPassCount = progressivePassCount > 0 ? progressivePassCount : PROGRESSIVE_PASS_COUNT;
+    RenderCheckpoint checkpoint;
+    if (checkpointing) {
+        uint64_t renderHash = Random::Hash(Utilities::HashFile(sceneFileName) ^ scene->SamplingHash());
+        renderHash = Random::Hash(renderHash ^ ((uint64_t)renderPassCount << 1 | (denoise || writeFeatures)));
+        if (resume && !checkpoint.Read(checkpointFileName)) {
+            if (std::ifstream(checkpointFileName)) {
+                std::cout << "Checkpoint file " << checkpointFileName << " could not be read.\n";
+                delete scene;
+                return -1;
+            }
+            std::cerr << "No checkpoint found in " << checkpointFileName << ", starting from the beginning.\n";
+            checkpoint = RenderCheckpoint();
+        } else if (resume && checkpoint.renderHash != renderHash) {
+            std::cout << "Checkpoint " << checkpointFileName << " was saved from a different scene or settings.\n";
+            delete scene;
+            return -1;
+        }
+        checkpoint.renderHash = renderHash;
+    }
+
+    // Renders the scene and writes either the image or its diagnostic heatmaps.
+    // Images are written on a separate thread so that writing one frame
+    // overlaps rendering the next.
+    // The writer thread keeps its own total, joined into outputSeconds at the end
+    double outputSeconds = 0;
+    double writerSeconds = 0;
+    double denoiseSeconds = 0;
+    Denoiser denoiser(threadCount);
+    std::thread writer;
+    bool renderFailed = false;
+    auto renderFrame = [&](const std::string& frameFileName) {
+        if (heatmap) {
+            RenderHeatmaps heatmaps;
+            scene->Render(&heatmaps);
+            Timer outputTimer;
+            heatmaps.nodeVisits.WriteToPPMFile(Utilities::ReplaceExtension(frameFileName, "_nodes.ppm"));
+            heatmaps.primitiveTests.WriteToPPMFile(Utilities::ReplaceExtension(frameFileName, "_tests.ppm"));
+            heatmaps.renderTime.WriteToPPMFile(Utilities::ReplaceExtension(frameFileName, "_time.ppm"));
+            outputSeconds += outputTimer.Seconds();
+        } else {
+            // First-hit features are recorded while rendering if the image is to be denoised
+            RenderFeatures renderFeatures;
+            RenderFeatures* features = denoise || writeFeatures ? &renderFeatures : NULL;
+            Image* renderImage;
+            if (workerCount > 0) {
+                // Workers render with the thread count given, or an even share of the hardware
+                // threads. They must not be forked while the previous frame's writer thread
+                // may hold a lock in the heap or stdio, which the children would never see released.
+                if (writer.joinable())
+                    writer.join();
+                RenderCoordinator coordinator(scene, workerCount, threadCount, COORDINATOR_TILE_SIZE, workerTimeout);
+                renderImage = new Image();
+                if (!coordinator.Render(*renderImage)) {
+                    std::cout << "Workers failed to render " << frameFileName << ".\n";
+                    renderFailed = true;
+                    delete renderImage;
+                    return;
+                }
+            } else if (progressivePassCount > 0 || timeBudget > 0 || checkpointing) {
+                // Write the preview, then the refined image whenever writeInterval seconds
+                // have passed, so a shot can be judged while it is still rendering. The
+                // final pass is written below like any other frame. A time budget or
+                // checkpoints alone split the samples over passes too, so that the image
+                // is refined evenly when time runs out, but write only the final image.
+                if (writer.joinable())
+                    writer.join();
+                Timer writeTimer;
+                renderImage = new Image(scene->RenderProgressive(renderPassCount,
+                    [&](const Image& image, int pass, int passCount) {
+                        if (checkpointing && pass > 0 && !checkpoint.Write(checkpointFileName))
+                            std::cerr << "Could not write checkpoint " << checkpointFileName << ".\n";
+                        if (progressivePassCount == 0 || pass == passCount || (pass > 0 && writeTimer.Seconds() < writeInterval))
+                            return true;
+                        // The preview comes before any features are recorded
+                        if (denoise && pass > 0) {
+                            Timer denoiseTimer;
+                            Image denoised = denoiser.Denoise(image, *features);
+                            denoiseSeconds += denoiseTimer.Seconds();
+                            Timer outputTimer;
+                            denoised.WriteToPPMFile(frameFileName, outputComment);
+                            outputSeconds += outputTimer.Seconds();
+                        } else {
+                            Timer outputTimer;
+                            image.WriteToPPMFile(frameFileName, outputComment);
+                            outputSeconds += outputTimer.Seconds();
+                        }
+                        writeTimer.Reset();
+                        return true;
+                    }, features, checkpointing ? &checkpoint : NULL));
+            } else {
+                renderImage = new Image(scene->Render(NULL, features));
+            }
+            if (renderProgress.Stopped() && !showProgress)
+                std::cerr << renderProgress.Summary() << "\n";
+            if (denoise) {
+                Timer denoiseTimer;
+                *renderImage = denoiser.Denoise(*renderImage, renderFeatures);
+                denoiseSeconds += denoiseTimer.Seconds();
+            }
+            if (writeFeatures) {
+                Timer outputTimer;
+                renderFeatures.albedo.WriteToPPMFile(Utilities::ReplaceExtension(frameFileName, "_albedo.ppm"), outputComment);
+                renderFeatures.normal.WriteToPPMFile(Utilities::ReplaceExtension(frameFileName, "_normal.ppm"), outputComment);
+                renderFeatures.depth.WriteToPPMFile(Utilities::ReplaceExtension(frameFileName, "_depth.ppm"));
+                outputSeconds += outputTimer.Seconds();
+            }
+            if (writer.joinable())
+                writer.join();
+            writer = std::thread([renderImage, frameFileName, outputComment, &writerSeconds]() {
+                Timer outputTimer;
+                renderImage->WriteToPPMFile(frameFileName, outputComment);
+                writerSeconds += outputTimer.Seconds();
+                delete renderImage;
+            });
+        }
+    };
+
+    if (frameCount == 1) {
+        // Render a ray traced image of the scene and write it to an output file for viewing
+        if (!cameras.empty())
+            scene->SetCamera(cameras[0]);
+        renderFrame(outputFileName);
+    } else {
+        // Render each frame of the animation or camera path, keeping the scene, textures
+        // and BVH alive between frames and only refitting the parts of the BVH that moved
+        for (int frame = 0; frame < frameCount; frame++) {
+            if (frame > 0)
+                scene->AdvanceFrame();
+            if (!cameras.empty())
+                scene->SetCamera(cameras[frame]);
+            renderFrame(Utilities::FrameFileName(outputFileName, frame));
+            if (renderFailed || renderProgress.Cancelled())
+                break;
+        }
+    }
+    if (writer.joinable())
+        writer.join();
+    outputSeconds += writerSeconds;
+
+    // Report where the rays went and where the time was spent
+    if (printStats) {
+        scene->SetOutputSeconds(outputSeconds);
+        scene->SetDenoiseSeconds(denoiseSeconds);
+        std::cout << scene->Stats().ToJSON() << "\n";
+    }
+    if (bvhReport)
+        std::cout << scene->AnalyzeBVH().ToJSON() << "\n";
 
     // Delete scene and exit
     delete scene;
-    return 0;
+    return renderFailed ? -1 : 0;
 }
@@ -2,6 +2,7 @@
 #define MATERIAL_H_
 
 #include "color.h"
+#include "vector3.h"
 
 namespace RayTracer {
 
@@ -13,6 +14,34 @@ struct Material {
     float a, ior;
 };
 
+/// A material preprocessed at load for shading, with colors already converted
+/// to vectors and constants that do not depend on the hit computed once.
+struct ShadingMaterial {
+    Vector3 Od, Os;
+    float ka, kd, ks, n;
+    float a, ior;
+    /// Fresnel reflectance at normal incidence
+    float F0;
+    /// Fraction of refracted light let through (1 - a)
+    float transmission;
+    /// True if refracted rays contribute, false for opaque materials
+    bool transparent;
+
+    ShadingMaterial(const Material& material) {
+        Od = Vector3(material.Od.r(), material.Od.g(), material.Od.b());
+        Os = Vector3(material.Os.r(), material.Os.g(), material.Os.b());
+        ka = material.ka;
+        kd = material.kd;
+        ks = material.ks;
+        n = material.n;
+        a = material.a;
+        ior = material.ior;
+        F0 = ((ior-1)/(ior+1))*((ior-1)/(ior+1));
+        transmission = 1 - a;
+        transparent = transmission != 0;
+    }
+};
+
 }  // namespace RayTracer
 
 #endif  // MATERIAL_H_
@@ -0,0 +1,439 @@
+#include "paged_geometry.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace RayTracer {
+
+namespace {
+
+// Writes all of the given bytes to a file descriptor, returning false on error
+bool WriteAll(int fd, const void* data, size_t size) {
+    const char* bytes = (const char*)data;
+    while (size > 0) {
+        ssize_t n = write(fd, bytes, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Reads exactly the given number of bytes at an offset of a file descriptor,
+// leaving its file position alone so that threads can read at once
+bool ReadAllAt(int fd, void* data, size_t size, uint64_t offset) {
+    char* bytes = (char*)data;
+    while (size > 0) {
+        ssize_t n = pread(fd, bytes, size, (off_t)offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        bytes += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+template <typename T>
+void Append(std::vector<char>& bytes, const T& value) {
+    const char* data = (const char*)&value;
+    bytes.insert(bytes.end(), data, data + sizeof(T));
+}
+
+void StoreVector(float* xyz, Vector3 v) {
+    xyz[0] = v.x();
+    xyz[1] = v.y();
+    xyz[2] = v.z();
+}
+
+Vector3 LoadVector(const float* xyz) {
+    return Vector3(xyz[0], xyz[1], xyz[2]);
+}
+
+}  // namespace
+
+PagedGeometry::PagedGeometry() {
+    root_ = 0;
+    file_ = -1;
+    slotBytes_ = 0;
+}
+
+PagedGeometry::~PagedGeometry() {
+    if (file_ >= 0)
+        close(file_);
+}
+
+bool PagedGeometry::Build(const BVHNode* root, const std::string& directory, size_t cacheBytes) {
+    nodes_.clear();
+    pages_.clear();
+    residentObjects_.clear();
+    residentArena_.Reset();
+    tokens_.clear();
+    slots_.clear();
+    pageSlots_.clear();
+    lru_.clear();
+    root_ = 0;
+    slotBytes_ = 0;
+    if (file_ >= 0)
+        close(file_);
+
+    // The page file is only ever read through its descriptor, so remove its
+    // name at once and let the kernel free it when the process exits
+    std::string path = (directory.empty() ? std::string(".") : directory) + "/raytracer-pages-XXXXXX";
+    std::vector<char> pathBuffer(path.begin(), path.end());
+    pathBuffer.push_back('\0');
+    file_ = mkstemp(pathBuffer.data());
+    if (file_ < 0)
+        return false;
+    unlink(pathBuffer.data());
+    if (root == NULL || root->IsEmpty())
+        return true;
+
+    BuildState state;
+    root_ = Encode(root, state);
+    if (state.failed) {
+        close(file_);
+        file_ = -1;
+        nodes_.clear();
+        pages_.clear();
+        residentObjects_.clear();
+        return false;
+    }
+    tokens_.assign(state.objectIds.size(), 0);
+
+    // Every slot can hold the largest page, and there is always one to load into
+    for (const Page& page : pages_)
+        slotBytes_ = std::max(slotBytes_, LoadedBytes(page));
+    size_t slotCount = slotBytes_ > 0 ? cacheBytes / slotBytes_ : 0;
+    slotCount = std::min(std::max(slotCount, (size_t)1), pages_.size());
+    slots_.resize(slotCount);
+    for (size_t i = 0; i < slots_.size(); i++)
+        slots_[i].lruPosition = lru_.insert(lru_.end(), (int)i);
+    pageSlots_.assign(pages_.size(), -1);
+    return true;
+}
+
+size_t PagedGeometry::ResidentBytes() const {
+    return nodes_.size() * sizeof(Node) + pages_.size() * sizeof(Page) +
+        residentObjects_.size() * sizeof(ResidentObject) + residentArena_.BytesReserved() + tokens_.size();
+}
+
+uint32_t PagedGeometry::Encode(const BVHNode* node, BuildState& state) {
+    int leafCount = PageableLeafCount(node, PAGED_GEOMETRY_PAGE_OBJECTS);
+    if (leafCount > 0)
+        return PAGED_GEOMETRY_PAGE_FLAG | WritePage(node, state);
+    if (node->IsLeaf()) {
+        ResidentObject resident = { node->BoundingBox(), node->Leaf()->CopyTo(residentArena_) };
+        residentObjects_.push_back(resident);
+        return PAGED_GEOMETRY_OBJECT_FLAG | (uint32_t)(residentObjects_.size() - 1);
+    }
+
+    // Store nodes depth first, with every left child directly after its parent
+    uint32_t index = (uint32_t)nodes_.size();
+    Node encoded;
+    encoded.bounds = node->BoundingBox();
+    nodes_.push_back(encoded);
+    uint32_t left = Encode(node->Left(), state);
+    uint32_t right = Encode(node->Right(), state);
+    nodes_[index].child[0] = left;
+    nodes_[index].child[1] = right;
+    return index;
+}
+
+int PagedGeometry::PageableLeafCount(const BVHNode* node, int limit) {
+    // Stop counting as soon as the subtree is known to be too large
+    if (limit <= 0)
+        return -1;
+    if (node->IsLeaf()) {
+        if (node->IsEmpty())
+            return -1;
+        ObjectType type = node->Leaf()->Type();
+        return type == SphereObject || type == TriangleObject ? 1 : -1;
+    }
+    int left = PageableLeafCount(node->Left(), limit);
+    if (left < 0)
+        return -1;
+    int right = PageableLeafCount(node->Right(), limit - left);
+    if (right < 0 || left + right > limit)
+        return -1;
+    return left + right;
+}
+
+void PagedGeometry::GatherPage(const BVHNode* node, std::vector<const BVHNode*>& nodes) {
+    nodes.push_back(node);
+    if (node->IsLeaf())
+        return;
+    GatherPage(node->Left(), nodes);
+    GatherPage(node->Right(), nodes);
+}
+
+uint32_t PagedGeometry::WritePage(const BVHNode* root, BuildState& state) {
+    std::vector<const BVHNode*> pageNodes;
+    GatherPage(root, pageNodes);
+
+    // Each object is stored once per page, spheres first, even if spatial
+    // splits left it in several of the page's leaves
+    std::vector<const Sphere*> spheres;
+    std::vector<const Triangle*> triangles;
+    std::unordered_map<const SceneObject*, int32_t> localIds;
+    for (const BVHNode* node : pageNodes) {
+        if (!node->IsLeaf() || localIds.count(node->Leaf()))
+            continue;
+        localIds[node->Leaf()] = 0;
+        if (node->Leaf()->Type() == SphereObject)
+            spheres.push_back((const Sphere*)node->Leaf());
+        else
+            triangles.push_back((const Triangle*)node->Leaf());
+    }
+    std::vector<const SceneObject*> objects(spheres.begin(), spheres.end());
+    objects.insert(objects.end(), triangles.begin(), triangles.end());
+    for (size_t i = 0; i < objects.size(); i++)
+        localIds[objects[i]] = (int32_t)i;
+
+    std::vector<char> bytes;
+    for (const Sphere* sphere : spheres) {
+        SphereRecord record;
+        StoreVector(record.center, sphere->Position());
+        record.radius = sphere->Radius();
+        record.materialIdx = sphere->MaterialIdx();
+        record.textureIdx = sphere->TextureIdx();
+        Append(bytes, record);
+    }
+    for (const Triangle* triangle : triangles) {
+        TriangleRecord record;
+        memset(&record, 0, sizeof(record));
+        for (int i = 0; i < 3; i++) {
+            StoreVector(record.vertices[i], triangle->Vertex(i));
+            StoreVector(record.normals[i], triangle->VertexNormal(i));
+            StoreVector(record.texCoords[i], triangle->TexCoord(i));
+        }
+        record.materialIdx = triangle->MaterialIdx();
+        record.textureIdx = triangle->TextureIdx();
+        record.hasNormals = triangle->HasNormals();
+        record.hasTexCoords = triangle->HasTexCoords();
+        Append(bytes, record);
+    }
+    // Nodes are gathered depth first, so a node's left child follows it and its
+    // right child follows the left child's subtree
+    std::unordered_map<const BVHNode*, int32_t> nodeIds;
+    for (size_t i = 0; i < pageNodes.size(); i++)
+        nodeIds[pageNodes[i]] = (int32_t)i;
+    for (const BVHNode* node : pageNodes) {
+        NodeRecord record;
+        StoreVector(record.bounds, node->BoundingBox().Min());
+        StoreVector(record.bounds + 3, node->BoundingBox().Max());
+        if (node->IsLeaf()) {
+            record.child[0] = -1 - localIds[node->Leaf()];
+            record.child[1] = 0;
+        } else {
+            record.child[0] = nodeIds[node->Left()];
+            record.child[1] = nodeIds[node->Right()];
+        }
+        Append(bytes, record);
+    }
+    for (const SceneObject* object : objects) {
+        auto id = state.objectIds.insert(std::make_pair(object, (uint32_t)state.objectIds.size())).first;
+        Append(bytes, id->second);
+    }
+
+    Page page;
+    page.bounds = root->BoundingBox();
+    page.offset = state.fileBytes;
+    page.sphereCount = (uint32_t)spheres.size();
+    page.triangleCount = (uint32_t)triangles.size();
+    page.nodeCount = (uint32_t)pageNodes.size();
+    pages_.push_back(page);
+    if (!WriteAll(file_, bytes.data(), bytes.size()))
+        state.failed = true;
+    state.fileBytes += bytes.size();
+    return (uint32_t)(pages_.size() - 1);
+}
+
+size_t PagedGeometry::FileBytes(const Page& page) {
+    return page.sphereCount * sizeof(SphereRecord) + page.triangleCount * sizeof(TriangleRecord) +
+        page.nodeCount * sizeof(NodeRecord) + (page.sphereCount + page.triangleCount) * sizeof(uint32_t);
+}
+
+size_t PagedGeometry::LoadedBytes(const Page& page) {
+    size_t objectCount = page.sphereCount + page.triangleCount;
+    return FileBytes(page) + page.sphereCount * sizeof(Sphere) + page.triangleCount * sizeof(Triangle) +
+        objectCount * (sizeof(const SceneObject*) + sizeof(uint32_t)) + page.nodeCount * sizeof(PageNode);
+}
+
+RaycastHit PagedGeometry::Raycast(Ray& ray, TraceContext& context, const SceneObject* ignoreObject) const {
+    if (IsEmpty()) {
+        context.stats.bvhNodesVisited++;
+        return RaycastHit();
+    }
+    return RaycastChild(ray, root_, context, ignoreObject);
+}
+
+RaycastHit PagedGeometry::RaycastChild(Ray& ray, uint32_t child, TraceContext& context,
+    const SceneObject* ignoreObject) const {
+    context.stats.bvhNodesVisited++;
+    if (child & PAGED_GEOMETRY_PAGE_FLAG) {
+        // Only load pages that the ray enters
+        uint32_t page = child & ~PAGED_GEOMETRY_PAGE_FLAG;
+        if (!pages_[page].bounds.IntersectsRay(ray))
+            return RaycastHit();
+        Slot& slot = Acquire(page, context);
+        RaycastHit hit = IntersectPageNode(ray, slot, 0, context, ignoreObject);
+        Release(slot);
+        return hit;
+    }
+    if (child & PAGED_GEOMETRY_OBJECT_FLAG) {
+        const ResidentObject& resident = residentObjects_[child & ~PAGED_GEOMETRY_OBJECT_FLAG];
+        if (!resident.bounds.IntersectsRay(ray) || resident.object == ignoreObject)
+            return RaycastHit();
+        context.stats.otherTests++;
+        RaycastHit hit = resident.object->IntersectRay(ray);
+        if (hit.hit)
+            ray.SetTMax(hit.distance);
+        return hit;
+    }
+    // Same order and tie breaking as the in-memory traversal
+    const Node& node = nodes_[child];
+    if (!node.bounds.IntersectsRay(ray))
+        return RaycastHit();
+    RaycastHit left = RaycastChild(ray, node.child[0], context, ignoreObject);
+    RaycastHit right = RaycastChild(ray, node.child[1], context, ignoreObject);
+    return left.distance < right.distance ? left : right;
+}
+
+RaycastHit PagedGeometry::RaycastPageNode(Ray& ray, const Slot& slot, int32_t node, TraceContext& context,
+    const SceneObject* ignoreObject) const {
+    context.stats.bvhNodesVisited++;
+    if (!slot.nodes[node].bounds.IntersectsRay(ray))
+        return RaycastHit();
+    return IntersectPageNode(ray, slot, node, context, ignoreObject);
+}
+
+RaycastHit PagedGeometry::IntersectPageNode(Ray& ray, const Slot& slot, int32_t node, TraceContext& context,
+    const SceneObject* ignoreObject) const {
+    const PageNode& pageNode = slot.nodes[node];
+    if (pageNode.child[0] < 0) {
+        int32_t object = -1 - pageNode.child[0];
+        const SceneObject* token = Token(slot.tokens[object]);
+        if (token == ignoreObject)
+            return RaycastHit();
+        if ((uint32_t)object < slot.spheres.size()) context.stats.sphereTests++;
+        else context.stats.triangleTests++;
+        RaycastHit hit = slot.objects[object]->IntersectRay(ray);
+        if (hit.hit) {
+            ray.SetTMax(hit.distance);
+            hit.object = token;
+        }
+        return hit;
+    }
+    RaycastHit left = RaycastPageNode(ray, slot, pageNode.child[0], context, ignoreObject);
+    RaycastHit right = RaycastPageNode(ray, slot, pageNode.child[1], context, ignoreObject);
+    return left.distance < right.distance ? left : right;
+}
+
+PagedGeometry::Slot& PagedGeometry::Acquire(uint32_t page, TraceContext& context) const {
+    std::unique_lock<std::mutex> lock(cacheMutex_);
+    for (;;) {
+        int slotIdx = pageSlots_[page];
+        if (slotIdx >= 0) {
+            // Wait for another thread to finish loading the page
+            Slot& slot = slots_[slotIdx];
+            if (slot.loading) {
+                slotReleased_.wait(lock);
+                continue;
+            }
+            if (slot.pins++ == 0)
+                lru_.erase(slot.lruPosition);
+            context.stats.geometryPageHits++;
+            return slot;
+        }
+        // Every slot is in use by other threads, each for one page at most
+        if (lru_.empty()) {
+            slotReleased_.wait(lock);
+            continue;
+        }
+
+        // Evict the least recently used page and read this one in its place,
+        // without holding up threads tracing pages already loaded
+        slotIdx = lru_.front();
+        lru_.pop_front();
+        Slot& slot = slots_[slotIdx];
+        if (slot.page >= 0)
+            pageSlots_[slot.page] = -1;
+        slot.page = (int)page;
+        slot.pins = 1;
+        slot.loading = true;
+        pageSlots_[page] = slotIdx;
+        lock.unlock();
+        Load(page, slot);
+        lock.lock();
+        slot.loading = false;
+        context.stats.geometryPageLoads++;
+        slotReleased_.notify_all();
+        return slot;
+    }
+}
+
+void PagedGeometry::Release(Slot& slot) const {
+    std::lock_guard<std::mutex> lock(cacheMutex_);
+    if (--slot.pins == 0) {
+        slot.lruPosition = lru_.insert(lru_.end(), (int)(&slot - slots_.data()));
+        slotReleased_.notify_all();
+    }
+}
+
+void PagedGeometry::Load(uint32_t pageIdx, Slot& slot) const {
+    const Page& page = pages_[pageIdx];
+    slot.buffer.resize(FileBytes(page));
+    if (!ReadAllAt(file_, slot.buffer.data(), slot.buffer.size(), page.offset)) {
+        std::cerr << "Could not read geometry page " << pageIdx << " back from the page file.\n";
+        std::abort();
+    }
+
+    // Rebuild the objects through their constructors, as the scene first made them
+    const char* bytes = slot.buffer.data();
+    slot.spheres.clear();
+    slot.spheres.reserve(page.sphereCount);
+    for (uint32_t i = 0; i < page.sphereCount; i++, bytes += sizeof(SphereRecord)) {
+        SphereRecord record;
+        memcpy(&record, bytes, sizeof(record));
+        slot.spheres.push_back(Sphere(LoadVector(record.center), record.radius, record.materialIdx, record.textureIdx));
+    }
+    slot.triangles.clear();
+    slot.triangles.reserve(page.triangleCount);
+    for (uint32_t i = 0; i < page.triangleCount; i++, bytes += sizeof(TriangleRecord)) {
+        TriangleRecord record;
+        memcpy(&record, bytes, sizeof(record));
+        Vector3 vertices[3], normals[3], texCoords[3];
+        for (int j = 0; j < 3; j++) {
+            vertices[j] = LoadVector(record.vertices[j]);
+            normals[j] = LoadVector(record.normals[j]);
+            texCoords[j] = LoadVector(record.texCoords[j]);
+        }
+        slot.triangles.push_back(Triangle(vertices, normals, texCoords, record.materialIdx, record.textureIdx,
+            record.hasNormals != 0, record.hasTexCoords != 0));
+    }
+    slot.objects.clear();
+    for (const Sphere& sphere : slot.spheres)
+        slot.objects.push_back(&sphere);
+    for (const Triangle& triangle : slot.triangles)
+        slot.objects.push_back(&triangle);
+
+    slot.nodes.resize(page.nodeCount);
+    for (uint32_t i = 0; i < page.nodeCount; i++, bytes += sizeof(NodeRecord)) {
+        NodeRecord record;
+        memcpy(&record, bytes, sizeof(record));
+        slot.nodes[i].bounds = AABB(LoadVector(record.bounds), LoadVector(record.bounds + 3));
+        slot.nodes[i].child[0] = record.child[0];
+        slot.nodes[i].child[1] = record.child[1];
+    }
+    slot.tokens.resize(slot.objects.size());
+    memcpy(slot.tokens.data(), bytes, slot.tokens.size() * sizeof(uint32_t));
+}
+
+}  // namespace RayTracer
@@ -0,0 +1,185 @@
+#ifndef PAGED_GEOMETRY_H_
+#define PAGED_GEOMETRY_H_
+
+#include "bvh_node.h"
+#include "aabb.h"
+#include "sphere.h"
+#include "triangle.h"
+#include "ray.h"
+#include "raycast_hit.h"
+#include "trace_context.h"
+#include "arena.h"
+
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+
+namespace RayTracer {
+
+#define PAGED_GEOMETRY_PAGE_OBJECTS 64
+#define PAGED_GEOMETRY_PAGE_FLAG 0x80000000u
+#define PAGED_GEOMETRY_OBJECT_FLAG 0x40000000u
+
+/// Scene geometry kept on disk and paged in on demand, reducing the memory
+/// a scene takes while it is rendered.
+///
+/// The top of a BVH stays in memory, while every subtree of at most
+/// PAGED_GEOMETRY_PAGE_OBJECTS spheres and triangles is written to a page
+/// file along with its objects. Rays entering a page's bounds load it into a
+/// fixed number of slots, least recently used first, so the memory taken by
+/// geometry while rendering is set by the cache size rather than by the
+/// scene. The pages are written from a tree built in memory, so the scene
+/// must still fit in memory until then. Traversal
+/// follows the same order and tie breaking as the in-memory tree and finds
+/// the same hits.
+///
+/// Hits report a stable token per object in place of the object, which moves
+/// whenever its page is reloaded: tokens may be compared, e.g. to ignore the
+/// object a ray starts on, but never dereferenced.
+class PagedGeometry {
+public:
+
+    /// Creates empty geometry that no ray hits
+    PagedGeometry();
+    /// Closes the page file
+    ~PagedGeometry();
+    PagedGeometry(const PagedGeometry&) = delete;
+    PagedGeometry& operator=(const PagedGeometry&) = delete;
+
+    /// Writes the pages of the tree with the given root to a new file in the
+    /// given directory, which is removed as soon as it is opened, and keeps the
+    /// top of the tree. Objects of other kinds stay in memory as copies. The
+    /// cache holds as many pages as fit in cacheBytes, and at least one.
+    /// Returns false if the page file could not be written.
+    bool Build(const BVHNode* root, const std::string& directory, size_t cacheBytes);
+    /// Returns true if no geometry has been paged out
+    bool IsEmpty() const { return pages_.empty() && nodes_.empty() && residentObjects_.empty(); }
+    /// Returns the number of pages and of slots in the cache
+    size_t PageCount() const { return pages_.size(); }
+    size_t SlotCount() const { return slots_.size(); }
+    /// Returns the number of bytes kept in memory for the top of the tree and object tokens
+    size_t ResidentBytes() const;
+    /// Returns the number of bytes the cache may grow to
+    size_t CacheBytes() const { return slots_.size() * slotBytes_; }
+
+    /// Casts a ray through the tree, returning the nearest hit within the ray's
+    /// range and shrinking tMax to each hit found, like Scene::Raycast.
+    /// Safe to call from several threads at once.
+    RaycastHit Raycast(Ray& ray, TraceContext& context, const SceneObject* ignoreObject) const;
+
+private:
+    struct Node {
+        AABB bounds;
+        // Index of an interior node, or a page or resident object flagged as such
+        uint32_t child[2];
+    };
+    struct Page {
+        AABB bounds;
+        uint64_t offset;
+        uint32_t sphereCount;
+        uint32_t triangleCount;
+        uint32_t nodeCount;
+    };
+    struct ResidentObject {
+        AABB bounds;
+        const SceneObject* object;
+    };
+    // A loaded page's subtree, root first; leaves refer to objects by index as
+    // -1 - index, spheres before triangles
+    struct PageNode {
+        AABB bounds;
+        int32_t child[2];
+    };
+    struct Slot {
+        int page = -1;
+        int pins = 0;
+        bool loading = false;
+        std::list<int>::iterator lruPosition;
+        std::vector<char> buffer;
+        std::vector<Sphere> spheres;
+        std::vector<Triangle> triangles;
+        std::vector<const SceneObject*> objects;
+        std::vector<uint32_t> tokens;
+        std::vector<PageNode> nodes;
+    };
+    // Page file records, written and read back by the same process
+    struct SphereRecord {
+        float center[3];
+        float radius;
+        int32_t materialIdx;
+        int32_t textureIdx;
+    };
+    struct TriangleRecord {
+        float vertices[3][3];
+        float normals[3][3];
+        float texCoords[3][3];
+        int32_t materialIdx;
+        int32_t textureIdx;
+        uint8_t hasNormals;
+        uint8_t hasTexCoords;
+    };
+    struct NodeRecord {
+        float bounds[6];
+        int32_t child[2];
+    };
+
+    // Objects numbered so far, shared leaves getting one number, and the end of
+    // the page file
+    struct BuildState {
+        std::unordered_map<const SceneObject*, uint32_t> objectIds;
+        uint64_t fileBytes = 0;
+        bool failed = false;
+    };
+
+    uint32_t Encode(const BVHNode* node, BuildState& state);
+    uint32_t WritePage(const BVHNode* root, BuildState& state);
+    // Returns the number of leaves below the node, or -1 if any holds an object
+    // that cannot be paged or there are more than limit
+    static int PageableLeafCount(const BVHNode* node, int limit);
+    static void GatherPage(const BVHNode* node, std::vector<const BVHNode*>& nodes);
+    static size_t FileBytes(const Page& page);
+    static size_t LoadedBytes(const Page& page);
+    const SceneObject* Token(uint32_t id) const { return (const SceneObject*)&tokens_[id]; }
+
+    RaycastHit RaycastChild(Ray& ray, uint32_t child, TraceContext& context, const SceneObject* ignoreObject) const;
+    RaycastHit RaycastPageNode(Ray& ray, const Slot& slot, int32_t node, TraceContext& context,
+        const SceneObject* ignoreObject) const;
+    // Tests a page node the ray is known to enter
+    RaycastHit IntersectPageNode(Ray& ray, const Slot& slot, int32_t node, TraceContext& context,
+        const SceneObject* ignoreObject) const;
+    // Returns the slot holding the page, loading it first if needed, and pins
+    // it until released
+    Slot& Acquire(uint32_t page, TraceContext& context) const;
+    void Release(Slot& slot) const;
+    // Reads a page into the slot. Runs on render threads, where there is no
+    // one to report a failure to, so a page that cannot be read aborts the
+    // render rather than leaving its geometry out of the image.
+    void Load(uint32_t page, Slot& slot) const;
+
+    std::vector<Node> nodes_;
+    std::vector<Page> pages_;
+    std::vector<ResidentObject> residentObjects_;
+    Arena residentArena_;
+    // One byte per paged object, whose addresses serve as the objects' tokens
+    std::vector<char> tokens_;
+    uint32_t root_;
+    int file_;
+    size_t slotBytes_;
+
+    // The cache, shared by all render threads
+    mutable std::mutex cacheMutex_;
+    mutable std::condition_variable slotReleased_;
+    mutable std::vector<Slot> slots_;
+    mutable std::vector<int> pageSlots_;
+    // Unpinned slots, least recently used first
+    mutable std::list<int> lru_;
+};
+
+}  // namespace RayTracer
+
+#endif  // PAGED_GEOMETRY_H_
@@ -1,5 +1,8 @@
 #include "point_light.h"
 
+#include <cmath>
+#include <algorithm>
+
 namespace RayTracer {
 
 PointLight::PointLight() {
@@ -23,6 +26,17 @@ PointLight::PointLight(Vector3 position, Color color, float c1, float c2, float
     attenuated_ = true;
 }
 
+void PointLight::SetSphere(float radius) {
+    shape_ = radius > 0 ? SphereShape : PointShape;
+    radius_ = radius;
+}
+
+void PointLight::SetRectangle(Vector3 edgeU, Vector3 edgeV) {
+    shape_ = RectangleShape;
+    edgeU_ = edgeU;
+    edgeV_ = edgeV;
+}
+
 float PointLight::Attenuate(Vector3 point) const {
     if (!attenuated_)
         return 1;
@@ -32,4 +46,87 @@ float PointLight::Attenuate(Vector3 point) const {
     return f;
 }
 
+Vector3 PointLight::SamplePoint(Vector3 from, float u, float v) const {
+    if (shape_ == SphereShape)
+        return SampleSphere(position_, radius_, from, u, v);
+    if (shape_ == RectangleShape)
+        return SampleRectangle(position_ - edgeU_/2 - edgeV_/2, edgeU_, edgeV_, from, u, v);
+    return position_;
+}
+
+Vector3 PointLight::SampleSphere(Vector3 center, float radius, Vector3 from, float u, float v) {
+    Vector3 w = center - from;
+    float d2 = Vector3::Dot(w, w);
+    if (d2 <= radius*radius)
+        return center;
+    float d = std::sqrt(d2);
+    w = w / d;
+
+    // Pick a direction uniformly inside the cone of directions that hit the sphere
+    float cosThetaMax = std::sqrt(std::max(0.0f, 1 - radius*radius/d2));
+    float cosTheta = 1 - u*(1 - cosThetaMax);
+    float sinTheta = std::sqrt(std::max(0.0f, 1 - cosTheta*cosTheta));
+    float phi = 2*M_PI*v;
+    Vector3 t1 = Vector3::Normalize(Vector3::Cross(std::fabs(w.x()) > 0.9f ? Vector3(0, 1, 0) : Vector3(1, 0, 0), w));
+    Vector3 t2 = Vector3::Cross(w, t1);
+    Vector3 direction = sinTheta*std::cos(phi)*t1 + sinTheta*std::sin(phi)*t2 + cosTheta*w;
+
+    // Return the near intersection of that direction with the sphere
+    float t = d*cosTheta - std::sqrt(std::max(0.0f, radius*radius - d2*sinTheta*sinTheta));
+    return from + t*direction;
+}
+
+Vector3 PointLight::SampleRectangle(Vector3 corner, Vector3 edgeU, Vector3 edgeV, Vector3 from, float u, float v) {
+    // Local frame with the rectangle in the plane z = z0 < 0 as seen from the point
+    float exl = edgeU.Length();
+    float eyl = edgeV.Length();
+    Vector3 x = edgeU / exl;
+    Vector3 y = edgeV / eyl;
+    Vector3 z = Vector3::Cross(x, y);
+    Vector3 d = corner - from;
+    float z0 = Vector3::Dot(d, z);
+    if (z0 > 0) {
+        z = -z;
+        z0 = -z0;
+    }
+    // Seen edge-on the rectangle has no solid angle, so sample it by area instead
+    if (z0 > -1e-6f)
+        return corner + u*edgeU + v*edgeV;
+    float x0 = Vector3::Dot(d, x);
+    float y0 = Vector3::Dot(d, y);
+    float x1 = x0 + exl;
+    float y1 = y0 + eyl;
+
+    // Normals of the planes through the point and each edge, and the internal
+    // angles of the spherical rectangle they bound
+    Vector3 v00(x0, y0, z0), v01(x0, y1, z0), v10(x1, y0, z0), v11(x1, y1, z0);
+    Vector3 n0 = Vector3::Normalize(Vector3::Cross(v00, v10));
+    Vector3 n1 = Vector3::Normalize(Vector3::Cross(v10, v11));
+    Vector3 n2 = Vector3::Normalize(Vector3::Cross(v11, v01));
+    Vector3 n3 = Vector3::Normalize(Vector3::Cross(v01, v00));
+    float g0 = std::acos(std::min(1.0f, std::max(-1.0f, -Vector3::Dot(n0, n1))));
+    float g1 = std::acos(std::min(1.0f, std::max(-1.0f, -Vector3::Dot(n1, n2))));
+    float g2 = std::acos(std::min(1.0f, std::max(-1.0f, -Vector3::Dot(n2, n3))));
+    float g3 = std::acos(std::min(1.0f, std::max(-1.0f, -Vector3::Dot(n3, n0))));
+    float b0 = n0.z();
+    float b1 = n2.z();
+    float k = 2*M_PI - g2 - g3;
+    float solidAngle = g0 + g1 - k;
+
+    // Invert the solid angle as a function of x, then sample y uniformly in solid angle
+    float au = u*solidAngle + k;
+    float fu = (std::cos(au)*b0 - b1) / std::sin(au);
+    float cu = (fu > 0 ? 1 : -1) / std::sqrt(fu*fu + b0*b0);
+    cu = std::min(1.0f, std::max(-1.0f, cu));
+    float xu = -(cu*z0) / std::sqrt(std::max(1e-12f, 1 - cu*cu));
+    xu = std::min(x1, std::max(x0, xu));
+    float dist = std::sqrt(xu*xu + z0*z0);
+    float h0 = y0 / std::sqrt(dist*dist + y0*y0);
+    float h1 = y1 / std::sqrt(dist*dist + y1*y1);
+    float hv = h0 + v*(h1 - h0);
+    float hv2 = hv*hv;
+    float yv = hv2 < 1 - 1e-6f ? (hv*dist) / std::sqrt(1 - hv2) : y1;
+    return from + xu*x + yv*y + z0*z;
+}
+
 }  // namespace RayTracer
@@ -6,8 +6,17 @@
 
 namespace RayTracer {
 
+/// Shapes a point light can emit from
+enum LightShape {
+    PointShape,
+    SphereShape,
+    RectangleShape
+};
+
 /// A point light defined by its position, color
-/// and optional attenuation factors.
+/// and optional attenuation factors. Given a radius or a pair of edges it
+/// becomes an area light emitting from a sphere or rectangle centered on its
+/// position, which is shaded from its center but casts soft shadows.
 class PointLight {
 public:
 
@@ -20,6 +29,11 @@ public:
     /// Destructor
     ~PointLight() {}
 
+    /// Makes the light a sphere of given radius (0 = a point light again)
+    void SetSphere(float radius);
+    /// Makes the light a rectangle spanned by two edge vectors through its center
+    void SetRectangle(Vector3 edgeU, Vector3 edgeV);
+
     /// Returns light attenuation factor from light to given point,
     /// returning 1 if the light does not support attenuation.
     float Attenuate(Vector3 point) const;
@@ -28,6 +42,23 @@ public:
     Vector3 Position() const { return position_; }
     /// Returns the light color
     Color LightColor() const { return color_; }
+    /// Returns true if the light is attenuated with distance
+    bool Attenuated() const { return attenuated_; }
+    /// Returns the constant, linear and quadratic attenuation factors (c1, c2, c3)
+    Vector3 AttenuationFactors() const { return attenuated_ ? Vector3(c1_, c2_, c3_) : Vector3(1, 0, 0); }
+    /// Returns the shape the light emits from
+    LightShape Shape() const { return shape_; }
+
+    /// Returns a point on the light, distributed uniformly over the solid angle
+    /// the light subtends as seen from the given point, for random numbers u, v
+    /// in [0, 1). Point lights always return their position.
+    Vector3 SamplePoint(Vector3 from, float u, float v) const;
+    /// Returns a point on the near side of a sphere, uniform in solid angle
+    /// from the given point (the center if the point is inside the sphere)
+    static Vector3 SampleSphere(Vector3 center, float radius, Vector3 from, float u, float v);
+    /// Returns a point on a rectangle, uniform in solid angle from the given point
+    /// (Urena et al. 2013, "An Area-Preserving Parametrization for Spherical Rectangles")
+    static Vector3 SampleRectangle(Vector3 corner, Vector3 edgeU, Vector3 edgeV, Vector3 from, float u, float v);
 
 private:
     Vector3 position_;
@@ -36,6 +67,9 @@ private:
     float c1_;
     float c2_;
     float c3_;
+    LightShape shape_ = PointShape;
+    float radius_ = 0;
+    Vector3 edgeU_, edgeV_;
 };
 
 }  // namespace RayTracer
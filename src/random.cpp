@@ -0,0 +1,37 @@
+#include "random.h"
+
+namespace RayTracer {
+
+Random::Random(uint64_t seed) {
+    Seed(seed);
+}
+
+void Random::Seed(uint64_t seed) {
+    state_ = 0;
+    NextUInt();
+    state_ += seed;
+    NextUInt();
+}
+
+uint32_t Random::NextUInt() {
+    uint64_t oldState = state_;
+    state_ = oldState * 6364136223846793005ULL + 1442695040888963407ULL;
+    uint32_t xorShifted = (uint32_t)(((oldState >> 18u) ^ oldState) >> 27u);
+    uint32_t rotation = (uint32_t)(oldState >> 59u);
+    return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+}
+
+float Random::NextFloat() {
+    // Use the top 24 bits so the result is exactly representable and never reaches 1
+    return (NextUInt() >> 8) * (1.0f / 16777216.0f);
+}
+
+uint64_t Random::Hash(uint64_t value) {
+    // SplitMix64 finalizer
+    value += 0x9E3779B97F4A7C15ULL;
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+}  // namespace RayTracer
@@ -0,0 +1,33 @@
+#ifndef RANDOM_H_
+#define RANDOM_H_
+
+#include <cstdint>
+
+namespace RayTracer {
+
+/// A small, fast pseudo random number generator (PCG32) that can be
+/// owned by each render thread, unlike the shared global rand().
+class Random {
+public:
+
+    /// Creates a generator with the given seed
+    Random(uint64_t seed = 1);
+
+    /// Restarts the sequence from the given seed
+    void Seed(uint64_t seed);
+    /// Returns a uniformly distributed 32 bit integer
+    uint32_t NextUInt();
+    /// Returns a uniformly distributed float in [0, 1)
+    float NextFloat();
+
+    /// Scrambles a value into a well distributed seed, so that neighbouring
+    /// indices (e.g. pixel indices) give unrelated sequences
+    static uint64_t Hash(uint64_t value);
+
+private:
+    uint64_t state_;
+};
+
+}  // namespace RayTracer
+
+#endif  // RANDOM_H_
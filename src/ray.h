@@ -3,28 +3,56 @@
 
 #include "vector3.h"
 
+#include <limits>
+
 namespace RayTracer {
 
-/// A 3D ray defined by its origin and unit direction.
+/// A 3D ray defined by its origin and unit direction, limited to the
+/// distances in (tMin, tMax]. The reciprocal direction and its signs are
+/// computed once on construction for the slab tests run at every BVH node.
 class Ray {
 public:
 
     /// Default constructor creates a ray pointing up from the origin
-    Ray();
-    /// Creates a ray with specified origin and direction (direction will be normalized)
-    Ray(Vector3 origin, Vector3 direction);
+    Ray() : Ray(Vector3(0, 0, 0), Vector3(0, 1, 0)) {}
+    /// Creates a ray with specified origin and direction (direction will be
+    /// normalized), accepting hits at distances in (tMin, tMax]
+    Ray(Vector3 origin, Vector3 direction, float tMin = 0, float tMax = std::numeric_limits<float>::infinity())
+        : origin_(origin), direction_(Vector3::Normalize(direction)), tMin_(tMin), tMax_(tMax) {
+        // Zero components give infinite reciprocals, which the slab test relies on
+        inverseDirection_ = 1 / direction_;
+        sign_[0] = inverseDirection_.x() < 0;
+        sign_[1] = inverseDirection_.y() < 0;
+        sign_[2] = inverseDirection_.z() < 0;
+    }
 
     /// Returns the ray origin
     Vector3 Origin() const { return origin_; }
     /// Returns the ray direction
     Vector3 Direction() const { return direction_; }
+    /// Returns the component-wise reciprocal of the ray direction
+    Vector3 InverseDirection() const { return inverseDirection_; }
+    /// Returns 1 if the direction is negative along the given axis, 0 otherwise
+    int Sign(int axis) const { return sign_[axis]; }
+
+    /// Returns the smallest distance (exclusive) at which hits are accepted
+    float TMin() const { return tMin_; }
+    /// Returns the largest distance (inclusive) at which hits are accepted
+    float TMax() const { return tMax_; }
+    /// Sets the largest accepted distance, e.g. to the closest hit found so far
+    void SetTMax(float tMax) { tMax_ = tMax; }
+    /// Returns true if a hit at the given distance lies within the ray's range
+    bool InRange(float t) const { return t > tMin_ && t <= tMax_; }
 
     /// Returns a point at given distance along the ray
-    Vector3 GetPoint(float distance) const;
+    Vector3 GetPoint(float distance) const { return origin_ + direction_*distance; }
 
 private:
     Vector3 origin_;
     Vector3 direction_;
+    Vector3 inverseDirection_;
+    int sign_[3];
+    float tMin_, tMax_;
 };
 
 }  // namespace RayTracer
@@ -0,0 +1,147 @@
+#include "render_checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace RayTracer {
+
+namespace {
+
+const char checkpointMagic[8] = { 'R', 'T', 'C', 'K', 'P', 'T', '0', '1' };
+
+template <typename T>
+void WriteValue(std::ofstream& file, T value) {
+    file.write((const char*)&value, sizeof(T));
+}
+
+template <typename T>
+bool ReadValue(std::ifstream& file, T& value) {
+    return (bool)file.read((char*)&value, sizeof(T));
+}
+
+// Colors are stored as three floats, whatever the in-memory layout
+void WriteColors(std::ofstream& file, const Image& image) {
+    for (int y = 0; y < image.Height(); y++) {
+        for (int x = 0; x < image.Width(); x++) {
+            Color c = image.GetPixel(x, y);
+            float rgb[3] = { c.r(), c.g(), c.b() };
+            file.write((const char*)rgb, sizeof(rgb));
+        }
+    }
+}
+
+// Flushes a closed file to disk, so that renaming it over the old checkpoint
+// cannot leave an empty file in its place after a crash
+bool SyncFile(const std::string& fileName) {
+    int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool synced = fsync(fd) == 0;
+    close(fd);
+    return synced;
+}
+
+bool ReadColors(std::ifstream& file, Image& image) {
+    for (int y = 0; y < image.Height(); y++) {
+        for (int x = 0; x < image.Width(); x++) {
+            float rgb[3];
+            if (!file.read((char*)rgb, sizeof(rgb)))
+                return false;
+            image.SetPixel(x, y, Color(rgb[0], rgb[1], rgb[2]));
+        }
+    }
+    return true;
+}
+
+}  // namespace
+
+bool RenderCheckpoint::Write(const std::string& fileName) const {
+    // Write next to the old checkpoint and swap it in, so that a process killed
+    // while writing leaves the previous checkpoint intact
+    std::string tempFileName = fileName + ".tmp";
+    std::ofstream file(tempFileName, std::ios::binary | std::ios::trunc);
+    if (!file)
+        return false;
+    file.write(checkpointMagic, sizeof(checkpointMagic));
+    WriteValue(file, renderHash);
+    WriteValue(file, (int32_t)width);
+    WriteValue(file, (int32_t)height);
+    WriteValue(file, (int32_t)passCount);
+    WriteValue(file, (int32_t)passesDone);
+    WriteValue(file, (uint8_t)hasFeatures);
+    for (const Vector3& sum : accumulation) {
+        float xyz[3] = { sum.x(), sum.y(), sum.z() };
+        file.write((const char*)xyz, sizeof(xyz));
+    }
+    if (hasFeatures) {
+        WriteColors(file, features.albedo);
+        WriteColors(file, features.normal);
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                WriteValue(file, features.depth.GetValue(x, y));
+    }
+    file.close();
+    if (!file || !SyncFile(tempFileName) || std::rename(tempFileName.c_str(), fileName.c_str()) != 0) {
+        std::remove(tempFileName.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool RenderCheckpoint::Read(const std::string& fileName) {
+    std::ifstream file(fileName, std::ios::binary);
+    char magic[sizeof(checkpointMagic)];
+    if (!file || !file.read(magic, sizeof(magic)) || memcmp(magic, checkpointMagic, sizeof(magic)) != 0)
+        return false;
+    int32_t fileWidth, fileHeight, filePassCount, filePassesDone;
+    uint8_t fileHasFeatures;
+    if (!ReadValue(file, renderHash) || !ReadValue(file, fileWidth) || !ReadValue(file, fileHeight) ||
+        !ReadValue(file, filePassCount) || !ReadValue(file, filePassesDone) || !ReadValue(file, fileHasFeatures))
+        return false;
+    if (fileWidth < 0 || fileHeight < 0 || filePassesDone < 0 || filePassesDone > filePassCount)
+        return false;
+    width = fileWidth;
+    height = fileHeight;
+    passCount = filePassCount;
+    passesDone = filePassesDone;
+    hasFeatures = fileHasFeatures != 0;
+
+    // Check the header against the file's size before allocating for it
+    std::streampos dataStart = file.tellg();
+    file.seekg(0, std::ios::end);
+    uint64_t dataBytes = (uint64_t)(file.tellg() - dataStart);
+    file.seekg(dataStart);
+    uint64_t pixelBytes = 3*sizeof(float) + (hasFeatures ? 7*sizeof(float) : 0);
+    if (!file || (uint64_t)width * height != dataBytes / pixelBytes || dataBytes % pixelBytes != 0)
+        return false;
+
+    accumulation.assign((size_t)width * height, Vector3());
+    for (Vector3& sum : accumulation) {
+        float xyz[3];
+        if (!file.read((char*)xyz, sizeof(xyz)))
+            return false;
+        sum = Vector3(xyz[0], xyz[1], xyz[2]);
+    }
+    if (hasFeatures) {
+        features.albedo = Image(width, height);
+        features.normal = Image(width, height);
+        features.depth = Heatmap(width, height);
+        if (!ReadColors(file, features.albedo) || !ReadColors(file, features.normal))
+            return false;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                float depth;
+                if (!ReadValue(file, depth))
+                    return false;
+                features.depth.SetValue(x, y, depth);
+            }
+        }
+    }
+    // Anything after the data means the file is not what it claims to be
+    return file.peek() == std::ifstream::traits_type::eof();
+}
+
+}  // namespace RayTracer
@@ -0,0 +1,41 @@
+#ifndef RENDER_CHECKPOINT_H_
+#define RENDER_CHECKPOINT_H_
+
+#include "vector3.h"
+#include "denoiser.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace RayTracer {
+
+/// The state of a progressive render between two passes: the sum of the
+/// pixel estimates of every finished pass and, if recorded, the first-hit
+/// features. Since each pass seeds its samples from the pixel and pass index
+/// alone, a render resumed from a checkpoint traces exactly the samples the
+/// uninterrupted render would have and ends with the same image.
+struct RenderCheckpoint {
+    /// Hash of the scene and of every setting that decides the samples traced,
+    /// which must match for a render to resume from the checkpoint
+    uint64_t renderHash = 0;
+    int width = 0;
+    int height = 0;
+    int passCount = 0;
+    int passesDone = 0;
+    /// Per-pixel sums of the estimates of the finished passes, row by row
+    std::vector<Vector3> accumulation;
+    bool hasFeatures = false;
+    RenderFeatures features;
+
+    /// Writes the checkpoint to a file, replacing it only once the new
+    /// checkpoint is complete. Returns false if the file could not be written.
+    bool Write(const std::string& fileName) const;
+    /// Reads a checkpoint written by Write. Returns false if the file is
+    /// missing, truncated or not a checkpoint.
+    bool Read(const std::string& fileName);
+};
+
+}  // namespace RayTracer
+
+#endif  // RENDER_CHECKPOINT_H_
@@ -0,0 +1,319 @@
+#include "render_coordinator.h"
+#include "timer.h"
+
+#include <deque>
+#include <thread>
+#include <iostream>
+#include <cmath>
+#include <algorithm>
+#include <csignal>
+#include <cstdint>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+
+namespace RayTracer {
+
+namespace {
+
+// Writes all bytes of a buffer to a file descriptor
+bool WriteAll(int fd, const void* data, size_t size) {
+    const char* bytes = (const char*)data;
+    while (size > 0) {
+        ssize_t n = write(fd, bytes, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Reads exactly the given number of bytes from a file descriptor, returning
+// false if the other end closed or failed first
+bool ReadAll(int fd, void* data, size_t size) {
+    char* bytes = (char*)data;
+    while (size > 0) {
+        ssize_t n = read(fd, bytes, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Reads exactly the given number of bytes like ReadAll, but waits for each
+// chunk only until the timer reaches the timeout, so a writer that stalls part
+// way cannot block the reader
+bool ReadAllWithin(int fd, void* data, size_t size, const Timer& timer, double timeout) {
+    char* bytes = (char*)data;
+    while (size > 0) {
+        pollfd pollFd;
+        pollFd.fd = fd;
+        pollFd.events = POLLIN;
+        pollFd.revents = 0;
+        int timeoutMilliseconds = (int)std::ceil(std::max(timeout - timer.Seconds(), 0.0) * 1000);
+        int ready = poll(&pollFd, 1, timeoutMilliseconds);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready <= 0) return false;
+        ssize_t n = read(fd, bytes, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+}  // namespace
+
+RenderCoordinator::RenderCoordinator(Scene* scene, int workerCount, int threadsPerWorker, int tileSize,
+    double tileTimeout) {
+    scene_ = scene;
+    workerCount_ = std::max(1, workerCount);
+    threadsPerWorker_ = threadsPerWorker > 0 ? threadsPerWorker :
+        std::max(1, (int)std::thread::hardware_concurrency() / workerCount_);
+    tileSize_ = std::max(1, tileSize);
+    tileTimeout_ = tileTimeout;
+}
+
+bool RenderCoordinator::Render(Image& image) {
+    Timer renderTimer;
+
+    // Split the render region into tiles
+    int regionX0, regionY0, regionX1, regionY1;
+    scene_->RenderRegion(regionX0, regionY0, regionX1, regionY1);
+    image = Image(regionX1 - regionX0, regionY1 - regionY0);
+    tiles_.clear();
+    for (int y = regionY0; y < regionY1; y += tileSize_) {
+        for (int x = regionX0; x < regionX1; x += tileSize_) {
+            Tile tile;
+            tile.x0 = x;
+            tile.y0 = y;
+            tile.x1 = std::min(x + tileSize_, regionX1);
+            tile.y1 = std::min(y + tileSize_, regionY1);
+            tiles_.push_back(tile);
+        }
+    }
+    std::deque<int> pendingTiles;
+    for (size_t t = 0; t < tiles_.size(); t++)
+        pendingTiles.push_back(t);
+
+    // A worker dying must show up as a failed write, not kill the coordinator
+    void (*previousHandler)(int) = signal(SIGPIPE, SIG_IGN);
+    workerStats_ = RenderStats();
+    workers_.assign(std::min((size_t)workerCount_, tiles_.size()), Worker());
+    bool success = true;
+    for (Worker& worker : workers_) {
+        if (!StartWorker(worker)) {
+            success = false;
+            break;
+        }
+    }
+
+    // Hand out tiles as workers become free and collect them as they finish
+    size_t completedTiles = 0;
+    while (success && completedTiles < tiles_.size()) {
+        // Give each idle worker a tile, replacing workers that can no longer be written to
+        for (Worker& worker : workers_) {
+            while (success && worker.tile < 0 && !pendingTiles.empty()) {
+                int tileIdx = pendingTiles.front();
+                pendingTiles.pop_front();
+                if (SendTile(worker, tileIdx))
+                    break;
+                pendingTiles.push_front(tileIdx);
+                StopWorker(worker, true);
+                success = tiles_[tileIdx].attempts < COORDINATOR_MAX_TILE_ATTEMPTS && StartWorker(worker);
+            }
+        }
+        if (!success)
+            break;
+
+        // Wait for a busy worker to finish its tile or exit, or for the first
+        // tile in progress to run out of time
+        std::vector<pollfd> pollFds;
+        std::vector<Worker*> pollWorkers;
+        double timeLeft = tileTimeout_;
+        for (Worker& worker : workers_) {
+            if (worker.tile >= 0) {
+                timeLeft = std::min(timeLeft, tileTimeout_ - worker.tileTimer.Seconds());
+                pollfd pollFd;
+                pollFd.fd = worker.resultFd;
+                pollFd.events = POLLIN;
+                pollFd.revents = 0;
+                pollFds.push_back(pollFd);
+                pollWorkers.push_back(&worker);
+            }
+        }
+        if (pollFds.empty()) {
+            success = false;
+            break;
+        }
+        int timeoutMilliseconds = (int)std::ceil(std::max(timeLeft, 0.0) * 1000);
+        if (poll(pollFds.data(), pollFds.size(), timeoutMilliseconds) < 0) {
+            if (errno == EINTR) continue;
+            success = false;
+            break;
+        }
+        for (size_t p = 0; p < pollFds.size() && success; p++) {
+            Worker& worker = *pollWorkers[p];
+            if (pollFds[p].revents == 0) {
+                // A worker past its time is taken to be hung
+                if (worker.tileTimer.Seconds() >= tileTimeout_) {
+                    std::cerr << "Worker " << worker.pid << " timed out on a tile, retrying it.\n";
+                    success = RetryTile(worker, pendingTiles);
+                }
+                continue;
+            }
+            // A worker that died part way through its tile has it retried on a fresh worker
+            if (ReceiveTile(worker, regionX0, regionY0, image))
+                completedTiles++;
+            else
+                success = RetryTile(worker, pendingTiles);
+        }
+    }
+
+    for (Worker& worker : workers_)
+        StopWorker(worker, !success);
+    workers_.clear();
+    signal(SIGPIPE, previousHandler);
+
+    scene_->MergeStats(workerStats_, renderTimer.Seconds());
+    return success;
+}
+
+bool RenderCoordinator::RetryTile(Worker& worker, std::deque<int>& pendingTiles) {
+    int tileIdx = worker.tile;
+    StopWorker(worker, true);
+    pendingTiles.push_front(tileIdx);
+    return tiles_[tileIdx].attempts < COORDINATOR_MAX_TILE_ATTEMPTS && StartWorker(worker);
+}
+
+bool RenderCoordinator::StartWorker(Worker& worker) {
+    int commandPipe[2], resultPipe[2];
+    if (pipe(commandPipe) < 0)
+        return false;
+    if (pipe(resultPipe) < 0) {
+        close(commandPipe[0]);
+        close(commandPipe[1]);
+        return false;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(commandPipe[0]);
+        close(commandPipe[1]);
+        close(resultPipe[0]);
+        close(resultPipe[1]);
+        return false;
+    }
+    if (pid == 0) {
+        // Worker: drop the coordinator's ends of every pipe so that each worker
+        // sees end of file as soon as the coordinator closes its command pipe
+        close(commandPipe[1]);
+        close(resultPipe[0]);
+        for (Worker& other : workers_) {
+            if (other.commandFd >= 0) close(other.commandFd);
+            if (other.resultFd >= 0) close(other.resultFd);
+        }
+        WorkerLoop(commandPipe[0], resultPipe[1]);
+        // Skip exit handlers and stdio flushing, which belong to the coordinator
+        _exit(0);
+    }
+    close(commandPipe[0]);
+    close(resultPipe[1]);
+    worker.pid = pid;
+    worker.commandFd = commandPipe[1];
+    worker.resultFd = resultPipe[0];
+    worker.tile = -1;
+    worker.stats = RenderStats();
+    return true;
+}
+
+void RenderCoordinator::StopWorker(Worker& worker, bool kill) {
+    if (worker.pid < 0)
+        return;
+    // Closing the command pipe tells an idle worker to exit
+    close(worker.commandFd);
+    close(worker.resultFd);
+    if (kill)
+        ::kill(worker.pid, SIGKILL);
+    waitpid(worker.pid, NULL, 0);
+    workerStats_.Merge(worker.stats);
+    worker = Worker();
+}
+
+void RenderCoordinator::WorkerLoop(int commandFd, int resultFd) {
+    // The coordinator's thread pool, if any, does not exist in this process, so
+    // start one to render every tile this worker is given
+    ThreadPool threadPool(threadsPerWorker_);
+    scene_->SetThreadPool(&threadPool);
+    scene_->ClearStats();
+
+    int32_t command[5];
+    while (ReadAll(commandFd, command, sizeof(command))) {
+        // Render the tile as a crop window of the full frame
+        scene_->SetCropWindow(command[1], command[2], command[3], command[4]);
+        Image tileImage = scene_->Render();
+
+        // Send back the tile index, the stats so far and the pixel colors
+        RenderStats stats = scene_->Stats();
+        std::vector<float> pixels;
+        pixels.reserve(3 * tileImage.Width() * tileImage.Height());
+        for (int y = 0; y < tileImage.Height(); y++) {
+            for (int x = 0; x < tileImage.Width(); x++) {
+                Color c = tileImage.GetPixel(x, y);
+                pixels.push_back(c.r());
+                pixels.push_back(c.g());
+                pixels.push_back(c.b());
+            }
+        }
+        if (!WriteAll(resultFd, &command[0], sizeof(command[0])) ||
+            !WriteAll(resultFd, &stats, sizeof(stats)) ||
+            !WriteAll(resultFd, pixels.data(), pixels.size() * sizeof(float)))
+            break;
+    }
+    close(commandFd);
+    close(resultFd);
+}
+
+bool RenderCoordinator::SendTile(Worker& worker, int tileIdx) {
+    Tile& tile = tiles_[tileIdx];
+    tile.attempts++;
+    int32_t command[5] = { tileIdx, tile.x0, tile.y0, tile.x1, tile.y1 };
+    if (!WriteAll(worker.commandFd, command, sizeof(command)))
+        return false;
+    worker.tile = tileIdx;
+    worker.tileTimer.Reset();
+    return true;
+}
+
+bool RenderCoordinator::ReceiveTile(Worker& worker, int regionX0, int regionY0, Image& image) {
+    const Tile& tile = tiles_[worker.tile];
+    int32_t tileIdx;
+    RenderStats stats;
+    std::vector<float> pixels(3 * (tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+    // The rest of the tile must arrive within the tile's time, as its start did
+    int fd = worker.resultFd;
+    if (!ReadAllWithin(fd, &tileIdx, sizeof(tileIdx), worker.tileTimer, tileTimeout_) || tileIdx != worker.tile ||
+        !ReadAllWithin(fd, &stats, sizeof(stats), worker.tileTimer, tileTimeout_) ||
+        !ReadAllWithin(fd, pixels.data(), pixels.size() * sizeof(float), worker.tileTimer, tileTimeout_)) {
+        if (worker.tileTimer.Seconds() >= tileTimeout_)
+            std::cerr << "Worker " << worker.pid << " timed out sending a tile, retrying it.\n";
+        return false;
+    }
+
+    size_t p = 0;
+    for (int y = tile.y0; y < tile.y1; y++) {
+        for (int x = tile.x0; x < tile.x1; x++) {
+            image.SetPixel(x - regionX0, y - regionY0, Color(pixels[p], pixels[p+1], pixels[p+2]));
+            p += 3;
+        }
+    }
+    worker.stats = stats;
+    worker.tile = -1;
+    return true;
+}
+
+}  // namespace RayTracer
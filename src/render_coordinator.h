@@ -0,0 +1,77 @@
+#ifndef RENDER_COORDINATOR_H_
+#define RENDER_COORDINATOR_H_
+
+#include "scene.h"
+#include "image.h"
+#include "timer.h"
+
+#include <sys/types.h>
+#include <vector>
+#include <deque>
+
+namespace RayTracer {
+
+#define COORDINATOR_TILE_SIZE 32
+#define COORDINATOR_MAX_TILE_ATTEMPTS 3
+#define COORDINATOR_TILE_TIMEOUT 600
+
+/// Renders a scene across several forked worker processes.
+///
+/// Workers are forked after the scene is loaded, so they share its objects,
+/// textures and BVH copy-on-write without reloading them. Tiles are handed
+/// out one at a time over a pipe to each worker as it becomes free, and the
+/// rendered pixels come back over a second pipe. If a worker dies, its tile
+/// is given to a replacement worker, up to COORDINATOR_MAX_TILE_ATTEMPTS
+/// times per tile. A worker that takes longer than the tile timeout to render
+/// and send back its tile, even if it stalls part way through sending it, is
+/// killed and its tile retried the same way, so a hung worker cannot stall
+/// the frame.
+class RenderCoordinator {
+public:
+
+    /// Creates a coordinator rendering the given scene on workerCount processes,
+    /// each rendering with threadsPerWorker threads (0 = share hardware threads evenly)
+    /// and given tileTimeout seconds per tile
+    RenderCoordinator(Scene* scene, int workerCount, int threadsPerWorker = 0, int tileSize = COORDINATOR_TILE_SIZE,
+        double tileTimeout = COORDINATOR_TILE_TIMEOUT);
+
+    /// Renders the scene's current frame (or crop window), returning false if
+    /// some tile could not be rendered. Worker render stats are merged into the scene.
+    bool Render(Image& image);
+
+private:
+    struct Worker {
+        pid_t pid = -1;
+        int commandFd = -1;
+        int resultFd = -1;
+        int tile = -1;
+        Timer tileTimer;
+        RenderStats stats;
+    };
+    struct Tile {
+        int x0, y0, x1, y1;
+        int attempts = 0;
+    };
+
+    bool StartWorker(Worker& worker);
+    void StopWorker(Worker& worker, bool kill);
+    void WorkerLoop(int commandFd, int resultFd);
+    bool SendTile(Worker& worker, int tileIdx);
+    bool ReceiveTile(Worker& worker, int regionX0, int regionY0, Image& image);
+    // Replaces a worker that failed its tile and puts the tile back, returning
+    // false if the tile has had all its attempts or no worker could be started
+    bool RetryTile(Worker& worker, std::deque<int>& pendingTiles);
+
+    Scene* scene_;
+    std::vector<Worker> workers_;
+    std::vector<Tile> tiles_;
+    RenderStats workerStats_;
+    int workerCount_;
+    int threadsPerWorker_;
+    int tileSize_;
+    double tileTimeout_;
+};
+
+}  // namespace RayTracer
+
+#endif  // RENDER_COORDINATOR_H_
@@ -0,0 +1,91 @@
+#include "render_progress.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace RayTracer {
+
+RenderProgress::RenderProgress() : cancelled_(false), stopped_(false), pixelsDone_(0), nextReport_(0) {
+}
+
+void RenderProgress::SetReportStream(std::ostream* out, bool overwrite, double interval) {
+    out_ = out;
+    overwrite_ = overwrite;
+    reportInterval_ = interval;
+}
+
+void RenderProgress::Start(uint64_t totalPixels) {
+    totalPixels_ = totalPixels;
+    pixelsDone_ = 0;
+    stopped_ = false;
+    nextReport_ = reportInterval_;
+    timer_.Reset();
+}
+
+void RenderProgress::Advance(uint64_t pixels) {
+    pixelsDone_ += pixels;
+    if (out_ == NULL)
+        return;
+    // Whichever thread first finds a report due writes it; the others carry on
+    double seconds = timer_.Seconds();
+    if (seconds < nextReport_)
+        return;
+    std::unique_lock<std::mutex> lock(reportMutex_, std::try_to_lock);
+    if (!lock.owns_lock() || seconds < nextReport_)
+        return;
+    nextReport_ = seconds + reportInterval_;
+    *out_ << (overwrite_ ? "\r" : "") << Text() << (overwrite_ ? "" : "\n") << std::flush;
+}
+
+void RenderProgress::Finish() {
+    if (out_ == NULL)
+        return;
+    // Pad over the longer progress line being replaced
+    *out_ << (overwrite_ ? "\r" : "") << Summary() << (overwrite_ ? "          \n" : "\n") << std::flush;
+}
+
+bool RenderProgress::ShouldStop() {
+    if (cancelled_ || OutOfTime())
+        stopped_ = true;
+    return stopped_;
+}
+
+double RenderProgress::Fraction() const {
+    if (totalPixels_ == 0)
+        return 0;
+    return std::min((double)pixelsDone_ / totalPixels_, 1.0);
+}
+
+double RenderProgress::SecondsLeft() const {
+    double fraction = Fraction();
+    if (fraction <= 0)
+        return -1;
+    double seconds = Seconds();
+    double secondsLeft = seconds * (1 - fraction) / fraction;
+    if (timeBudget_ > 0)
+        secondsLeft = std::min(secondsLeft, std::max(timeBudget_ - seconds, 0.0));
+    return secondsLeft;
+}
+
+std::string RenderProgress::Text() const {
+    char line[128];
+    double secondsLeft = SecondsLeft();
+    if (secondsLeft < 0)
+        snprintf(line, sizeof(line), "Rendering %.1f%%, %.1fs elapsed", 100*Fraction(), Seconds());
+    else
+        snprintf(line, sizeof(line), "Rendering %.1f%%, %.1fs elapsed, %.1fs left", 100*Fraction(), Seconds(), secondsLeft);
+    return line;
+}
+
+std::string RenderProgress::Summary() const {
+    char line[128];
+    if (stopped_) {
+        snprintf(line, sizeof(line), "Stopped at %.1f%% after %.1fs (%s)", 100*Fraction(), Seconds(),
+            cancelled_ ? "interrupted" : "time budget spent");
+    } else {
+        snprintf(line, sizeof(line), "Rendered in %.1fs", Seconds());
+    }
+    return line;
+}
+
+}  // namespace RayTracer
@@ -0,0 +1,80 @@
+#ifndef RENDER_PROGRESS_H_
+#define RENDER_PROGRESS_H_
+
+#include "timer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace RayTracer {
+
+#define PROGRESS_REPORT_INTERVAL 1.0
+
+/// Follows a render as its pixels are traced, estimates the time left and
+/// decides when the render should stop early: once its time budget has been
+/// spent, or once it has been cancelled. Render threads advance the progress
+/// concurrently, and Cancel may be called from a signal handler.
+class RenderProgress {
+public:
+
+    /// Creates a progress tracker with no time budget that reports nothing
+    RenderProgress();
+
+    /// Sets the wall clock seconds each render may take before it stops (0 = no limit)
+    void SetTimeBudget(double seconds) { timeBudget_ = seconds; }
+    /// Writes a progress line to out at most every interval seconds while rendering
+    /// (NULL = no reports). With overwrite, each line replaces the previous one.
+    void SetReportStream(std::ostream* out, bool overwrite, double interval = PROGRESS_REPORT_INTERVAL);
+
+    /// Starts timing a render that will trace the given number of pixels
+    void Start(uint64_t totalPixels);
+    /// Records that pixels have been traced, reporting progress if a report is due
+    void Advance(uint64_t pixels);
+    /// Ends the render, writing a last report with how it ended
+    void Finish();
+
+    /// Asks the current render, and any later one, to stop as soon as possible
+    void Cancel() { cancelled_ = true; }
+    /// Returns true if the render was cancelled
+    bool Cancelled() const { return cancelled_; }
+    /// Returns true once the current render has used up its time budget
+    bool OutOfTime() const { return timeBudget_ > 0 && timer_.Seconds() >= timeBudget_; }
+    /// Returns true if the render should stop before tracing more pixels, and
+    /// from then on marks the render as stopped
+    bool ShouldStop();
+    /// Returns true if the current render was stopped before tracing all its pixels
+    bool Stopped() const { return stopped_; }
+
+    /// Returns the fraction of the render's pixels traced so far
+    double Fraction() const;
+    /// Returns the seconds since the render started
+    double Seconds() const { return timer_.Seconds(); }
+    /// Returns the estimated seconds until the render finishes or runs out of
+    /// time, or a negative value before there is anything to estimate from
+    double SecondsLeft() const;
+    /// Returns a one line report such as "Rendering 42.0%, 3.1s elapsed, 4.3s left"
+    std::string Text() const;
+    /// Returns a one line account of how the render ended, such as
+    /// "Stopped at 42.0% after 3.0s (time budget spent)"
+    std::string Summary() const;
+
+private:
+    std::atomic<bool> cancelled_;
+    std::atomic<bool> stopped_;
+    double timeBudget_ = 0;
+    Timer timer_;
+    uint64_t totalPixels_ = 0;
+    std::atomic<uint64_t> pixelsDone_;
+    std::ostream* out_ = NULL;
+    bool overwrite_ = false;
+    double reportInterval_ = PROGRESS_REPORT_INTERVAL;
+    std::atomic<double> nextReport_;
+    std::mutex reportMutex_;
+};
+
+}  // namespace RayTracer
+
+#endif  // RENDER_PROGRESS_H_
@@ -0,0 +1,241 @@
+#include "render_server.h"
+#include "timer.h"
+#include "utilities.h"
+
+#include <sstream>
+#include <vector>
+#include <stdexcept>
+#include <new>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+namespace RayTracer {
+
+namespace {
+
+// Parses "x,y,z" into a vector
+Vector3 ParseVector3(const std::string& value) {
+    std::vector<std::string> components = Utilities::SplitString(value, ",");
+    if (components.size() != 3) throw std::invalid_argument("expected x,y,z");
+    return Vector3(std::stof(components[0]), std::stof(components[1]), std::stof(components[2]));
+}
+
+// Writes all of a string to a connected socket, returning false once the peer
+// has gone. MSG_NOSIGNAL keeps a client that hung up from raising SIGPIPE,
+// which would otherwise end the server.
+bool WriteAll(int fd, const std::string& data) {
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = send(fd, data.data() + written, data.size() - written, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        written += n;
+    }
+    return true;
+}
+
+}  // namespace
+
+RenderServer::RenderServer(ThreadPool* threadPool) {
+    threadPool_ = threadPool;
+}
+
+RenderServer::~RenderServer() {
+    for (auto scene : scenes_)
+        delete scene.second;
+    scenes_.clear();
+}
+
+void RenderServer::AddScene(const std::string& name, Scene* scene) {
+    scene->SetThreadPool(threadPool_);
+    scenes_[name] = scene;
+}
+
+void RenderServer::Serve(std::istream& input, std::ostream& output) {
+    std::string line;
+    bool quit = false;
+    while (!quit && std::getline(input, line)) {
+        std::string response = HandleRequest(line, quit);
+        if (!response.empty())
+            output << response << "\n" << std::flush;
+    }
+}
+
+bool RenderServer::ServeSocket(const std::string& socketPath) {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) return false;
+    std::strcpy(address.sun_path, socketPath.c_str());
+
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) return false;
+    unlink(socketPath.c_str());
+    if (bind(listenFd, (sockaddr*)&address, sizeof(address)) < 0 || listen(listenFd, 8) < 0) {
+        close(listenFd);
+        return false;
+    }
+
+    bool quit = false;
+    while (!quit) {
+        int connectionFd = accept(listenFd, NULL, NULL);
+        if (connectionFd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // Running out of descriptors or memory may pass, so wait before trying
+            // again rather than spinning; anything else will not
+            std::cerr << "accept failed: " << std::strerror(errno) << "\n";
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                sleep(ACCEPT_RETRY_SECONDS);
+                continue;
+            }
+            close(listenFd);
+            unlink(socketPath.c_str());
+            return false;
+        }
+        // Split incoming bytes into request lines, dropping the connection once
+        // the client stops reading responses
+        std::string pending;
+        char buffer[4096];
+        ssize_t n;
+        bool connected = true;
+        while (connected && !quit && (n = read(connectionFd, buffer, sizeof(buffer))) > 0) {
+            pending.append(buffer, n);
+            size_t newline;
+            while (connected && !quit && (newline = pending.find('\n')) != std::string::npos) {
+                std::string response = HandleRequest(pending.substr(0, newline), quit);
+                pending.erase(0, newline + 1);
+                if (!response.empty() && !WriteAll(connectionFd, response + "\n"))
+                    connected = false;
+            }
+        }
+        close(connectionFd);
+    }
+
+    close(listenFd);
+    unlink(socketPath.c_str());
+    return true;
+}
+
+std::string RenderServer::HandleRequest(const std::string& request, bool& quit) {
+    // Split the request into a command and key=value parameters
+    std::istringstream iss(request);
+    std::string command;
+    iss >> command;
+    std::map<std::string, std::string> parameters;
+    for (std::string s; iss >> s; ) {
+        size_t equals = s.find('=');
+        if (equals == std::string::npos)
+            return "error malformed parameter " + s;
+        parameters[s.substr(0, equals)] = s.substr(equals + 1);
+    }
+
+    if (command.empty() || command[0] == '#') {
+        return "";
+    } else if (command == "quit") {
+        quit = true;
+        return "ok";
+    } else if (command == "scenes") {
+        std::string response = "ok";
+        for (auto scene : scenes_)
+            response += " " + scene.first;
+        return response;
+    } else if (command == "render") {
+        return HandleRender(parameters);
+    }
+    return "error unknown command " + command;
+}
+
+std::string RenderServer::HandleRender(const std::map<std::string, std::string>& parameters) {
+    auto sceneParameter = parameters.find("scene");
+    if (sceneParameter == parameters.end() && scenes_.size() != 1)
+        return "error missing scene";
+    auto scene = sceneParameter == parameters.end() ? scenes_.begin() : scenes_.find(sceneParameter->second);
+    if (scene == scenes_.end())
+        return "error unknown scene " + sceneParameter->second;
+    auto outParameter = parameters.find("out");
+    if (outParameter == parameters.end())
+        return "error missing out";
+
+    // Start from the camera and settings the scene was loaded with, overriding any given
+    Camera camera = scene->second->SceneCamera();
+    Vector3 eye = camera.EyePosition();
+    Vector3 viewDirection = camera.ViewDirection();
+    Vector3 upDirection = camera.UpDirection();
+    float fieldOfView = camera.FieldOfView();
+    int width = camera.Width();
+    int height = camera.Height();
+    bool softShadows = scene->second->SoftShadows();
+    bool depthOfField = scene->second->DepthOfField();
+    int dofSampleCount = scene->second->DofSampleCount();
+    int shadowSampleCount = scene->second->ShadowSampleCount();
+    try {
+        for (auto parameter : parameters) {
+            const std::string& key = parameter.first;
+            const std::string& value = parameter.second;
+            if (key == "eye") eye = ParseVector3(value);
+            else if (key == "viewdir") viewDirection = ParseVector3(value);
+            else if (key == "updir") upDirection = ParseVector3(value);
+            else if (key == "vfov") fieldOfView = std::stof(value);
+            else if (key == "softshadows") softShadows = std::stoi(value) != 0;
+            else if (key == "dof") depthOfField = std::stoi(value) != 0;
+            else if (key == "dof-samples") dofSampleCount = std::stoi(value);
+            else if (key == "shadow-samples") shadowSampleCount = std::stoi(value);
+            else if (key == "size") {
+                std::vector<std::string> size = Utilities::SplitString(value, "x");
+                if (size.size() != 2) throw std::invalid_argument("expected <width>x<height>");
+                width = std::stoi(size[0]);
+                height = std::stoi(size[1]);
+            } else if (key != "scene" && key != "out") {
+                return "error unknown parameter " + key;
+            }
+        }
+    } catch (std::exception& e) {
+        return "error malformed parameter value";
+    }
+    if (viewDirection.Length() == 0 || upDirection.Length() == 0 || fieldOfView <= 0 || width <= 0 || height <= 0)
+        return "error invalid camera";
+    if ((uint64_t)width * height > SERVER_MAX_IMAGE_PIXELS)
+        return "error image too large";
+    if (dofSampleCount < 1 || shadowSampleCount < 1)
+        return "error invalid sample count";
+
+    // Render with the requested settings, then restore the scene defaults
+    Scene* renderScene = scene->second;
+    bool defaultSoftShadows = renderScene->SoftShadows();
+    bool defaultDepthOfField = renderScene->DepthOfField();
+    int defaultDofSampleCount = renderScene->DofSampleCount();
+    int defaultShadowSampleCount = renderScene->ShadowSampleCount();
+    renderScene->SetCamera(Camera(eye, viewDirection, upDirection, fieldOfView, width, height));
+    renderScene->SetSoftShadows(softShadows);
+    renderScene->SetDepthOfField(depthOfField);
+    renderScene->SetSampleCounts(dofSampleCount, shadowSampleCount);
+    std::string outputFileName = Utilities::ReplaceExtension(outParameter->second, ".ppm");
+    Timer renderTimer;
+    double renderSeconds = 0;
+    bool outOfMemory = false;
+    try {
+        Image renderImage = renderScene->Render();
+        renderSeconds = renderTimer.Seconds();
+        renderImage.WriteToPPMFile(outputFileName);
+    } catch (std::bad_alloc& e) {
+        outOfMemory = true;
+    }
+    renderScene->SetCamera(camera);
+    renderScene->SetSoftShadows(defaultSoftShadows);
+    renderScene->SetDepthOfField(defaultDepthOfField);
+    renderScene->SetSampleCounts(defaultDofSampleCount, defaultShadowSampleCount);
+    if (outOfMemory)
+        return "error out of memory";
+
+    std::ostringstream response;
+    response << "ok " << outputFileName << " " << renderSeconds;
+    return response.str();
+}
+
+}  // namespace RayTracer
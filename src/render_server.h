@@ -0,0 +1,59 @@
+#ifndef RENDER_SERVER_H_
+#define RENDER_SERVER_H_
+
+#include "scene.h"
+#include "thread_pool.h"
+
+#include <map>
+#include <string>
+#include <istream>
+#include <ostream>
+
+namespace RayTracer {
+
+#define ACCEPT_RETRY_SECONDS 1
+#define SERVER_MAX_IMAGE_PIXELS (16384*16384)
+
+/// A long running render process that keeps loaded scenes and their BVHs
+/// resident and renders them on request on a shared thread pool.
+///
+/// Requests are single lines of space separated words:
+///   render scene=<name> out=<file> [eye=x,y,z] [viewdir=x,y,z] [updir=x,y,z]
+///          [vfov=degrees] [size=<width>x<height>] [softshadows=0|1] [dof=0|1]
+///          [dof-samples=n] [shadow-samples=n]
+///   scenes
+///   quit
+/// and each is answered with a single line starting with "ok" or "error".
+/// Images are limited to SERVER_MAX_IMAGE_PIXELS, and a render that runs out
+/// of memory is answered with an error, keeping the server and its scenes.
+class RenderServer {
+public:
+
+    /// Creates a server rendering on the given thread pool
+    RenderServer(ThreadPool* threadPool);
+    /// Deletes all scenes held by the server
+    ~RenderServer();
+
+    /// Adds a loaded scene (with its BVH constructed) under the given name, taking ownership of it
+    void AddScene(const std::string& name, Scene* scene);
+
+    /// Serves requests read from input until it ends or a quit request is received
+    void Serve(std::istream& input, std::ostream& output);
+    /// Listens on a local UNIX socket and serves each connection in turn until a
+    /// quit request is received, returning false if the socket could not be opened
+    /// or fails with an error that waiting does not fix
+    bool ServeSocket(const std::string& socketPath);
+
+    /// Handles a single request, returning its response line and setting quit if requested
+    std::string HandleRequest(const std::string& request, bool& quit);
+
+private:
+    std::string HandleRender(const std::map<std::string, std::string>& parameters);
+
+    ThreadPool* threadPool_;
+    std::map<std::string, Scene*> scenes_;
+};
+
+}  // namespace RayTracer
+
+#endif  // RENDER_SERVER_H_
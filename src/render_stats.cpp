@@ -0,0 +1,72 @@
+#include "render_stats.h"
+
+#include <sstream>
+
+namespace RayTracer {
+
+void RenderStats::Merge(const RenderStats& other) {
+    cameraRays += other.cameraRays;
+    shadowRays += other.shadowRays;
+    reflectionRays += other.reflectionRays;
+    refractionRays += other.refractionRays;
+    bvhNodesVisited += other.bvhNodesVisited;
+    sphereTests += other.sphereTests;
+    triangleTests += other.triangleTests;
+    otherTests += other.otherTests;
+    shadowCacheHits += other.shadowCacheHits;
+    geometryPageHits += other.geometryPageHits;
+    geometryPageLoads += other.geometryPageLoads;
+    for (int i = 0; i < RAY_DEPTH_HISTOGRAM_SIZE; i++)
+        rayDepths[i] += other.rayDepths[i];
+}
+
+std::string RenderStats::ToJSON() const {
+    uint64_t totalRays = cameraRays + shadowRays + reflectionRays + refractionRays;
+    uint64_t primitiveTests = sphereTests + triangleTests + otherTests;
+    double perRay = totalRays > 0 ? 1.0 / totalRays : 0;
+
+    // Trim trailing empty depth buckets
+    int depthCount = RAY_DEPTH_HISTOGRAM_SIZE;
+    while (depthCount > 1 && rayDepths[depthCount-1] == 0)
+        depthCount--;
+
+    std::ostringstream json;
+    json << "{\n"
+        << "  \"rays\": {"
+            << "\"camera\": " << cameraRays
+            << ", \"shadow\": " << shadowRays
+            << ", \"reflection\": " << reflectionRays
+            << ", \"refraction\": " << refractionRays
+            << ", \"total\": " << totalRays << "},\n"
+        << "  \"bvh_nodes_visited\": " << bvhNodesVisited << ",\n"
+        << "  \"primitive_tests\": {"
+            << "\"sphere\": " << sphereTests
+            << ", \"triangle\": " << triangleTests
+            << ", \"other\": " << otherTests
+            << ", \"total\": " << primitiveTests << "},\n"
+        << "  \"shadow_cache_hits\": " << shadowCacheHits << ",\n"
+        << "  \"geometry_pages\": {"
+            << "\"hits\": " << geometryPageHits
+            << ", \"loads\": " << geometryPageLoads << "},\n"
+        << "  \"ray_depth_histogram\": [";
+    for (int i = 0; i < depthCount; i++)
+        json << (i > 0 ? ", " : "") << rayDepths[i];
+    json << "],\n"
+        << "  \"per_ray\": {"
+            << "\"bvh_nodes\": " << bvhNodesVisited*perRay
+            << ", \"primitive_tests\": " << primitiveTests*perRay
+            << ", \"shadow_fraction\": " << shadowRays*perRay
+            << ", \"secondary_fraction\": " << (reflectionRays + refractionRays)*perRay << "},\n"
+        << "  \"seconds\": {"
+            << "\"parse\": " << parseSeconds
+            << ", \"texture_load\": " << textureLoadSeconds
+            << ", \"bvh_build\": " << bvhBuildSeconds
+            << ", \"render\": " << renderSeconds
+            << ", \"denoise\": " << denoiseSeconds
+            << ", \"output\": " << outputSeconds << "},\n"
+        << "  \"rays_per_second\": " << (renderSeconds > 0 ? totalRays / renderSeconds : 0) << "\n"
+        << "}";
+    return json.str();
+}
+
+}  // namespace RayTracer
@@ -0,0 +1,47 @@
+#ifndef RENDER_STATS_H_
+#define RENDER_STATS_H_
+
+#include <cstdint>
+#include <string>
+
+namespace RayTracer {
+
+#define RAY_DEPTH_HISTOGRAM_SIZE 16
+
+/// A struct containing counts of the rays traced and work done while rendering,
+/// and the time spent in each phase of loading and rendering a scene.
+/// Each render thread counts into its own copy, and copies are merged at the end.
+struct RenderStats {
+    uint64_t cameraRays = 0;
+    uint64_t shadowRays = 0;
+    uint64_t reflectionRays = 0;
+    uint64_t refractionRays = 0;
+
+    uint64_t bvhNodesVisited = 0;
+    uint64_t sphereTests = 0;
+    uint64_t triangleTests = 0;
+    uint64_t otherTests = 0;
+    /// Shadow rays found blocked by the cached occluder of their light, skipping traversal
+    uint64_t shadowCacheHits = 0;
+    /// Paged geometry pages found in the cache, and read from disk
+    uint64_t geometryPageHits = 0;
+    uint64_t geometryPageLoads = 0;
+    /// Number of traced rays at each recursion depth (last bucket holds all deeper rays)
+    uint64_t rayDepths[RAY_DEPTH_HISTOGRAM_SIZE] = {};
+
+    double parseSeconds = 0;
+    double textureLoadSeconds = 0;
+    double bvhBuildSeconds = 0;
+    double renderSeconds = 0;
+    double denoiseSeconds = 0;
+    double outputSeconds = 0;
+
+    /// Adds the counters of another set of stats to this one (timings are left unchanged)
+    void Merge(const RenderStats& other);
+    /// Returns the stats as a JSON object, including derived per-ray ratios
+    std::string ToJSON() const;
+};
+
+}  // namespace RayTracer
+
+#endif  // RENDER_STATS_H_
@@ -3,6 +3,7 @@
 #include "triangle.h"
 #include "ray.h"
 #include "utilities.h"
+#include "timer.h"
 
 #include <map>
 #include <sstream>
@@ -10,6 +11,11 @@
 #include <limits>
 #include <cmath>
 #include <iostream>
+#include <atomic>
+#include <cstring>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 namespace RayTracer {
 
@@ -36,18 +42,12 @@ Scene::Scene(Camera camera, Color backgroundColor, bool softShadows, bool depthO
 }
 
 Scene::~Scene() {
-    // Delete all objects in scene
-    for (size_t i = 0; i < sceneObjects_.size(); i++) {
-      delete sceneObjects_[i];
-    }
-    sceneObjects_.clear();
+    // Objects and the BVH live in arenas and are freed with them, block by block
     // Delete all textures in the scene
     for (size_t i = 0; i < textures_.size(); i++) {
       delete textures_[i];
     }
     textures_.clear();
-    // Delete the BVH
-    delete bvhRoot_;
 }
 
 SceneInitStatus Scene::InitFromFile(std::ifstream& sceneFile) {
@@ -58,6 +58,7 @@ SceneInitStatus Scene::InitFromFile(std::ifstream& sceneFile) {
     std::vector<std::pair<std::vector<int>, std::vector<std::string>>> sphereDescriptions;
     // Vector used to parse non-unique scene lights
     std::vector<std::vector<std::string>> lightDescriptions;
+    std::vector<std::vector<std::string>> rectLightDescriptions;
     // Vector used to parse textures
     std::vector<std::vector<std::string>> textureDescriptions;
     // Vectors used to parse vertex info
@@ -66,12 +67,17 @@ SceneInitStatus Scene::InitFromFile(std::ifstream& sceneFile) {
     std::vector<std::vector<std::string>> texCoordDescriptions;
     // Vector used to parse triangle definitions
     std::vector<std::pair<std::vector<int>, std::vector<std::string>>> triangleDescriptions;
+    // Vector used to parse per-frame object motions
+    std::vector<std::vector<std::string>> motionDescriptions;
+
+    Timer parseTimer;
 
     // Read all lines in the file write them to scene description map
     // or object/material maps
     std::string line;
     int mtlmaterialIdx = -1;
     int textureIdx = -1;
+    int motionIdx = -1;
     while (std::getline(sceneFile, line)) {
         // Split each line with ' '
         // taking first element as key, and remaining elements as values related to that key
@@ -94,14 +100,20 @@ SceneInitStatus Scene::InitFromFile(std::ifstream& sceneFile) {
         // Needs to be saved so that all objects that come after use this texture
         else if (key == "texture")
             textureDescriptions.insert(textureDescriptions.begin()+(++textureIdx), values);
+        // Special case: key is motion
+        // Needs to be saved so that all objects that come after move by this amount each frame
+        else if (key == "motion")
+            motionDescriptions.insert(motionDescriptions.begin()+(++motionIdx), values);
         // Special case: key is object
         // Needs to be saved with reference to which material color to use
         else if (key == "sphere")
-            sphereDescriptions.push_back({ { mtlmaterialIdx, textureIdx }, values });
+            sphereDescriptions.push_back({ { mtlmaterialIdx, textureIdx, motionIdx }, values });
         // Special case: key is light
         // Needs to be saved in the light vector array
         else if (key == "light" || key == "attlight")
             lightDescriptions.push_back(values);
+        else if (key == "rectlight")
+            rectLightDescriptions.push_back(values);
         // Special case: triangle
         else if (key == "v")
             vertexDescriptions.push_back(values);
@@ -110,7 +122,7 @@ SceneInitStatus Scene::InitFromFile(std::ifstream& sceneFile) {
         else if (key == "vt")
             texCoordDescriptions.push_back(values);
         else if (key == "f")
-            triangleDescriptions.push_back({ { mtlmaterialIdx, textureIdx }, values });
+            triangleDescriptions.push_back({ { mtlmaterialIdx, textureIdx, motionIdx }, values });
         // Otherwise add values as new entry in our scene description map
         else if (!key.empty())
             sceneDescription[key] = values;
@@ -273,12 +285,13 @@ SceneInitStatus Scene::InitFromFile(std::ifstream& sceneFile) {
             material.n = n;
             material.a = a;
             material.ior = ior;
-            materials_.push_back(material);
+            materials_.push_back(ShadingMaterial(material));
         } else {
             return MtlColorError;
         }
     }
     // Load all textures
+    Timer textureTimer;
     size_t textureCount = textureDescriptions.size();
     for (std::size_t c = 0; c < textureCount; c++) {
         if (textureDescriptions[c].size() >= 1) {
@@ -291,6 +304,25 @@ SceneInitStatus Scene::InitFromFile(std::ifstream& sceneFile) {
             return TextureError;
         }
     }
+    stats_.textureLoadSeconds = textureTimer.Seconds();
+
+    // Ensure all motions are valid
+    std::vector<Vector3> motions;
+    for (auto motionDescription : motionDescriptions) {
+        if (motionDescription.size() >= 3) {
+            float offset[3];
+            for (int i = 0; i < 3; i++) {
+                try {
+                    offset[i] = std::stof(motionDescription[i]);
+                } catch (std::invalid_argument& e) {
+                    return MotionError;
+                }
+            }
+            motions.push_back(Vector3(offset[0], offset[1], offset[2]));
+        } else {
+            return MotionError;
+        }
+    }
 
     // Attempt to process all spheres and assign colors
     for (size_t s = 0; s < sphereDescriptions.size(); s++) {
@@ -309,8 +341,11 @@ SceneInitStatus Scene::InitFromFile(std::ifstream& sceneFile) {
                 return SphereError;
             }
             Vector3 spherePosition = Vector3(position[0], position[1], position[2]);
-            Sphere* sphere = new Sphere(spherePosition, radius, materialIdx, textureIdx);
+            Sphere* sphere = objectArena_.New<Sphere>(spherePosition, radius, materialIdx, textureIdx);
             sceneObjects_.push_back(sphere);
+            int motionIdx = sphereDescriptions[s].first[2];
+            if (motionIdx >= 0)
+                animatedObjects_.push_back({ sphere, motions[motionIdx] });
         } else {
             return SphereError;
         }
@@ -323,6 +358,7 @@ SceneInitStatus Scene::InitFromFile(std::ifstream& sceneFile) {
             int w;
             float color[3];
             float c1 = -1, c2 = -1, c3 = -1;
+            float radius = 0;
             try {
                 x = std::stof(lightDescription[0]);
                 y = std::stof(lightDescription[1]);
@@ -344,6 +380,16 @@ SceneInitStatus Scene::InitFromFile(std::ifstream& sceneFile) {
                     if (c1 < 0 || c2 < 0 || c3 < 0) throw std::invalid_argument("c1, c2, c3 must be positive.");
                 }
             } catch (std::invalid_argument& e) {}
+            // An optional radius after the color (and attenuation) makes a spherical area light
+            size_t radiusIdx = lightDescription.size() >= 10 ? 10 : 7;
+            if (w == 1 && lightDescription.size() > radiusIdx) {
+                try {
+                    radius = std::stof(lightDescription[radiusIdx]);
+                    if (radius < 0) throw std::invalid_argument("Radius must not be negative.");
+                } catch (std::invalid_argument& e) {
+                    return LightError;
+                }
+            }
             Color lightColor = Color(color[0], color[1], color[2]);
             if (w == 0) {  // Directional light
                 Vector3 lightDirection = Vector3(x, y, z);
@@ -356,12 +402,44 @@ SceneInitStatus Scene::InitFromFile(std::ifstream& sceneFile) {
                     pointLight = PointLight(lightPosition, lightColor);
                 else
                     pointLight = PointLight(lightPosition, lightColor, c1, c2, c3);
+                pointLight.SetSphere(radius);
                 pointLights_.push_back(pointLight);
             }
         } else {
             return LightError;
         }
     }
+    for (auto lightDescription : rectLightDescriptions) {
+        // rectlight x y z r g b ux uy uz vx vy vz [c1 c2 c3]: a rectangle centered on (x, y, z)
+        if (lightDescription.size() < 12)
+            return LightError;
+        float values[15];
+        try {
+            for (size_t i = 0; i < 15 && i < lightDescription.size(); i++)
+                values[i] = std::stof(lightDescription[i]);
+        } catch (std::invalid_argument& e) {
+            return LightError;
+        }
+        Vector3 lightPosition = Vector3(values[0], values[1], values[2]);
+        if (values[3] < 0 || values[4] < 0 || values[5] < 0)
+            return LightError;
+        Color lightColor = Color(values[3], values[4], values[5]);
+        Vector3 edgeU = Vector3(values[6], values[7], values[8]);
+        Vector3 edgeV = Vector3(values[9], values[10], values[11]);
+        if (Vector3::Cross(edgeU, edgeV).Length() <= 0)
+            return LightError;
+        // Attenuation takes all three factors or none
+        if (lightDescription.size() > 12 && lightDescription.size() < 15)
+            return LightError;
+        PointLight pointLight = PointLight(lightPosition, lightColor);
+        if (lightDescription.size() >= 15) {
+            if (values[12] < 0 || values[13] < 0 || values[14] < 0)
+                return LightError;
+            pointLight = PointLight(lightPosition, lightColor, values[12], values[13], values[14]);
+        }
+        pointLight.SetRectangle(edgeU, edgeV);
+        pointLights_.push_back(pointLight);
+    }
 
     // ----- Vertices -----
     Vector3 vertices[vertexDescriptions.size()];
@@ -447,80 +525,145 @@ SceneInitStatus Scene::InitFromFile(std::ifstream& sceneFile) {
             } catch (std::invalid_argument& e) {
                 return TriangleError;
             }
-            Triangle* triangle = new Triangle(triangleVertices, triangleNormals, triangleTexCoords, materialIdx, textureIdx, hasNormals, hasTexCoords);
+            Triangle* triangle = objectArena_.New<Triangle>(triangleVertices, triangleNormals, triangleTexCoords, materialIdx, textureIdx, hasNormals, hasTexCoords);
             sceneObjects_.push_back(triangle);
+            int motionIdx = triangleDescriptions[t].first[2];
+            if (motionIdx >= 0)
+                animatedObjects_.push_back({ triangle, motions[motionIdx] });
         } else {
             return TriangleError;
         }
     }
 
     // If we made it this far, the scene has been successfully loaded
+    stats_.parseSeconds = parseTimer.Seconds() - stats_.textureLoadSeconds;
     return Success;
 }
 
 void Scene::AddObjectToScene(SceneObject* sceneObject) {
-    sceneObjects_.push_back(sceneObject);
+    // Keep all objects together in the object arena
+    sceneObjects_.push_back(sceneObject->CopyTo(objectArena_));
+    delete sceneObject;
+}
+
+void Scene::SetHugePages(bool hugePages) {
+    objectArena_.SetHugePages(hugePages);
+    bvhArena_.SetHugePages(hugePages);
 }
 void Scene::AddPointLightToScene(PointLight pointLight) {
     pointLights_.push_back(pointLight);
+    lightTreeStale_ = true;
 }
 void Scene::AddDirectionalLightToScene(DirectionalLight directionalLight) {
     directionalLights_.push_back(directionalLight);
 }
 
-float Scene::InShadow(Vector3 point, Vector3 lightPosition, const SceneObject* ignoreObject) const {
+template <bool SoftShadows>
+float Scene::InShadow(Vector3 point, const PointLight& light, bool pointLight, size_t lightIdx, TraceContext& context, const SceneObject* ignoreObject) const {
     float S = 0;
 
-    if (softShadows_) {
-        for (int i = 0; i < SHADOW_SAMPLE_COUNT; i++) {
-            float x = (float(rand())/float((RAND_MAX))) - 0.25;
-            float y = (float(rand())/float((RAND_MAX))) - 0.25;
-            float z = (float(rand())/float((RAND_MAX))) - 0.25;
-            Vector3 lightOffsetPosition = lightPosition + Vector3(x,y,z);
-            Ray shadowRay = Ray(point, lightOffsetPosition-point);
-            RaycastHit shadowHit = Raycast(shadowRay, ignoreObject);
-            S += shadowHit.hit ? 0 : 1.0f/SHADOW_SAMPLE_COUNT;
+    // Neighbouring points usually have the same blocker, so test the last one found for this light first
+    const SceneObject** occluder = NULL;
+    if (shadowCacheEnabled_ && lightIdx < context.shadowOccluders.size())
+        occluder = &context.shadowOccluders[lightIdx];
+
+    // Lights for directional shadows are placed relative to the shaded point
+    Vector3 lightCenter = pointLight ? light.Position() : point + light.Position();
+
+    // Area lights always cast soft shadows; with soft shadows on, point lights
+    // are shadowed as spheres of SOFT_SHADOW_LIGHT_RADIUS
+    if (SoftShadows || light.Shape() != PointShape) {
+        // Stratify samples over a grid of the light's solid angle, as far as the count allows
+        int strata = (int)std::sqrt((float)passShadowSampleCount_);
+        for (int i = 0; i < passShadowSampleCount_; i++) {
+            float u = context.random.NextFloat();
+            float v = context.random.NextFloat();
+            if (i < strata*strata) {
+                u = (i % strata + u) / strata;
+                v = (i / strata + v) / strata;
+            }
+            Vector3 lightOffsetPosition = light.Shape() == PointShape ?
+                PointLight::SampleSphere(lightCenter, SOFT_SHADOW_LIGHT_RADIUS, point, u, v) :
+                light.SamplePoint(point, u, v);
+            float lightDistance = pointLight ? Vector3::Distance(point, lightOffsetPosition) : std::numeric_limits<float>::infinity();
+            Ray shadowRay = Ray(point, lightOffsetPosition-point, 0, lightDistance);
+            context.stats.shadowRays++;
+            if (occluder != NULL && HitsCachedOccluder(shadowRay, *occluder, context, ignoreObject))
+                continue;
+            RaycastHit shadowHit = Raycast(shadowRay, context, ignoreObject);
+            // Forget the occluder once a ray gets through, so lit regions do not pay for testing it
+            if (occluder != NULL)
+                *occluder = shadowHit.hit ? shadowHit.object : NULL;
+            S += (shadowHit.hit ? materials_[shadowHit.materialIdx].transmission : 1) / passShadowSampleCount_;
         }
     } else {
-        Ray shadowRay = Ray(point, lightPosition-point);
-        RaycastHit shadowHit = Raycast(shadowRay, ignoreObject);
-        S += shadowHit.hit ? (1-materials_[shadowHit.materialIdx].a) : 1;
+        Vector3 lightPosition = lightCenter;
+        float lightDistance = pointLight ? Vector3::Distance(point, lightPosition) : std::numeric_limits<float>::infinity();
+        Ray shadowRay = Ray(point, lightPosition-point, 0, lightDistance);
+        context.stats.shadowRays++;
+        // The cache is only enabled when every material is opaque, so any
+        // blocker, not just the nearest, fully shadows the point
+        if (occluder != NULL && HitsCachedOccluder(shadowRay, *occluder, context, ignoreObject))
+            return 0;
+        RaycastHit shadowHit = Raycast(shadowRay, context, ignoreObject);
+        if (occluder != NULL)
+            *occluder = shadowHit.hit ? shadowHit.object : NULL;
+        S += shadowHit.hit ? materials_[shadowHit.materialIdx].transmission : 1;
     }
 
     if (S > 1) S = 1;
     return S;
 }
 
-Vector3 Scene::ComputeDiffuseSpecular(Vector3 L, Vector3 N, Vector3 I, Vector3 Od, Vector3 Os, float ka, float kd, float ks, float n) const {
+bool Scene::HitsCachedOccluder(const Ray& shadowRay, const SceneObject* occluder, TraceContext& context, const SceneObject* ignoreObject) const {
+    if (occluder == NULL || occluder == ignoreObject)
+        return false;
+    ObjectType type = occluder->Type();
+    if (type == SphereObject) context.stats.sphereTests++;
+    else if (type == TriangleObject) context.stats.triangleTests++;
+    else context.stats.otherTests++;
+    if (!occluder->IntersectRay(shadowRay).hit)
+        return false;
+    context.stats.shadowCacheHits++;
+    return true;
+}
+
+Vector3 Scene::ComputeDiffuseSpecular(Vector3 L, Vector3 N, Vector3 I, Vector3 Od, Vector3 Os, float ka, float kd, float ks, float n) {
     Vector3 H = Vector3::Normalize(L + I);
     Vector3 diffuse = kd*Od * std::max(0.0f, Vector3::Dot(N, L));
     Vector3 specular = ks*Os * std::pow(std::max(0.0f, Vector3::Dot(N, H)), n);
     return diffuse + specular;
 }
 
-Color Scene::TraceRay(const Ray ray, int iteration, const SceneObject* ignoreObject) const {
+Color Scene::TraceRay(const Ray ray, TraceContext& context, int iteration, const SceneObject* ignoreObject) const {
+    if (softShadows_)
+        return TraceRayKernel<true>(ray, context, iteration, ignoreObject);
+    return TraceRayKernel<false>(ray, context, iteration, ignoreObject);
+}
+
+template <bool SoftShadows>
+Color Scene::TraceRayKernel(const Ray ray, TraceContext& context, int iteration, const SceneObject* ignoreObject) const {
+    context.stats.rayDepths[std::min(iteration, RAY_DEPTH_HISTOGRAM_SIZE-1)]++;
+
     // Raycast into the scene and get hit information
-    RaycastHit raycastHit = Raycast(ray, ignoreObject);
+    RaycastHit raycastHit = Raycast(ray, context, ignoreObject);
 
     // Return the background color if no object was hit
     if (!raycastHit.hit)
         return backgroundColor_;
 
-    // Convert hit object material parameters to vec3s
-    Material hitMaterial = materials_[raycastHit.materialIdx];
-    Vector3 Od;
+    // Look up the preprocessed hit material, taking the diffuse color from the texture if the object has one
+    const ShadingMaterial& hitMaterial = materials_[raycastHit.materialIdx];
+    Vector3 Od = hitMaterial.Od;
     if (raycastHit.textureIdx != -1) {
         Color textureColor = textures_[raycastHit.textureIdx]->GetPixel(raycastHit.u, raycastHit.v);
         Od = Vector3(textureColor.r(), textureColor.g(), textureColor.b());
-    } else {
-        Od = Vector3(hitMaterial.Od.r(), hitMaterial.Od.g(), hitMaterial.Od.b());
     }
-    Vector3 Os = Vector3(hitMaterial.Os.r(), hitMaterial.Os.g(), hitMaterial.Os.b());
+    const Vector3& Os = hitMaterial.Os;
     float ka = hitMaterial.ka;
     float kd = hitMaterial.kd;
     float ks = hitMaterial.ks;
     float n = hitMaterial.n;
-    float a = hitMaterial.a;
     float ior = hitMaterial.ior;
     Vector3 I = -ray.Direction();
     Vector3 N = raycastHit.normal;
@@ -532,40 +675,62 @@ Color Scene::TraceRay(const Ray ray, int iteration, const SceneObject* ignoreObj
     // Ambient light contribution
     Vector3 rayColor = ka*Od;
     // Point light contribution
-    for (auto pointLight : pointLights_) {
-        Vector3 IL = Vector3(pointLight.LightColor().r(), pointLight.LightColor().g(), pointLight.LightColor().b());
-        Vector3 L = Vector3::Normalize(pointLight.Position()-raycastHit.point);
-        Vector3 ds = ComputeDiffuseSpecular(L, N, I, Od, Os, ka, kd, ks, n);
-        float S = InShadow(raycastHit.point, pointLight.Position(), raycastHit.object);
-        float f = pointLight.Attenuate(raycastHit.point);
-        rayColor = rayColor + S*f*IL*ds;
+    if (lightSampleCount_ > 0 && pointLights_.size() > (size_t)lightSampleCount_) {
+        // Importance sample a few lights, weighting each by how likely it was to be picked
+        for (int i = 0; i < lightSampleCount_; i++) {
+            float pdf;
+            int lightIdx = lightTree_.Sample(raycastHit.point, context.random, pdf);
+            if (lightIdx < 0)
+                continue;
+            const PointLight& pointLight = pointLights_[lightIdx];
+            Vector3 IL = Vector3(pointLight.LightColor().r(), pointLight.LightColor().g(), pointLight.LightColor().b());
+            Vector3 L = Vector3::Normalize(pointLight.Position()-raycastHit.point);
+            Vector3 ds = ComputeDiffuseSpecular(L, N, I, Od, Os, ka, kd, ks, n);
+            float S = InShadow<SoftShadows>(raycastHit.point, pointLight, true, lightIdx, context, raycastHit.object);
+            float f = pointLight.Attenuate(raycastHit.point);
+            rayColor = rayColor + (S*f/(pdf*lightSampleCount_))*IL*ds;
+        }
+    } else {
+        for (size_t lightIdx = 0; lightIdx < pointLights_.size(); lightIdx++) {
+            const PointLight& pointLight = pointLights_[lightIdx];
+            Vector3 IL = Vector3(pointLight.LightColor().r(), pointLight.LightColor().g(), pointLight.LightColor().b());
+            Vector3 L = Vector3::Normalize(pointLight.Position()-raycastHit.point);
+            Vector3 ds = ComputeDiffuseSpecular(L, N, I, Od, Os, ka, kd, ks, n);
+            float S = InShadow<SoftShadows>(raycastHit.point, pointLight, true, lightIdx, context, raycastHit.object);
+            float f = pointLight.Attenuate(raycastHit.point);
+            rayColor = rayColor + S*f*IL*ds;
+        }
     }
     // Directional light contribution
-    for (auto directionalLight : directionalLights_) {
+    for (size_t lightIdx = 0; lightIdx < directionalLights_.size(); lightIdx++) {
+        const DirectionalLight& directionalLight = directionalLights_[lightIdx];
         Vector3 IL = Vector3(directionalLight.LightColor().r(), directionalLight.LightColor().g(), directionalLight.LightColor().b());
         Vector3 L = -directionalLight.Direction();
         Vector3 ds = ComputeDiffuseSpecular(L, N, I, Od, Os, ka, kd, ks, n);
-        float S = InShadow(raycastHit.point, raycastHit.point+(25*L), raycastHit.object);
+        float S = InShadow<SoftShadows>(raycastHit.point, directionalShadowLights_[lightIdx], false, pointLights_.size() + lightIdx, context, raycastHit.object);
         rayColor = rayColor + S*IL*ds;
     }
     // Reflectance contribution
     if (iteration < MAX_DEPTH) {
         float cosThetai = Vector3::Dot(N, I);
         Vector3 R = 2*cosThetai*N-I;
-        Color Rc = TraceRay(Ray(raycastHit.point, R), ++iteration, raycastHit.object);
-        float F0 = ((ior-1)/(ior+1))*((ior-1)/(ior+1));
+        context.stats.reflectionRays++;
+        Color Rc = TraceRayKernel<SoftShadows>(Ray(raycastHit.point, R), context, ++iteration, raycastHit.object);
+        float F0 = hitMaterial.F0;
         float Fr = F0 + (1-F0)*std::pow((1-cosThetai), 5);
         rayColor = rayColor + Fr*Vector3(Rc.r(), Rc.g(), Rc.b());
 
+        // Opaque materials let no refracted light through, so skip tracing it
         float ni = leaving ? IOR_AIR : ior;
         float nt = leaving ? ior : IOR_AIR;
         float tir = 1-((ni/nt)*(ni/nt)*(1-cosThetai*cosThetai));
-        if (tir >= 0)
+        if (hitMaterial.transparent && tir >= 0)
         {
             float cosThetat = std::sqrt(tir);
             Vector3 T = cosThetat*(-N) + (ni/nt)*(cosThetai*N-I);
-            Color Tc = TraceRay(Ray(raycastHit.point+T*0.0001, T), ++iteration);
-            rayColor = rayColor + (1 - Fr)*(1 - a)*Vector3(Tc.r(), Tc.g(), Tc.b());
+            context.stats.refractionRays++;
+            Color Tc = TraceRayKernel<SoftShadows>(Ray(raycastHit.point+T*0.0001, T), context, ++iteration, NULL);
+            rayColor = rayColor + (1 - Fr)*hitMaterial.transmission*Vector3(Tc.r(), Tc.g(), Tc.b());
         }
     }
 
@@ -573,7 +738,170 @@ Color Scene::TraceRay(const Ray ray, int iteration, const SceneObject* ignoreObj
     return Color(rayColor.x(), rayColor.y(), rayColor.z()); //DepthCue(I, raycastHit.distance);
 }
 
-Image Scene::Render() {
+template <bool SoftShadows, bool DepthOfField>
+Color Scene::RenderPixel(Vector3 pixelPosition, Vector3 eyePosition, TraceContext& context) const {
+    if (!DepthOfField) {
+        // Trace a single ray from the eye through the pixel
+        context.stats.cameraRays++;
+        Color color = TraceRayKernel<SoftShadows>(Ray(eyePosition, pixelPosition - eyePosition), context, 0, NULL);
+        color.Clamp01();
+        return color;
+    }
+
+    // Average rays from jittered eye positions through the pixel
+    Color avgColor;
+    float dofJitter = 0.075f;
+    for (int i = 0; i < passDofSampleCount_; i++)
+    {
+        float x = context.random.NextFloat() * dofJitter - dofJitter/2;
+        float y = context.random.NextFloat() * dofJitter - dofJitter/2;
+        float z = context.random.NextFloat() * dofJitter - dofJitter/2;
+        Vector3 eyeOffset = eyePosition + Vector3(x, y, z);
+        // Calculate ray from eye through pixel
+        Ray viewingRay = Ray(eyeOffset, pixelPosition - eyeOffset);
+        // Trace the ray to set the pixel color
+        context.stats.cameraRays++;
+        avgColor = avgColor + TraceRayKernel<SoftShadows>(viewingRay, context, 0, NULL)/passDofSampleCount_;
+    }
+    avgColor.Clamp01();
+    return avgColor;
+}
+
+void Scene::RecordFeatures(RenderFeatures& features, int x, int y, Vector3 pixelPosition, Vector3 eyePosition,
+    TraceContext& context) const {
+    // Follow the same camera rays as the pixel kernel: the pinhole ray, or
+    // rays from jittered eye positions with depth of field
+    int rayCount = depthOfField_ ? passDofSampleCount_ : 1;
+    float dofJitter = 0.075f;
+    Vector3 albedo, normal;
+    float depth = 0;
+    int hitCount = 0;
+    for (int i = 0; i < rayCount; i++) {
+        Vector3 eye = eyePosition;
+        if (depthOfField_) {
+            float x = context.random.NextFloat() * dofJitter - dofJitter/2;
+            float y = context.random.NextFloat() * dofJitter - dofJitter/2;
+            float z = context.random.NextFloat() * dofJitter - dofJitter/2;
+            eye = eyePosition + Vector3(x, y, z);
+        }
+        Ray ray = Ray(eye, pixelPosition - eye);
+        RaycastHit hit = Raycast(ray, context);
+        if (!hit.hit) {
+            albedo = albedo + Vector3(backgroundColor_.r(), backgroundColor_.g(), backgroundColor_.b());
+            continue;
+        }
+        Vector3 Od = materials_[hit.materialIdx].Od;
+        if (hit.textureIdx != -1) {
+            Color textureColor = textures_[hit.textureIdx]->GetPixel(hit.u, hit.v);
+            Od = Vector3(textureColor.r(), textureColor.g(), textureColor.b());
+        }
+        albedo = albedo + Od;
+        normal = normal + (Vector3::Dot(hit.normal, ray.Direction()) > 0 ? -hit.normal : hit.normal);
+        depth += hit.distance;
+        hitCount++;
+    }
+    albedo = albedo / rayCount;
+    normal = (normal / rayCount + Vector3(1, 1, 1)) / 2;
+    features.albedo.SetPixel(x, y, Color(albedo.x(), albedo.y(), albedo.z()));
+    features.normal.SetPixel(x, y, Color(normal.x(), normal.y(), normal.z()));
+    features.depth.SetValue(x, y, hitCount > 0 ? depth / hitCount : 0);
+}
+
+void Scene::SetSampleCounts(int dofSampleCount, int shadowSampleCount) {
+    dofSampleCount_ = std::max(dofSampleCount, 1);
+    shadowSampleCount_ = std::max(shadowSampleCount, 1);
+}
+
+void Scene::SetCropWindow(int x0, int y0, int x1, int y1) {
+    cropWindow_ = true;
+    cropX0_ = x0;
+    cropY0_ = y0;
+    cropX1_ = x1;
+    cropY1_ = y1;
+}
+
+void Scene::RenderRegion(int& x0, int& y0, int& x1, int& y1) const {
+    int pixelWidth = camera_.Width();
+    int pixelHeight = camera_.Height();
+    x0 = 0;
+    y0 = 0;
+    x1 = pixelWidth;
+    y1 = pixelHeight;
+    if (cropWindow_) {
+        x0 = std::min(std::max(cropX0_, 0), pixelWidth);
+        y0 = std::min(std::max(cropY0_, 0), pixelHeight);
+        x1 = std::min(std::max(cropX1_, x0), pixelWidth);
+        y1 = std::min(std::max(cropY1_, y0), pixelHeight);
+    }
+}
+
+uint64_t Scene::SamplingHash() const {
+    // Chain every setting through the seed hash, floats by their bit patterns
+    uint64_t hash = 0;
+    auto mix = [&hash](uint64_t value) { hash = Random::Hash(hash ^ value); };
+    auto mixFloat = [&mix](float value) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        mix(bits);
+    };
+    Vector3 cameraVectors[3] = { camera_.EyePosition(), camera_.ViewDirection(), camera_.UpDirection() };
+    for (const Vector3& v : cameraVectors) {
+        mixFloat(v.x());
+        mixFloat(v.y());
+        mixFloat(v.z());
+    }
+    mixFloat(camera_.FieldOfView());
+    mix(camera_.Width());
+    mix(camera_.Height());
+    mixFloat(viewingDistance_);
+    mix(softShadows_);
+    mix(depthOfField_);
+    mix(dofSampleCount_);
+    mix(shadowSampleCount_);
+    mix(lightSampleCount_);
+    mix(bvhBuildMode_);
+    int x0, y0, x1, y1;
+    RenderRegion(x0, y0, x1, y1);
+    mix(x0);
+    mix(y0);
+    mix(x1);
+    mix(y1);
+    return hash;
+}
+
+Scene::PixelKernel Scene::PrepareRender() {
+    passDofSampleCount_ = dofSampleCount_;
+    passShadowSampleCount_ = shadowSampleCount_;
+
+    // Build the light tree once per frame, so that it reflects lights added,
+    // moved or changed since the last one
+    if (lightSampleCount_ > 0 && lightTreeStale_) {
+        lightTree_.Build(pointLights_);
+        lightTreeStale_ = false;
+    }
+
+    // Directional lights cast shadows from a point light a fixed distance
+    // toward them, positioned relative to each shaded point
+    directionalShadowLights_.clear();
+    for (const DirectionalLight& directionalLight : directionalLights_)
+        directionalShadowLights_.push_back(PointLight(25*(-directionalLight.Direction()), directionalLight.LightColor()));
+
+    // Cached shadow occluders stand in for the nearest blocker, which only matters
+    // when some material lets light through. Hits on paged out geometry report
+    // tokens in place of objects, so there is nothing to cache.
+    shadowCacheEnabled_ = !pagedOut_;
+    for (const ShadingMaterial& material : materials_) {
+        if (material.transparent)
+            shadowCacheEnabled_ = false;
+    }
+
+    // Pick the pixel kernel for the enabled features once for the whole frame
+    if (softShadows_)
+        return depthOfField_ ? &Scene::RenderPixel<true, true> : &Scene::RenderPixel<true, false>;
+    return depthOfField_ ? &Scene::RenderPixel<false, true> : &Scene::RenderPixel<false, false>;
+}
+
+Scene::ViewWindow Scene::ComputeViewWindow() const {
     // Pull variables from scene
     int pixelWidth = camera_.Width();
     int pixelHeight = camera_.Height();
@@ -581,9 +909,6 @@ Image Scene::Render() {
     Vector3 viewDirection = camera_.ViewDirection();
     Vector3 upDirection = camera_.UpDirection();
 
-    // Initialize the final output render image
-    Image renderImage = Image(pixelWidth, pixelHeight);
-
     // Calculate height and width of viewing window in world space
     float vfovRadians = camera_.FieldOfView() * (M_PI/180);
     float h = 2*viewingDistance_*tan(vfovRadians/2);
@@ -599,59 +924,276 @@ Image Scene::Render() {
     //Vector3 lr = eyePosition + viewingDistance_*viewDirection + (w/2)*u - (h/2)*v;
 
     // Compute pixel offsets
-    Vector3 du = u * Vector3::Distance(ur, ul)/pixelWidth;
-    Vector3 dv = v * Vector3::Distance(ll, ul)/pixelHeight;
+    ViewWindow window;
+    window.ul = ul;
+    window.du = u * Vector3::Distance(ur, ul)/pixelWidth;
+    window.dv = v * Vector3::Distance(ll, ul)/pixelHeight;
+    return window;
+}
 
-    // Iterate through each pixel in the output image and trace a ray to determine pixel color
-    for (int x = 0; x < renderImage.Width(); x++) {
-        for (int y = 0; y < renderImage.Height(); y++) {
-            // Calculate position of viewing window pixel in world space
-            Vector3 pixelPosition = ul + x*du - y*dv + du/2 - dv/2;
-            Color avgColor;
-            float dofJitter = depthOfField_ ? 0.075f : 0;
-            int dofIterations = depthOfField_ ? DOF_SAMPLE_COUNT : 1;
-            for (int i = 0; i < dofIterations; i++)
-            {
-                float x = (float(rand())/float((RAND_MAX))) * dofJitter - dofJitter/2;
-                float y = (float(rand())/float((RAND_MAX))) * dofJitter - dofJitter/2;
-                float z = (float(rand())/float((RAND_MAX))) * dofJitter - dofJitter/2;
-                Vector3 eyeOffset = eyePosition + Vector3(x, y, z);
-                // Calculate ray from eye through pixel
-                Ray viewingRay = Ray(eyeOffset, pixelPosition - eyeOffset);
-                // Trace the ray to set the pixel color
-                avgColor = avgColor + TraceRay(viewingRay)/dofIterations;
+bool Scene::RenderRows(int y0, int y1, int rowPixels, const std::function<void(int y, TraceContext& context)>& renderRow) {
+    // Render threads take rows one at a time until all rows are done, each
+    // tracing with its own context so they never contend on shared counters
+    ThreadPool* threadPool = threadPool_;
+    ThreadPool* localThreadPool = NULL;
+    if (threadPool == NULL)
+        threadPool = localThreadPool = new ThreadPool(threadCount_);
+    std::vector<TraceContext> contexts(threadPool->ThreadCount());
+    for (TraceContext& context : contexts)
+        context.shadowOccluders.assign(pointLights_.size() + directionalLights_.size(), NULL);
+    std::atomic<int> nextRow(y0);
+    std::atomic<bool> stopped(false);
+    threadPool->Run([&](int threadIdx) {
+        TraceContext& context = contexts[threadIdx];
+        for (int y = nextRow++; y < y1; y = nextRow++) {
+            if (progress_ != NULL && progress_->ShouldStop()) {
+                stopped = true;
+                break;
             }
-            avgColor.Clamp01();
-            renderImage.SetPixel(x, y, avgColor);
+            renderRow(y, context);
+            if (progress_ != NULL)
+                progress_->Advance(rowPixels);
         }
+    });
+    delete localThreadPool;
+
+    // Merge the per-thread counters
+    for (const TraceContext& context : contexts)
+        stats_.Merge(context.stats);
+    return !stopped;
+}
+
+Image Scene::Render(RenderHeatmaps* heatmaps, RenderFeatures* features) {
+    Timer renderTimer;
+    PixelKernel renderPixel = PrepareRender();
+    ViewWindow window = ComputeViewWindow();
+    int pixelWidth = camera_.Width();
+    Vector3 eyePosition = camera_.EyePosition();
+
+    // Determine the region of the full frame to render
+    int x0, y0, x1, y1;
+    RenderRegion(x0, y0, x1, y1);
+    int regionWidth = x1 - x0;
+    int regionHeight = y1 - y0;
+
+    // Initialize the final output render image
+    Image renderImage = Image(regionWidth, regionHeight);
+    if (heatmaps != NULL) {
+        heatmaps->nodeVisits = Heatmap(regionWidth, regionHeight);
+        heatmaps->primitiveTests = Heatmap(regionWidth, regionHeight);
+        heatmaps->renderTime = Heatmap(regionWidth, regionHeight);
     }
+    if (features != NULL) {
+        features->albedo = Image(regionWidth, regionHeight);
+        features->normal = Image(regionWidth, regionHeight);
+        features->depth = Heatmap(regionWidth, regionHeight);
+    }
+
+    if (progress_ != NULL)
+        progress_->Start((uint64_t)regionWidth * regionHeight);
+    RenderRows(y0, y1, regionWidth, [&](int y, TraceContext& context) {
+        for (int x = x0; x < x1; x++) {
+            // Seed from the pixel's position in the full frame, so its samples do not
+            // depend on thread scheduling or on which crop window it was rendered in
+            context.random.Seed(Random::Hash((uint64_t)y * pixelWidth + x));
+
+            // Calculate position of viewing window pixel in world space
+            Vector3 pixelPosition = window.ul + x*window.du - y*window.dv + window.du/2 - window.dv/2;
+
+            if (heatmaps == NULL) {
+                renderImage.SetPixel(x - x0, y - y0, (this->*renderPixel)(pixelPosition, eyePosition, context));
+            } else {
+                // Snapshot counters so the cost of this pixel can be recorded
+                Timer pixelTimer;
+                uint64_t nodesBefore = context.stats.bvhNodesVisited;
+                uint64_t testsBefore = context.stats.sphereTests + context.stats.triangleTests + context.stats.otherTests;
+                renderImage.SetPixel(x - x0, y - y0, (this->*renderPixel)(pixelPosition, eyePosition, context));
+                uint64_t testsAfter = context.stats.sphereTests + context.stats.triangleTests + context.stats.otherTests;
+                heatmaps->nodeVisits.SetValue(x - x0, y - y0, context.stats.bvhNodesVisited - nodesBefore);
+                heatmaps->primitiveTests.SetValue(x - x0, y - y0, testsAfter - testsBefore);
+                heatmaps->renderTime.SetValue(x - x0, y - y0, pixelTimer.Seconds() * 1e6);
+            }
+            // Features are sampled after the pixel so they do not change its random samples
+            if (features != NULL)
+                RecordFeatures(*features, x - x0, y - y0, pixelPosition, eyePosition, context);
+        }
+    });
 
     // Return the rendered image
+    if (progress_ != NULL)
+        progress_->Finish();
+    stats_.renderSeconds += renderTimer.Seconds();
     return renderImage;
 }
 
-RaycastHit Scene::Raycast(const Ray ray, const SceneObject* ignoreObject) const {
+Image Scene::RenderProgressive(int passCount, const std::function<bool(const Image& image, int pass, int passCount)>& onPass,
+    RenderFeatures* features, RenderCheckpoint* checkpoint) {
+    Timer renderTimer;
+    PixelKernel renderPixel = PrepareRender();
+    ViewWindow window = ComputeViewWindow();
+    int pixelWidth = camera_.Width();
+    uint64_t pixelCount = (uint64_t)pixelWidth * camera_.Height();
+    Vector3 eyePosition = camera_.EyePosition();
+
+    // Split the full sample budget over the passes: depth of field samples if
+    // enabled, otherwise shadow samples, which soft shadows and area lights
+    // take. Lights picked from the light tree differ between passes too.
+    // Without any of them, every pass would trace exactly the same rays.
+    bool areaLights = false;
+    for (const PointLight& pointLight : pointLights_) {
+        if (pointLight.Shape() != PointShape)
+            areaLights = true;
+    }
+    bool sampledLights = lightSampleCount_ > 0 && pointLights_.size() > (size_t)lightSampleCount_;
+    if (!softShadows_ && !depthOfField_ && !areaLights && !sampledLights)
+        passCount = 1;
+    passCount = std::max(passCount, 1);
+    if (depthOfField_)
+        passDofSampleCount_ = std::max(dofSampleCount_ / passCount, 1);
+    else
+        passShadowSampleCount_ = std::max(shadowSampleCount_ / passCount, 1);
+
+    int x0, y0, x1, y1;
+    RenderRegion(x0, y0, x1, y1);
+    int regionWidth = x1 - x0;
+    int regionHeight = y1 - y0;
+    size_t regionPixelCount = (size_t)regionWidth * regionHeight;
+    Image renderImage = Image(regionWidth, regionHeight);
+    if (features != NULL) {
+        features->albedo = Image(regionWidth, regionHeight);
+        features->normal = Image(regionWidth, regionHeight);
+        features->depth = Heatmap(regionWidth, regionHeight);
+    }
+
+    // Each pass adds one estimate per pixel to the accumulation buffer, and the
+    // image shows their mean. A checkpoint of this render with finished passes
+    // supplies the buffer to continue from; any other checkpoint is started afresh.
+    std::vector<Vector3> localAccumulation;
+    int passesDone = 0;
+    if (checkpoint != NULL && checkpoint->passesDone > 0 && checkpoint->passCount == passCount &&
+        checkpoint->width == regionWidth && checkpoint->height == regionHeight &&
+        checkpoint->accumulation.size() == regionPixelCount && (features == NULL || checkpoint->hasFeatures)) {
+        passesDone = checkpoint->passesDone;
+        if (features != NULL)
+            *features = checkpoint->features;
+    } else if (checkpoint != NULL) {
+        checkpoint->width = regionWidth;
+        checkpoint->height = regionHeight;
+        checkpoint->passCount = passCount;
+        checkpoint->passesDone = 0;
+        checkpoint->accumulation.assign(regionPixelCount, Vector3());
+        checkpoint->hasFeatures = false;
+        checkpoint->features = RenderFeatures();
+    } else {
+        localAccumulation.assign(regionPixelCount, Vector3());
+    }
+    std::vector<Vector3>& accumulation = checkpoint != NULL ? checkpoint->accumulation : localAccumulation;
 
+    int step = PROGRESSIVE_PREVIEW_STEP;
+    int previewWidth = (regionWidth + step - 1) / step;
+    int previewHeight = (regionHeight + step - 1) / step;
+    uint64_t passPixelCount = (uint64_t)(passCount - passesDone) * regionPixelCount;
+    bool keepGoing = true;
+    if (passesDone > 0) {
+        // A resumed render shows the checkpoint's image in place of the preview
+        if (progress_ != NULL)
+            progress_->Start(passPixelCount);
+        for (size_t i = 0; i < regionPixelCount; i++) {
+            Vector3 mean = passesDone == 1 ? accumulation[i] : accumulation[i] / passesDone;
+            renderImage.SetPixel(i % regionWidth, i / regionWidth, Color(mean.x(), mean.y(), mean.z()));
+        }
+    } else {
+        // Preview: trace the top left pixel of each block and fill the block with it
+        if (progress_ != NULL)
+            progress_->Start((uint64_t)previewWidth * previewHeight + passPixelCount);
+        keepGoing = RenderRows(0, previewHeight, previewWidth, [&](int blockY, TraceContext& context) {
+            int y = y0 + blockY*step;
+            for (int x = x0; x < x1; x += step) {
+                context.random.Seed(Random::Hash((uint64_t)y * pixelWidth + x));
+                Vector3 pixelPosition = window.ul + x*window.du - y*window.dv + window.du/2 - window.dv/2;
+                Color color = (this->*renderPixel)(pixelPosition, eyePosition, context);
+                for (int by = y; by < std::min(y + step, y1); by++)
+                    for (int bx = x; bx < std::min(x + step, x1); bx++)
+                        renderImage.SetPixel(bx - x0, by - y0, color);
+            }
+        });
+    }
+    keepGoing = keepGoing && onPass(renderImage, 0, passCount);
 
-    RaycastHit closestHitInfo = RaycastBVH(ray, bvhRoot_, ignoreObject);
+    // Pass p seeds pixel i with the hash of i + p*pixelCount, so the first pass
+    // draws the same samples as Render and no pass depends on the ones before it
+    for (int pass = passesDone + 1; pass <= passCount && keepGoing; pass++) {
+        keepGoing = RenderRows(y0, y1, regionWidth, [&](int y, TraceContext& context) {
+            for (int x = x0; x < x1; x++) {
+                context.random.Seed(Random::Hash((uint64_t)y * pixelWidth + x + (pass - 1) * pixelCount));
+                Vector3 pixelPosition = window.ul + x*window.du - y*window.dv + window.du/2 - window.dv/2;
+                Color color = (this->*renderPixel)(pixelPosition, eyePosition, context);
+                Vector3& sum = accumulation[(x - x0) + (size_t)(y - y0) * regionWidth];
+                sum = sum + Vector3(color.r(), color.g(), color.b());
+                Vector3 mean = pass == 1 ? sum : sum / pass;
+                renderImage.SetPixel(x - x0, y - y0, Color(mean.x(), mean.y(), mean.z()));
+                if (features != NULL && pass == 1)
+                    RecordFeatures(*features, x - x0, y - y0, pixelPosition, eyePosition, context);
+            }
+        });
+        // The checkpoint only ever holds whole passes
+        if (keepGoing && checkpoint != NULL) {
+            checkpoint->passesDone = pass;
+            if (features != NULL && pass == 1) {
+                checkpoint->features = *features;
+                checkpoint->hasFeatures = true;
+            }
+        }
+        keepGoing = keepGoing && onPass(renderImage, pass, passCount);
+    }
+
+    if (progress_ != NULL)
+        progress_->Finish();
+    stats_.renderSeconds += renderTimer.Seconds();
+    return renderImage;
+}
+
+RaycastHit Scene::Raycast(const Ray ray, const SceneObject* ignoreObject) const {
+    TraceContext context;
+    return Raycast(ray, context, ignoreObject);
+}
+
+RaycastHit Scene::Raycast(const Ray ray, TraceContext& context, const SceneObject* ignoreObject) const {
+    Ray boundedRay = ray;
+    if (pagedOut_)
+        return pagedGeometry_.Raycast(boundedRay, context, ignoreObject);
+    if (compressBVH_)
+        return compressedBVH_.Raycast(boundedRay, context, ignoreObject);
+    RaycastHit closestHitInfo = RaycastBVH(boundedRay, bvhRoot_, context, ignoreObject);
 
     // Return the raycast hit information
     return closestHitInfo;
 }
 
-RaycastHit Scene::RaycastBVH(const Ray ray, BVHNode* node, const SceneObject* ignoreObject) const {
+RaycastHit Scene::RaycastBVH(Ray& ray, BVHNode* node, TraceContext& context, const SceneObject* ignoreObject) const {
     // If the ray intersects with the BVH
     // Leaf - check for intersection with object
     // Non-leaf - recurse further
+    context.stats.bvhNodesVisited++;
     if (node->IntersectsRay(ray)) {
+        if (node->Cluster() >= 0)
+            return leafClusters_.IntersectRay(node->Cluster(), ray, context, ignoreObject);
         if (node->IsLeaf()) {
             if (node->IsEmpty() || node->Leaf() == ignoreObject)
                 return RaycastHit();
-            else
-                return node->Leaf()->IntersectRay(ray);
+            ObjectType type = node->Leaf()->Type();
+            if (type == SphereObject) context.stats.sphereTests++;
+            else if (type == TriangleObject) context.stats.triangleTests++;
+            else context.stats.otherTests++;
+            RaycastHit hit = node->Leaf()->IntersectRay(ray);
+            if (hit.hit)
+                ray.SetTMax(hit.distance);
+            return hit;
         } else {
-            RaycastHit left = RaycastBVH(ray, node->Left(), ignoreObject);
-            RaycastHit right = RaycastBVH(ray, node->Right(), ignoreObject);
+            // The right subtree only reports hits no farther than the left's,
+            // so on equal distances the right hit is kept
+            RaycastHit left = RaycastBVH(ray, node->Left(), context, ignoreObject);
+            RaycastHit right = RaycastBVH(ray, node->Right(), context, ignoreObject);
             return left.distance < right.distance ? left : right;
         }
     } else {
@@ -669,7 +1211,43 @@ Color Scene::DepthCue(Vector3 I, float d) const {
 }
 
 void Scene::ConstructBVH() {
-    bvhRoot_ = ConstructBVHRecursive(sceneObjects_);
+    Timer buildTimer;
+    bvhArena_.Reset();
+    // Refitting follows each object to its one leaf, so animated scenes cannot
+    // have objects split across several leaves
+    BVHBuildMode buildMode = bvhBuildMode_;
+    if (buildMode == SpatialSplitBVH && IsAnimated())
+        buildMode = MedianSplitBVH;
+    bvhRoot_ = BVHBuilder(buildMode).Build(sceneObjects_, bvhArena_, &bvhNodeCount_);
+    LayOutObjectsInLeafOrder();
+    // Remember which leaf holds each object so animated objects can be refit each frame
+    leafNodes_.clear();
+    if (IsAnimated())
+        MapLeaves(bvhRoot_);
+    bvhAreaSum_ = BVHAreaSum(bvhRoot_);
+    bvhBuildQuality_ = BVHQuality();
+    // Refitting needs every object in memory
+    bool pageGeometry = geometryCacheBytes_ > 0 && !IsAnimated();
+    if (clusterLeaves_ && !compressBVH_ && !pageGeometry)
+        leafClusters_.Build(bvhRoot_);
+    if (pageGeometry && PageOutGeometry()) {
+        stats_.bvhBuildSeconds += buildTimer.Seconds();
+        return;
+    }
+    // Only refitting needs the full precision tree once it is compressed
+    if (compressBVH_) {
+        compressedBVH_.Build(bvhRoot_);
+        if (!IsAnimated()) {
+            bvhArena_.Reset();
+            bvhRoot_ = NULL;
+#ifdef __GLIBC__
+            // The freed nodes usually lie below the objects laid out after them, where
+            // the heap cannot shrink, so hand their pages back to the kernel explicitly
+            malloc_trim(0);
+#endif
+        }
+    }
+    stats_.bvhBuildSeconds += buildTimer.Seconds();
     // for (size_t i = 0; i < sceneObjects_.size(); i++) {
     //     AABB objectBounds = sceneObjects_[i]->BoundingBox();
     //     std::cout << " ----- \n" << i << std::endl;
@@ -678,45 +1256,132 @@ void Scene::ConstructBVH() {
     // }
 }
 
-BVHNode* Scene::ConstructBVHRecursive(std::vector<SceneObject*>& sceneObjects) {
-    // Special Case: Empty node
-    if (sceneObjects.size() == 0)
-        return new BVHNode();
-
-    // Special Case: Leaf node
-    if (sceneObjects.size() == 1)
-        return new BVHNode(sceneObjects[0]->BoundingBox(), sceneObjects[0]);
-
-    // Construct an AABB surrounding all the given objects
-    AABB objectBounds = sceneObjects[0]->BoundingBox();
-    Vector3 min = objectBounds.Min();
-    Vector3 max = objectBounds.Max();
-    for (size_t i = 1; i < sceneObjects.size(); i++) {
-        objectBounds = sceneObjects[i]->BoundingBox();
-        min = Vector3::Min(min, objectBounds.Min());
-        max = Vector3::Max(max, objectBounds.Max());
-    }
-    AABB aabb = AABB(min, max);
-
-    // Split the AABB in half along its longest side
-    std::vector<SceneObject*> leftObjects;
-    std::vector<SceneObject*> rightObjects;
-    Vector3 dims = max-min;
-    float longestAxis = std::max(dims.x(), std::max(dims.y(), dims.z()));
-    if (dims.x() == longestAxis)
-        std::sort(sceneObjects.begin(), sceneObjects.end(), CompareObectX);
-    else if (dims.y() == longestAxis)
-        std::sort(sceneObjects.begin(), sceneObjects.end(), CompareObectY);
-    else
-        std::sort(sceneObjects.begin(), sceneObjects.end(), CompareObectZ);
-    for (size_t i = 0; i < sceneObjects.size(); i++) {
-        if (i < sceneObjects.size()/2)
-            leftObjects.push_back(sceneObjects[i]);
-        else
-            rightObjects.push_back(sceneObjects[i]);
+bool Scene::AdvanceFrame() {
+    lightTreeStale_ = true;
+
+    // Nothing moves, and a compressed scene may have no full precision tree to refit
+    if (!IsAnimated())
+        return false;
+
+    // Move each animated object and refit the bounds of its ancestors
+    for (auto animatedObject : animatedObjects_) {
+        animatedObject.first->Translate(animatedObject.second);
+        RefitBVHFromLeaf(leafNodes_[animatedObject.first]);
     }
 
-    return new BVHNode(aabb, ConstructBVHRecursive(leftObjects), ConstructBVHRecursive(rightObjects));
+    // Rebuild from scratch if the refit tree has become too loose
+    if (BVHQuality() > BVH_REBUILD_RATIO * bvhBuildQuality_) {
+        ConstructBVH();
+        return true;
+    }
+    // Clusters hold copies of the geometry they test
+    if (clusterLeaves_ && !compressBVH_)
+        leafClusters_.Build(bvhRoot_);
+    if (compressBVH_)
+        compressedBVH_.Build(bvhRoot_);
+    return false;
+}
+
+BVHReport Scene::AnalyzeBVH() const {
+    if (pagedOut_)
+        return pagedReport_;
+    if (!compressBVH_)
+        return BVHReport::Analyze(bvhRoot_);
+    // Analyze the quantized bounds that traversal tests
+    Arena decodeArena;
+    BVHReport report = BVHReport::Analyze(compressedBVH_.Decode(decodeArena));
+    report.bytes = compressedBVH_.Bytes();
+    return report;
+}
+
+void Scene::RefitBVHFromLeaf(BVHNode* leaf) {
+    // Walk up towards the root, stopping early once bounds no longer change
+    for (BVHNode* node = leaf; node != NULL; node = node->Parent()) {
+        float oldArea = node->BoundingBox().SurfaceArea();
+        if (!node->Refit())
+            break;
+        bvhAreaSum_ += node->BoundingBox().SurfaceArea() - oldArea;
+    }
+}
+
+float Scene::BVHQuality() const {
+    // Sum of node surface areas relative to the root, proportional to the expected
+    // number of nodes a random ray visits (lower is better)
+    float rootArea = bvhRoot_->BoundingBox().SurfaceArea();
+    if (rootArea <= 0) return 0;
+    return bvhAreaSum_ / rootArea;
+}
+
+float Scene::BVHAreaSum(BVHNode* node) const {
+    if (node->IsEmpty()) return 0;
+    float area = node->BoundingBox().SurfaceArea();
+    if (!node->IsLeaf())
+        area += BVHAreaSum(node->Left()) + BVHAreaSum(node->Right());
+    return area;
+}
+
+void Scene::LayOutObjectsInLeafOrder() {
+    // Nodes are stored depth first, so walking the node array visits leaves in
+    // traversal order. Copy each leaf object into a fresh arena in that order,
+    // so that objects close together in the tree are close together in memory.
+    Arena layoutArena(objectArena_.HugePages());
+    // Spatial splits can reference an object from several leaves, which must
+    // then share its one copy
+    bool sharedLeaves = bvhNodeCount_ != BVHBuilder::NodeCount(sceneObjects_.size());
+    std::unordered_map<const SceneObject*, SceneObject*> copies;
+    sceneObjects_.clear();
+    for (size_t i = 0; i < bvhNodeCount_; i++) {
+        BVHNode& node = bvhRoot_[i];
+        if (!node.IsLeaf() || node.IsEmpty())
+            continue;
+        if (sharedLeaves) {
+            auto copied = copies.find(node.Leaf());
+            if (copied != copies.end()) {
+                node.SetLeaf(copied->second);
+                continue;
+            }
+        }
+        SceneObject* copy = node.Leaf()->CopyTo(layoutArena);
+        if (IsAnimated() || sharedLeaves)
+            copies[node.Leaf()] = copy;
+        node.SetLeaf(copy);
+        sceneObjects_.push_back(copy);
+    }
+    for (auto& animatedObject : animatedObjects_)
+        animatedObject.first = copies[animatedObject.first];
+
+    // Keep the new arena's memory and free the old objects all at once
+    objectArena_.Swap(layoutArena);
+}
+
+bool Scene::PageOutGeometry() {
+    BVHReport report = BVHReport::Analyze(bvhRoot_);
+    if (!pagedGeometry_.Build(bvhRoot_, pageDirectory_, geometryCacheBytes_))
+        return false;
+    pagedReport_ = report;
+    pagedReport_.bytes = pagedGeometry_.ResidentBytes();
+    pagedObjectCount_ = sceneObjects_.size();
+    pagedOut_ = true;
+
+    // Only the top of the tree and the cache stay in memory from here on
+    std::vector<SceneObject*>().swap(sceneObjects_);
+    objectArena_.Reset();
+    bvhArena_.Reset();
+    bvhRoot_ = NULL;
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    return true;
+}
+
+void Scene::MapLeaves(BVHNode* node) {
+    if (node->IsLeaf()) {
+        if (!node->IsEmpty())
+            leafNodes_[node->Leaf()] = node;
+        return;
+    }
+    MapLeaves(node->Left());
+    MapLeaves(node->Right());
 }
 
 }  // namespace RayTracer
@@ -9,10 +9,25 @@
 #include "material.h"
 #include "image.h"
 #include "bvh_node.h"
+#include "bvh_builder.h"
+#include "render_stats.h"
+#include "trace_context.h"
+#include "heatmap.h"
+#include "bvh_report.h"
+#include "compressed_bvh.h"
+#include "leaf_clusters.h"
+#include "paged_geometry.h"
+#include "thread_pool.h"
+#include "light_tree.h"
+#include "denoiser.h"
+#include "render_progress.h"
+#include "render_checkpoint.h"
 
 #include <vector>
 #include <fstream>
 #include <string>
+#include <unordered_map>
+#include <functional>
 
 namespace RayTracer {
 
@@ -20,6 +35,10 @@ namespace RayTracer {
 #define MAX_DEPTH 8
 #define IOR_AIR 1
 #define DOF_SAMPLE_COUNT 20
+#define SOFT_SHADOW_LIGHT_RADIUS 0.5
+#define BVH_REBUILD_RATIO 1.5
+#define PROGRESSIVE_PREVIEW_STEP 4
+#define PROGRESSIVE_PASS_COUNT 10
 
 /// Scene init errors and their corresponding status text
 enum SceneInitStatus {
@@ -39,7 +58,8 @@ enum SceneInitStatus {
     NormalError,
     TexCoordError,
     TriangleError,
-    TextureError
+    TextureError,
+    MotionError
 };
 const std::string sceneInitStatusText[] = {
     "success",
@@ -58,7 +78,8 @@ const std::string sceneInitStatusText[] = {
     "vn",
     "vt",
     "f",
-    "texture"
+    "texture",
+    "motion"
 };
 
 /// A scene containing objects and a camera to render them.
@@ -84,28 +105,164 @@ public:
     /// Getters
     Camera SceneCamera() const { return camera_; }
     Color BackgroundColor() const { return backgroundColor_; }
+    bool SoftShadows() const { return softShadows_; }
+    bool DepthOfField() const { return depthOfField_; }
+    int DofSampleCount() const { return dofSampleCount_; }
+    int ShadowSampleCount() const { return shadowSampleCount_; }
     Color DepthCueingColor() const { return depthCueingColor_; }
     std::vector<PointLight> PointLights() const { return pointLights_; }
     std::vector<DirectionalLight> DirectionalLights() const { return directionalLights_; }
+    /// Returns ray counts and phase timings gathered while loading and rendering
+    const RenderStats& Stats() const { return stats_; }
+    /// Records the time taken to write output, so it is reported with the other phases
+    void SetOutputSeconds(double seconds) { stats_.outputSeconds = seconds; }
+    /// Records the time taken to denoise rendered images
+    void SetDenoiseSeconds(double seconds) { stats_.denoiseSeconds = seconds; }
+    /// Adds counters and render time from a render done elsewhere (e.g. in a worker process)
+    void MergeStats(const RenderStats& stats, double renderSeconds) { stats_.Merge(stats); stats_.renderSeconds += renderSeconds; }
+    /// Clears all counters and timings
+    void ClearStats() { stats_ = RenderStats(); }
+    /// Sets the number of threads used to render (0 = all hardware threads)
+    void SetThreadCount(int threadCount) { threadCount_ = threadCount; }
+    /// Renders on the given shared thread pool instead of creating threads for each render
+    void SetThreadPool(ThreadPool* threadPool) { threadPool_ = threadPool; }
+    /// Replaces the scene camera
+    void SetCamera(Camera camera) { camera_ = camera; }
+    /// Toggles soft shadows
+    void SetSoftShadows(bool softShadows) { softShadows_ = softShadows; }
+    /// Toggles depth of field
+    void SetDepthOfField(bool depthOfField) { depthOfField_ = depthOfField; }
+    /// Sets the rays traced per pixel with depth of field and per light with soft
+    /// shadows (defaults DOF_SAMPLE_COUNT and SHADOW_SAMPLE_COUNT)
+    void SetSampleCounts(int dofSampleCount, int shadowSampleCount);
+    /// Restricts rendering to the pixels in [x0, x1) x [y0, y1) of the full frame.
+    /// Rays are still generated from the full frame camera geometry, so the
+    /// resulting image is exactly that region of a full render.
+    void SetCropWindow(int x0, int y0, int x1, int y1);
+    /// Renders the full frame again
+    void ClearCropWindow() { cropWindow_ = false; }
+    /// Returns true if rendering is restricted to a crop window
+    bool HasCropWindow() const { return cropWindow_; }
+    /// Returns the pixel region [x0, x1) x [y0, y1) that Render covers: the crop
+    /// window clamped to the image, or the whole image if there is none
+    void RenderRegion(int& x0, int& y0, int& x1, int& y1) const;
+    /// Shades each hit with the given number of point lights picked from a light tree
+    /// by estimated contribution, instead of every point light (0 = every light)
+    void SetLightSampleCount(int lightSampleCount) { lightSampleCount_ = lightSampleCount; }
+    /// Backs scene geometry and the BVH with transparent huge pages where available.
+    /// Must be set before the scene is initialized.
+    void SetHugePages(bool hugePages);
+    /// Reports each render's progress to the given tracker, which can also stop a
+    /// render early; rows not yet rendered are then black, or keep the preview and
+    /// earlier passes in a progressive render (NULL = none)
+    void SetProgress(RenderProgress* progress) { progress_ = progress; }
+    /// Returns the number of objects in the scene
+    size_t ObjectCount() const { return pagedOut_ ? pagedObjectCount_ : sceneObjects_.size(); }
 
+    /// Returns true if any object in the scene has a per-frame motion
+    bool IsAnimated() const { return !animatedObjects_.empty(); }
+
+    /// Sets the strategy used when constructing the BVH
+    void SetBVHBuildMode(BVHBuildMode bvhBuildMode) { bvhBuildMode_ = bvhBuildMode; }
+    /// Traverses a compressed copy of the BVH with quantized bounds, which takes a
+    /// fraction of the memory, and frees the full precision tree unless the scene
+    /// is animated and needs it for refitting. Must be set before the BVH is constructed.
+    void SetCompressedBVH(bool compressed) { compressBVH_ = compressed; }
+    /// Tests small subtrees of spheres or of triangles against each ray in one
+    /// SIMD pass instead of traversing them (on by default). Must be set before
+    /// the BVH is constructed; ignored with a compressed BVH.
+    void SetLeafClusters(bool clusters) { clusterLeaves_ = clusters; }
+    /// Once the BVH is constructed, moves its lower subtrees and their objects to
+    /// a page file in the given directory and frees them, paging them back in
+    /// through a cache of at most cacheBytes while rendering (0 = keep everything
+    /// in memory). This bounds memory while rendering only: the whole scene is
+    /// still parsed and its BVH built in memory first. Must be set before the BVH
+    /// is constructed; animated scenes stay in memory, and compressed BVH and leaf
+    /// cluster settings are ignored.
+    void SetGeometryCache(size_t cacheBytes, const std::string& pageDirectory) {
+        geometryCacheBytes_ = cacheBytes;
+        pageDirectory_ = pageDirectory;
+    }
+    /// Returns true if the scene's geometry has been paged out to disk
+    bool IsGeometryPaged() const { return pagedOut_; }
     /// Constructs a BVH for the objects currently in the scene
     void ConstructBVH();
-    /// Returns an image of the scene rendered by tracing rays for each pixel
-    Image Render();
+    /// Moves all animated objects by one frame of motion and refits the BVH,
+    /// rebuilding it instead if tree quality has degraded too far.
+    /// Returns true if the BVH was rebuilt.
+    bool AdvanceFrame();
+    /// Returns quality measures of the BVH that rays traverse
+    BVHReport AnalyzeBVH() const;
+    /// Returns an image of the scene rendered by tracing rays for each pixel,
+    /// optionally recording per-pixel traversal cost heatmaps and the first-hit
+    /// features that guide denoising
+    Image Render(RenderHeatmaps* heatmaps = NULL, RenderFeatures* features = NULL);
+    /// Renders the image progressively: first a preview tracing one pixel in every
+    /// PROGRESSIVE_PREVIEW_STEP x PROGRESSIVE_PREVIEW_STEP block, then passCount passes
+    /// that each trace a share of the full per-pixel sample budget (depth of field and
+    /// soft shadow samples) into a float accumulation buffer. After the preview (pass 0)
+    /// and each pass, onPass is given the current image and may return false to stop.
+    /// First-hit features, if requested, are recorded during the first pass.
+    /// Passes beyond the full budget keep adding samples; renders without soft shadows
+    /// or depth of field are deterministic and take a single pass. With one pass the
+    /// result is identical to Render. A render stopped by its progress tracker returns
+    /// at once, every pixel showing the mean of the passes that reached it.
+    /// Given a checkpoint, the render continues after the passes it holds if it was
+    /// taken from this render, and keeps it up to date after every finished pass, so
+    /// that onPass can save it. Resumed renders end with the same image as
+    /// uninterrupted ones.
+    Image RenderProgressive(int passCount, const std::function<bool(const Image& image, int pass, int passCount)>& onPass,
+        RenderFeatures* features = NULL, RenderCheckpoint* checkpoint = NULL);
+    /// Returns a hash of every setting that decides which samples a render traces:
+    /// camera, sampling options and counts, BVH build mode and render region
+    uint64_t SamplingHash() const;
     /// Returns the color of a ray traced into the scene
-    Color TraceRay(const Ray ray, int iteration = 0, const SceneObject* ignoreObject = NULL) const;
-    /// Casts a ray into the scene, returning info about the nearest hit
+    Color TraceRay(const Ray ray, TraceContext& context, int iteration = 0, const SceneObject* ignoreObject = NULL) const;
+    /// Casts a ray into the scene, returning info about the nearest hit within the ray's range
+    RaycastHit Raycast(const Ray ray, TraceContext& context, const SceneObject* ignoreObject = NULL) const;
+    /// Casts a ray into the scene without recording stats, returning info about the nearest hit
     RaycastHit Raycast(const Ray ray, const SceneObject* ignoreObject = NULL) const;
+    /// Returns the Blinn-Phong diffuse and specular contribution of a light
+    static Vector3 ComputeDiffuseSpecular(Vector3 L, Vector3 N, Vector3 V, Vector3 Od, Vector3 Os, float ka, float kd, float ks, float n);
 
 private:
-    Vector3 ComputeDiffuseSpecular(Vector3 L, Vector3 N, Vector3 V, Vector3 Od, Vector3 Os, float ka, float kd, float ks, float n) const;
-    float InShadow(Vector3 point, Vector3 lightPosition, const SceneObject* ignoreObject = NULL) const;
+    // Kernels specialized on the features enabled for a render, so that the
+    // per ray and per sample paths carry no checks for disabled features
+    template <bool SoftShadows, bool DepthOfField>
+    Color RenderPixel(Vector3 pixelPosition, Vector3 eyePosition, TraceContext& context) const;
+    template <bool SoftShadows>
+    Color TraceRayKernel(const Ray ray, TraceContext& context, int iteration, const SceneObject* ignoreObject) const;
+    // Shadow rays toward point lights end at the light, so objects behind it cast no shadow
+    template <bool SoftShadows>
+    float InShadow(Vector3 point, const PointLight& light, bool pointLight, size_t lightIdx, TraceContext& context, const SceneObject* ignoreObject = NULL) const;
+    bool HitsCachedOccluder(const Ray& shadowRay, const SceneObject* occluder, TraceContext& context, const SceneObject* ignoreObject) const;
     Color DepthCue(Vector3 I, float d) const;
-    BVHNode* ConstructBVHRecursive(std::vector<SceneObject*>& sceneObjects);
-    RaycastHit RaycastBVH(const Ray ray, BVHNode* node, const SceneObject* ignoreObject) const;
-    static bool CompareObectX(SceneObject* a, SceneObject* b) { return a->Position().x() < b->Position().x(); }
-    static bool CompareObectY(SceneObject* a, SceneObject* b) { return a->Position().y() < b->Position().y(); }
-    static bool CompareObectZ(SceneObject* a, SceneObject* b) { return a->Position().z() < b->Position().z(); }
+    // World space position of the viewing window's top left corner and the offsets between pixels
+    struct ViewWindow {
+        Vector3 ul, du, dv;
+    };
+    typedef Color (Scene::*PixelKernel)(Vector3, Vector3, TraceContext&) const;
+    // Prepares per-frame state (light tree, shadow cache) and picks the pixel kernel
+    PixelKernel PrepareRender();
+    ViewWindow ComputeViewWindow() const;
+    // Records the first-hit albedo, camera facing normal and distance of pixel (x, y),
+    // averaged over the pixel's camera rays
+    void RecordFeatures(RenderFeatures& features, int x, int y, Vector3 pixelPosition, Vector3 eyePosition,
+        TraceContext& context) const;
+    // Runs renderRow for every row in [y0, y1) on the render threads, each with its
+    // own trace context, and merges their counters into the scene stats. Rows of
+    // rowPixels pixels are counted as progress, and no more rows start once the
+    // progress tracker says to stop. Returns false if rows were skipped.
+    bool RenderRows(int y0, int y1, int rowPixels, const std::function<void(int y, TraceContext& context)>& renderRow);
+    // Shrinks the ray's tMax to each hit found, culling farther nodes and objects
+    RaycastHit RaycastBVH(Ray& ray, BVHNode* node, TraceContext& context, const SceneObject* ignoreObject) const;
+    void RefitBVHFromLeaf(BVHNode* leaf);
+    float BVHQuality() const;
+    float BVHAreaSum(BVHNode* node) const;
+    void MapLeaves(BVHNode* node);
+    void LayOutObjectsInLeafOrder();
+    // Returns false, keeping the scene in memory, if the page file could not be written
+    bool PageOutGeometry();
     float viewingDistance_ = 3;
     bool softShadows_ = false;
     bool depthOfField_ = false;
@@ -113,12 +270,50 @@ private:
     Color backgroundColor_;
     Color depthCueingColor_;
     float aMax_, aMin_, distMax_, distMin_;
-    std::vector<Material> materials_;
+    std::vector<ShadingMaterial> materials_;
     std::vector<Image*> textures_;
     std::vector<SceneObject*> sceneObjects_;
+    Arena objectArena_;
+    Arena bvhArena_;
     std::vector<PointLight> pointLights_;
     std::vector<DirectionalLight> directionalLights_;
-    BVHNode* bvhRoot_;
+    // Point lights offset from the shaded point, one per directional light
+    std::vector<PointLight> directionalShadowLights_;
+    std::vector<std::pair<SceneObject*, Vector3>> animatedObjects_;
+    std::unordered_map<const SceneObject*, BVHNode*> leafNodes_;
+    BVHNode* bvhRoot_ = NULL;
+    size_t bvhNodeCount_ = 0;
+    BVHBuildMode bvhBuildMode_ = MedianSplitBVH;
+    bool compressBVH_ = false;
+    CompressedBVH compressedBVH_;
+    bool clusterLeaves_ = true;
+    LeafClusters leafClusters_;
+    size_t geometryCacheBytes_ = 0;
+    std::string pageDirectory_;
+    bool pagedOut_ = false;
+    PagedGeometry pagedGeometry_;
+    size_t pagedObjectCount_ = 0;
+    // Quality of the full tree, measured before its lower subtrees were paged out
+    BVHReport pagedReport_;
+    float bvhAreaSum_ = 0;
+    float bvhBuildQuality_ = 0;
+    RenderStats stats_;
+    int threadCount_ = 0;
+    ThreadPool* threadPool_ = NULL;
+    int lightSampleCount_ = 0;
+    bool shadowCacheEnabled_ = false;
+    LightTree lightTree_;
+    // Set when lights may have changed since the light tree was built, and at every frame
+    bool lightTreeStale_ = true;
+    RenderProgress* progress_ = NULL;
+    // Samples traced per pixel with depth of field and per light with soft shadows,
+    // and the share of them traced by each pass of a progressive render
+    int dofSampleCount_ = DOF_SAMPLE_COUNT;
+    int shadowSampleCount_ = SHADOW_SAMPLE_COUNT;
+    int passDofSampleCount_ = DOF_SAMPLE_COUNT;
+    int passShadowSampleCount_ = SHADOW_SAMPLE_COUNT;
+    bool cropWindow_ = false;
+    int cropX0_ = 0, cropY0_ = 0, cropX1_ = 0, cropY1_ = 0;
 };
 
 }
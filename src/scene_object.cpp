@@ -20,10 +20,22 @@ AABB SceneObject::BoundingBox() const {
     return AABB();
 }
 
-RaycastHit SceneObject::IntersectRay(Ray ray) const {
+bool SceneObject::ClipBoundingBox(const AABB& box, AABB& clipped) const {
+    return AABB::Intersection(BoundingBox(), box, clipped);
+}
+
+RaycastHit SceneObject::IntersectRay(const Ray& ray) const {
     RaycastHit hitInfo;
     return hitInfo;
 }
 
+SceneObject* SceneObject::CopyTo(Arena& arena) const {
+    return arena.New<SceneObject>(*this);
+}
+
+void SceneObject::Translate(Vector3 offset) {
+    position_ = position_ + offset;
+}
+
 
 }  // namespace RayTracer
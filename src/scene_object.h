@@ -6,11 +6,19 @@
 #include "ray.h"
 #include "raycast_hit.h"
 #include "aabb.h"
+#include "arena.h"
 
 namespace RayTracer {
 
 class AABB;
 
+/// Kinds of primitive a scene object can be
+enum ObjectType {
+    GenericObject,
+    SphereObject,
+    TriangleObject
+};
+
 /// An object that can be positioned in the scene, rendered, and intersected with.
 class SceneObject {
 public:
@@ -22,13 +30,29 @@ public:
     /// Destructor
     virtual ~SceneObject() {}
 
+    /// Returns the kind of primitive this object is
+    virtual ObjectType Type() const { return GenericObject; }
     /// Returns object position
     Vector3 Position() const { return position_; }
+    /// Returns the indices of the object's material and texture
+    int MaterialIdx() const { return materialIdx_; }
+    int TextureIdx() const { return textureIdx_; }
     /// Returns object bounding box
     virtual AABB BoundingBox() const;
+    /// Computes bounds of the part of the object inside the given box, returning
+    /// false if none of it is. By default the bounding box is clipped to the box;
+    /// objects that can do better bound the clipped surface itself.
+    virtual bool ClipBoundingBox(const AABB& box, AABB& clipped) const;
 
     /// Performs a raycast against this object, returning raycast hit information
-    virtual RaycastHit IntersectRay(Ray ray) const;
+    /// for the nearest hit within the ray's range
+    virtual RaycastHit IntersectRay(const Ray& ray) const;
+
+    /// Moves the object by the given offset
+    virtual void Translate(Vector3 offset);
+
+    /// Copies the object into the given arena, returning the copy
+    virtual SceneObject* CopyTo(Arena& arena) const;
 
 protected:
     Vector3 position_;
@@ -17,7 +17,7 @@ AABB Sphere::BoundingBox() const {
     return AABB(position_, radius_);
 }
 
-RaycastHit Sphere::IntersectRay(Ray ray) const {
+RaycastHit Sphere::IntersectRay(const Ray& ray) const {
     // Initialize raycast hit info
     RaycastHit hitInfo;
     hitInfo.hit = false;
@@ -32,26 +32,31 @@ RaycastHit Sphere::IntersectRay(Ray ray) const {
         float x = sqrt(radius_*radius_ - y*y);  // Distance from t along ray to intersection points
         float t1 = t - x;  // Closest intersection distance
         //float t2 = t + x;  // Farthest intersection distance
-        // Only consider it an intersection if it's in the positive direction along the ray
-        if (t1 > 0) {
-            hitInfo.hit = true;
-            hitInfo.distance = t1;
-            hitInfo.point = ray.GetPoint(t1);
-            hitInfo.normal = Vector3::Normalize(hitInfo.point - position_);
-            hitInfo.materialIdx = materialIdx_;
-            hitInfo.textureIdx = textureIdx_;
-            if (textureIdx_ != -1) {
-                float theta = std::atan2(hitInfo.normal.x(), hitInfo.normal.z());
-                float phi = std::acos(hitInfo.normal.y());
-                hitInfo.u = (theta + M_PI) / (2*M_PI);//theta > 0 ? theta/(2*M_PI) : (theta + 2*M_PI) / (2*M_PI);
-                hitInfo.v = phi / M_PI;
-            }
-            hitInfo.object = this;
-        }
+        // Only consider it an intersection if it's within the ray's range
+        if (ray.InRange(t1))
+            return HitAt(ray, t1);
     }
 
     // Return infinity if no collision
     return hitInfo;
 }
 
+RaycastHit Sphere::HitAt(const Ray& ray, float t) const {
+    RaycastHit hitInfo;
+    hitInfo.hit = true;
+    hitInfo.distance = t;
+    hitInfo.point = ray.GetPoint(t);
+    hitInfo.normal = Vector3::Normalize(hitInfo.point - position_);
+    hitInfo.materialIdx = materialIdx_;
+    hitInfo.textureIdx = textureIdx_;
+    if (textureIdx_ != -1) {
+        float theta = std::atan2(hitInfo.normal.x(), hitInfo.normal.z());
+        float phi = std::acos(hitInfo.normal.y());
+        hitInfo.u = (theta + M_PI) / (2*M_PI);//theta > 0 ? theta/(2*M_PI) : (theta + 2*M_PI) / (2*M_PI);
+        hitInfo.v = phi / M_PI;
+    }
+    hitInfo.object = this;
+    return hitInfo;
+}
+
 }  // namespace RayTracer
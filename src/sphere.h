@@ -16,13 +16,17 @@ public:
     Sphere(Vector3 position, float radius, int materialIdx, int textureIdx);
     ~Sphere() {}
 
+    ObjectType Type() const { return SphereObject; }
+    SceneObject* CopyTo(Arena& arena) const { return arena.New<Sphere>(*this); }
     /// Returns sphere radius
     float Radius() const { return radius_; }
     // Returns bounding box
     AABB BoundingBox() const;
 
     /// Performs a raycast against this sphere, returning raycast hit information
-    RaycastHit IntersectRay(Ray ray) const;
+    RaycastHit IntersectRay(const Ray& ray) const;
+    /// Returns the hit information for a ray known to hit this sphere at t
+    RaycastHit HitAt(const Ray& ray, float t) const;
 
 private:
     float radius_;
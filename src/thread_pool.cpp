@@ -0,0 +1,62 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+namespace RayTracer {
+
+ThreadPool::ThreadPool(int threadCount) {
+    threadCount_ = threadCount > 0 ? threadCount : std::max(1u, std::thread::hardware_concurrency());
+    for (int t = 1; t < threadCount_; t++)
+        workers_.push_back(std::thread(&ThreadPool::WorkerLoop, this, t));
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    jobReady_.notify_all();
+    for (auto& worker : workers_)
+        worker.join();
+}
+
+void ThreadPool::Run(std::function<void(int)> job) {
+    std::lock_guard<std::mutex> runLock(runMutex_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job_ = job;
+        remaining_ = threadCount_ - 1;
+        generation_++;
+    }
+    jobReady_.notify_all();
+
+    job(0);
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    jobDone_.wait(lock, [this]() { return remaining_ == 0; });
+    job_ = nullptr;
+}
+
+void ThreadPool::WorkerLoop(int threadIdx) {
+    unsigned long seenGeneration = 0;
+    while (true) {
+        std::function<void(int)> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            jobReady_.wait(lock, [this, seenGeneration]() { return stopping_ || generation_ != seenGeneration; });
+            if (stopping_) return;
+            seenGeneration = generation_;
+            job = job_;
+        }
+
+        job(threadIdx);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            remaining_--;
+        }
+        jobDone_.notify_all();
+    }
+}
+
+}  // namespace RayTracer
@@ -0,0 +1,47 @@
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+namespace RayTracer {
+
+/// A fixed set of worker threads that stay alive between jobs, so that
+/// repeated renders do not pay for creating and joining threads.
+class ThreadPool {
+public:
+
+    /// Creates a pool with given number of threads (0 = all hardware threads)
+    ThreadPool(int threadCount = 0);
+    /// Stops and joins all worker threads
+    ~ThreadPool();
+
+    /// Returns the number of threads that run each job, including the calling thread
+    int ThreadCount() const { return threadCount_; }
+
+    /// Runs job(threadIdx) once on every thread of the pool, using the calling
+    /// thread as thread 0, and returns once all have finished. Jobs submitted
+    /// from several threads at once are run one after another.
+    void Run(std::function<void(int)> job);
+
+private:
+    void WorkerLoop(int threadIdx);
+
+    int threadCount_;
+    std::vector<std::thread> workers_;
+    std::mutex runMutex_;
+    std::mutex mutex_;
+    std::condition_variable jobReady_;
+    std::condition_variable jobDone_;
+    std::function<void(int)> job_;
+    unsigned long generation_ = 0;
+    int remaining_ = 0;
+    bool stopping_ = false;
+};
+
+}  // namespace RayTracer
+
+#endif  // THREAD_POOL_H_
@@ -0,0 +1,17 @@
+#include "timer.h"
+
+namespace RayTracer {
+
+Timer::Timer() {
+    start_ = std::chrono::steady_clock::now();
+}
+
+void Timer::Reset() {
+    start_ = std::chrono::steady_clock::now();
+}
+
+double Timer::Seconds() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+}
+
+}  // namespace RayTracer
@@ -0,0 +1,26 @@
+#ifndef TIMER_H_
+#define TIMER_H_
+
+#include <chrono>
+
+namespace RayTracer {
+
+/// A simple wall clock stopwatch for measuring elapsed time.
+class Timer {
+public:
+
+    /// Creates a timer that starts immediately
+    Timer();
+
+    /// Restarts the timer
+    void Reset();
+    /// Returns seconds elapsed since the timer was created or last reset
+    double Seconds() const;
+
+private:
+    std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace RayTracer
+
+#endif  // TIMER_H_
@@ -0,0 +1,24 @@
+#ifndef TRACE_CONTEXT_H_
+#define TRACE_CONTEXT_H_
+
+#include "render_stats.h"
+#include "random.h"
+#include "scene_object.h"
+
+#include <vector>
+
+namespace RayTracer {
+
+/// A struct containing per-thread state carried through ray tracing,
+/// so that render threads never share mutable data.
+struct TraceContext {
+    RenderStats stats;
+    Random random;
+    /// The object that last blocked a shadow ray towards each light, tested
+    /// first by the next shadow ray to that light before traversing the BVH
+    std::vector<const SceneObject*> shadowOccluders;
+};
+
+}  // namespace RayTracer
+
+#endif  // TRACE_CONTEXT_H_
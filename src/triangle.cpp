@@ -1,4 +1,6 @@
 #include "triangle.h"
+
+#include <algorithm>
     #include <iostream>
 
 namespace RayTracer {
@@ -31,15 +33,62 @@ AABB Triangle::BoundingBox() const {
     return AABB(vertices_[0], vertices_[1], vertices_[2]);
 }
 
-RaycastHit Triangle::IntersectRay(Ray ray) const {
+bool Triangle::ClipBoundingBox(const AABB& box, AABB& clipped) const {
+    // Clip the triangle against each face of the box in turn (Sutherland-Hodgman).
+    // Every face adds at most one vertex, so the polygon never exceeds nine.
+    Vector3 polygon[9] = { vertices_[0], vertices_[1], vertices_[2] };
+    Vector3 clippedPolygon[9];
+    int vertexCount = 3;
+    for (int face = 0; face < 6; face++) {
+        int axis = face % 3;
+        bool upper = face >= 3;
+        float plane = upper ? box.Max()[axis] : box.Min()[axis];
+        int clippedCount = 0;
+        for (int i = 0; i < vertexCount; i++) {
+            const Vector3& a = polygon[i];
+            const Vector3& b = polygon[(i + 1) % vertexCount];
+            // Signed distances inside the face are positive
+            float da = upper ? plane - a[axis] : a[axis] - plane;
+            float db = upper ? plane - b[axis] : b[axis] - plane;
+            if (da >= 0)
+                clippedPolygon[clippedCount++] = a;
+            if ((da >= 0) != (db >= 0))
+                clippedPolygon[clippedCount++] = a + (da / (da - db)) * (b - a);
+        }
+        if (clippedCount == 0)
+            return false;
+        std::copy(clippedPolygon, clippedPolygon + clippedCount, polygon);
+        vertexCount = clippedCount;
+    }
+
+    Vector3 min = polygon[0];
+    Vector3 max = polygon[0];
+    for (int i = 1; i < vertexCount; i++) {
+        min = Vector3::Min(min, polygon[i]);
+        max = Vector3::Max(max, polygon[i]);
+    }
+    // Interpolated vertices may round inwards; widen by a hair within the box so
+    // the bounds always cover the clipped surface
+    Vector3 margin = (box.Max() - box.Min()) * 1e-5f;
+    return AABB::Intersection(AABB(min - margin, max + margin), box, clipped);
+}
+
+void Triangle::Translate(Vector3 offset) {
+    SceneObject::Translate(offset);
+    for (int i = 0; i < 3; i++)
+        vertices_[i] = vertices_[i] + offset;
+    d_ = Vector3::Dot(normal_, -vertices_[0]);
+}
+
+RaycastHit Triangle::IntersectRay(const Ray& ray) const {
     // Initialize raycast hit info
     RaycastHit hitInfo;
     hitInfo.hit = false;
     hitInfo.distance = std::numeric_limits<float>::infinity();
 
-    // Does ray intersect the plane this triangle lies within
+    // Does ray intersect the plane this triangle lies within, inside the ray's range
     float t = -(Vector3::Dot(normal_, ray.Origin()) + d_) / Vector3::Dot(normal_, ray.Direction());
-    if (t < 0)
+    if (!ray.InRange(t))
         return hitInfo;
 
     // Does the ray intersection point lie within the triangle
@@ -63,8 +112,14 @@ RaycastHit Triangle::IntersectRay(Ray ray) const {
     if (a < 0 || a > 1 ||b < 0 || b > 1 || y < 0 || y > 1)
         return hitInfo;
 
+    return HitAt(p, Vector3::Distance(ray.Origin(), p), b, y);
+}
+
+RaycastHit Triangle::HitAt(Vector3 p, float distance, float b, float y) const {
+    float a = 1-(b+y);
+    RaycastHit hitInfo;
     hitInfo.hit = true;
-    hitInfo.distance = Vector3::Distance(ray.Origin(), p);
+    hitInfo.distance = distance;
     hitInfo.point = p;
     hitInfo.normal = hasNormals_ ? a*normals_[0] + b*normals_[1] + y*normals_[2] : normal_;
     hitInfo.materialIdx = materialIdx_;
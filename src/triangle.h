@@ -16,8 +16,28 @@ public:
     Triangle(Vector3 vertices[3], Vector3 normals[3], Vector3 texCoords[3], int materialIdx, int textureIdx, bool hasNormals = false, bool hasTexCoords = false);
     ~Triangle() {}
 
+    ObjectType Type() const { return TriangleObject; }
+    SceneObject* CopyTo(Arena& arena) const { return arena.New<Triangle>(*this); }
     AABB BoundingBox() const;
-    RaycastHit IntersectRay(Ray ray) const;
+    bool ClipBoundingBox(const AABB& box, AABB& clipped) const;
+    RaycastHit IntersectRay(const Ray& ray) const;
+    /// Returns the hit information for a ray known to hit this triangle at
+    /// point p, the given distance away, with barycentric coordinates (1-(b+y), b, y)
+    RaycastHit HitAt(Vector3 p, float distance, float b, float y) const;
+    void Translate(Vector3 offset);
+
+    /// Returns the given vertex (0, 1 or 2)
+    Vector3 Vertex(int i) const { return vertices_[i]; }
+    /// Returns the normal given for a vertex, if the triangle has vertex normals
+    Vector3 VertexNormal(int i) const { return normals_[i]; }
+    /// Returns the texture coordinates given for a vertex, if the triangle has them
+    Vector3 TexCoord(int i) const { return texCoords_[i]; }
+    bool HasNormals() const { return hasNormals_; }
+    bool HasTexCoords() const { return hasTexCoords_; }
+    /// Returns the unit normal of the triangle's plane
+    Vector3 PlaneNormal() const { return normal_; }
+    /// Returns the offset d of the triangle's plane, on which Dot(normal, p) + d = 0
+    float PlaneOffset() const { return d_; }
 
 private:
     Vector3 vertices_[3];
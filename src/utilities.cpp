@@ -1,5 +1,7 @@
 #include "utilities.h"
 
+#include <fstream>
+
 namespace RayTracer {
 
 std::string Utilities::ReplaceExtension(const std::string& filename, std::string new_extension)
@@ -9,6 +11,16 @@ std::string Utilities::ReplaceExtension(const std::string& filename, std::string
     return filename.substr(0, lastdot) + new_extension;
 }
 
+std::string Utilities::FrameFileName(const std::string& filename, int frame)
+{
+    std::string frameNumber = std::to_string(frame);
+    if (frameNumber.size() < 4)
+        frameNumber.insert(0, 4 - frameNumber.size(), '0');
+    size_t lastdot = filename.find_last_of(".");
+    if (lastdot == std::string::npos) return filename + "_" + frameNumber;
+    return filename.substr(0, lastdot) + "_" + frameNumber + filename.substr(lastdot);
+}
+
 std::vector<std::string> Utilities::SplitString(std::string s, std::string del)
 {
     std::vector<std::string> splitString;
@@ -23,4 +35,18 @@ std::vector<std::string> Utilities::SplitString(std::string s, std::string del)
     return splitString;
 }
 
+uint64_t Utilities::HashFile(const std::string& filename)
+{
+    std::ifstream file(filename, std::ios::binary);
+    uint64_t hash = 14695981039346656037ull;
+    char buffer[4096];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+        for (std::streamsize i = 0; i < file.gcount(); i++) {
+            hash ^= (unsigned char)buffer[i];
+            hash *= 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
 }  // namespace RayTracer
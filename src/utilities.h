@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <cstdint>
 
 namespace RayTracer {
 
@@ -11,8 +12,12 @@ class Utilities {
 public:
     // Replaces a file extention with the given string (where given string should include ".")
     static std::string ReplaceExtension(const std::string& filename, std::string new_extension);
+    // Inserts a zero-padded frame number before the file extension (e.g. "out.ppm" -> "out_0003.ppm")
+    static std::string FrameFileName(const std::string& filename, int frame);
     // Splits string by a delimeter
     static std::vector<std::string> SplitString(std::string s, std::string del = " ");
+    // Returns a 64 bit FNV-1a hash of a file's contents (that of an empty file if it cannot be read)
+    static uint64_t HashFile(const std::string& filename);
 };
 
 }  // namespace RayTracer
@@ -1,6 +1,21 @@
 #ifndef VECTOR3_H_
 #define VECTOR3_H_
 
+#include <cmath>
+#include <limits>
+
+// Building with RAYTRACER_SIMD stores vectors as four aligned floats and
+// evaluates component-wise operations with SSE. Results are bit-identical to
+// the scalar build, since each lane performs the same IEEE operation and
+// reductions such as Dot still sum in x, y, z order.
+#if defined(RAYTRACER_SIMD) && defined(__SSE2__)
+#define RAYTRACER_SSE 1
+#include <xmmintrin.h>
+#define RAYTRACER_MATH inline
+#else
+#define RAYTRACER_MATH constexpr
+#endif
+
 namespace RayTracer {
 
 /// A 3D vector. Allows for basic mathematical operations and can
@@ -9,58 +24,179 @@ class Vector3 {
 public:
 
     /// Default constructor creates a zero vector
-    Vector3();
+    constexpr Vector3() : v_{0, 0, 0} {}
     /// Creates a vector (x, y, z)
-    Vector3(float x, float y, float z);
+    constexpr Vector3(float x, float y, float z) : v_{x, y, z} {}
 
     /// Getters for x, y and z vector components
-    float x() const { return x_; }
-    float y() const { return y_; }
-    float z() const { return z_; }
+    constexpr float x() const { return v_[0]; }
+    constexpr float y() const { return v_[1]; }
+    constexpr float z() const { return v_[2]; }
+    /// Returns the component along the given axis (0 = x, 1 = y, 2 = z)
+    constexpr float operator[](int axis) const { return v_[axis]; }
 
     /// Returns the length of the vector
-    float Length() const;
+    inline float Length() const;
 
     /// Normalizes the vector
-    void Normalize();
+    inline void Normalize();
 
     /// Returns normalized vector
-    static Vector3 Normalize(const Vector3& v);
+    static inline Vector3 Normalize(const Vector3& v);
     /// Returns distance between two points
-    static float Distance(const Vector3& v1, const Vector3& v2);
+    static inline float Distance(const Vector3& v1, const Vector3& v2);
     /// Returns the dot product of two vectors
-    static float Dot(const Vector3& v1, const Vector3& v2);
+    static RAYTRACER_MATH float Dot(const Vector3& v1, const Vector3& v2);
     /// Returns the cross product of two vectors
-    static Vector3 Cross(const Vector3& v1, const Vector3& v2);
+    static RAYTRACER_MATH Vector3 Cross(const Vector3& v1, const Vector3& v2);
     /// Returns component by component max of two vectors
-    static Vector3 Max(const Vector3& v1, const Vector3& v2);
+    static RAYTRACER_MATH Vector3 Max(const Vector3& v1, const Vector3& v2);
     /// Returns component by component min of two vectors
-    static Vector3 Min(const Vector3& v1, const Vector3& v2);
+    static RAYTRACER_MATH Vector3 Min(const Vector3& v1, const Vector3& v2);
+
+#ifdef RAYTRACER_SSE
+    /// Creates a vector from four SSE lanes, ignoring the last
+    explicit Vector3(__m128 v) { _mm_store_ps(v_, v); }
+    /// Returns the vector as four SSE lanes
+    __m128 Load() const { return _mm_load_ps(v_); }
+#endif
 
 private:
-    float x_, y_, z_;
+#ifdef RAYTRACER_SSE
+    alignas(16) float v_[4];
+#else
+    float v_[3];
+#endif
 };
 
 // ----- Operator Overloads -----
 
+#ifdef RAYTRACER_SSE
+
+/// Adds two vectors
+inline Vector3 operator+(const Vector3& v1, const Vector3& v2) { return Vector3(_mm_add_ps(v1.Load(), v2.Load())); }
+
+/// Subtracts two vectors
+inline Vector3 operator-(const Vector3& v1, const Vector3& v2) { return Vector3(_mm_sub_ps(v1.Load(), v2.Load())); }
+/// Negates a vector
+inline Vector3 operator-(const Vector3& v) { return Vector3(_mm_xor_ps(v.Load(), _mm_set1_ps(-0.0f))); }
+
+/// Multiplies a vector by a scalar
+inline Vector3 operator*(const float s, const Vector3& v) { return Vector3(_mm_mul_ps(_mm_set1_ps(s), v.Load())); }
+inline Vector3 operator*(const Vector3& v, const float s) { return Vector3(_mm_mul_ps(_mm_set1_ps(s), v.Load())); }
+
+// Multiplies a vector by a vector (component-wise)
+inline Vector3 operator*(const Vector3& v1, const Vector3& v2) { return Vector3(_mm_mul_ps(v1.Load(), v2.Load())); }
+
+/// Divides a vector by a scalar
+inline Vector3 operator/(const Vector3& v, const float s) { return Vector3(_mm_div_ps(v.Load(), _mm_set1_ps(s))); }
+inline Vector3 operator/(const float s, const Vector3& v) { return Vector3(_mm_div_ps(_mm_set1_ps(s), v.Load())); }
+
+inline float Vector3::Dot(const Vector3& v1, const Vector3& v2) {
+    Vector3 p(_mm_mul_ps(v1.Load(), v2.Load()));
+    return p.x() + p.y() + p.z();
+}
+
+inline Vector3 Vector3::Cross(const Vector3& v1, const Vector3& v2) {
+    __m128 a = v1.Load();
+    __m128 b = v2.Load();
+    __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 aZXY = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 bZXY = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 1, 0, 2));
+    return Vector3(_mm_sub_ps(_mm_mul_ps(aYZX, bZXY), _mm_mul_ps(aZXY, bYZX)));
+}
+
+// Operands are ordered to match std::max and std::min for equal values and NaNs
+inline Vector3 Vector3::Max(const Vector3& v1, const Vector3& v2) { return Vector3(_mm_max_ps(v2.Load(), v1.Load())); }
+inline Vector3 Vector3::Min(const Vector3& v1, const Vector3& v2) { return Vector3(_mm_min_ps(v2.Load(), v1.Load())); }
+
+#else
+
 /// Adds two vectors
-Vector3 operator+(const Vector3& v1, const Vector3& v2);
+constexpr Vector3 operator+(const Vector3& v1, const Vector3& v2) {
+    return Vector3(v1.x() + v2.x(), v1.y() + v2.y(), v1.z() + v2.z());
+}
 
 /// Subtracts two vectors
-Vector3 operator-(const Vector3& v1, const Vector3& v2);
+constexpr Vector3 operator-(const Vector3& v1, const Vector3& v2) {
+    return Vector3(v1.x() - v2.x(), v1.y() - v2.y(), v1.z() - v2.z());
+}
 /// Negates a vector
-Vector3 operator-(const Vector3& v1);
+constexpr Vector3 operator-(const Vector3& v) {
+    return Vector3(-v.x(), -v.y(), -v.z());
+}
 
 /// Multiplies a vector by a scalar
-Vector3 operator*(const float s, const Vector3& v);
-Vector3 operator*(const Vector3& v, const float s);
+constexpr Vector3 operator*(const float s, const Vector3& v) {
+    return Vector3(s * v.x(), s * v.y(), s * v.z());
+}
+constexpr Vector3 operator*(const Vector3& v, const float s) {
+    return Vector3(s * v.x(), s * v.y(), s * v.z());
+}
 
 // Multiplies a vector by a vector (component-wise)
-Vector3 operator*(const Vector3& v1, const Vector3& v2);
+constexpr Vector3 operator*(const Vector3& v1, const Vector3& v2) {
+    return Vector3(v1.x() * v2.x(), v1.y() * v2.y(), v1.z() * v2.z());
+}
 
 /// Divides a vector by a scalar
-Vector3 operator/(const Vector3& v, const float s);
-Vector3 operator/(const float s, const Vector3& v);
+constexpr Vector3 operator/(const Vector3& v, const float s) {
+    return Vector3(v.x() / s, v.y() / s, v.z() / s);
+}
+constexpr Vector3 operator/(const float s, const Vector3& v) {
+    return Vector3(s / v.x(), s / v.y(), s / v.z());
+}
+
+constexpr float Vector3::Dot(const Vector3& v1, const Vector3& v2) {
+    return v1.x()*v2.x() + v1.y()*v2.y() + v1.z()*v2.z();
+}
+
+constexpr Vector3 Vector3::Cross(const Vector3& v1, const Vector3& v2) {
+    return Vector3(
+        v1.y()*v2.z()-v1.z()*v2.y(),
+        v1.z()*v2.x()-v1.x()*v2.z(),
+        v1.x()*v2.y()-v1.y()*v2.x()
+    );
+}
+
+constexpr Vector3 Vector3::Max(const Vector3& v1, const Vector3& v2) {
+    return Vector3(
+        v1.x() < v2.x() ? v2.x() : v1.x(),
+        v1.y() < v2.y() ? v2.y() : v1.y(),
+        v1.z() < v2.z() ? v2.z() : v1.z()
+    );
+}
+
+constexpr Vector3 Vector3::Min(const Vector3& v1, const Vector3& v2) {
+    return Vector3(
+        v2.x() < v1.x() ? v2.x() : v1.x(),
+        v2.y() < v1.y() ? v2.y() : v1.y(),
+        v2.z() < v1.z() ? v2.z() : v1.z()
+    );
+}
+
+#endif  // RAYTRACER_SSE
+
+inline float Vector3::Length() const {
+    return std::sqrt(Dot(*this, *this));
+}
+
+inline void Vector3::Normalize() {
+    float length = Length();
+    if (length < std::numeric_limits<float>::epsilon()) return;
+    *this = *this / length;
+}
+
+inline Vector3 Vector3::Normalize(const Vector3& v) {
+    float length = v.Length();
+    if (length < std::numeric_limits<float>::epsilon()) return v;
+    return v / length;
+}
+
+inline float Vector3::Distance(const Vector3& v1, const Vector3& v2) {
+    return (v1 - v2).Length();
+}
 
 }  // namespace RayTracer
 